@@ -7,457 +7,6088 @@
 #include <string.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <limits.h>
+#include <glob.h>
+#include <math.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/random.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CSV_INDEX_X86
+#endif
 #include "libs/ctoolbox.c"
 
 /* Interface:
  * cgrade init                      // init the cgrade.csv in working directory
+ * cgrade init --time               // init a cgrade.csv whose rows carry the time they were added
  * cgrade add algd2 5.25 "test 1"   // add grade to algd2 with comment 
+ * cgrade add --from grades.csv     // add all subject;grade;comment records of a file
  * cgrade status                    // show status for all subjects
  * cgrade status algd2              // show status for algd2 
+ * cgrade status --all              // show stats of every subject
+ * cgrade status algd2 --stats      // show median, percentiles and a histogram
+ * cgrade status --format json      // status as csv, tsv or json
+ * cgrade status --no-list          // only count and average, not every grade
+ * cgrade --csv a.csv --csv dir status   // stats per file and combined, also for a pattern like 'dir/<name>*.csv'
+ * cgrade status --watch            // print the stats again whenever the csv changes
+ * cgrade status --where grade>=4  // only rows matching subject, grade and comment predicates
+ * cgrade status --since 2026-09-01 // only rows added since (or --until) a date, needs init --time
  * cgrade rm                        // removes last added grade
  * cgrade rm algd2 5.25             // remove grade in algd2 that is 5.25 (equivalent to `rm algd2 5.25 0`)
  * cgrade rm algd2 5.25 1           // remove the 2nd grade in algd2 that is 5.25
+ * cgrade rm algd2 5.25 0 dbs 4 1   // remove several grades in one pass
+ * cgrade compact                   // drop the removed grades from the csv
+ * cgrade shell                     // run commands interactively on the loaded csv
+ * cgrade batch < commands.txt      // run commands from stdin on the loaded csv
+ * cgrade serve --socket PATH       // serve commands over a unix socket
+ * cgrade --connect PATH status     // run a command on a server
+ * cgrade convert --to bin          // store the grades in the binary format
+ * cgrade --profile json status     // print phase timings and I/O counters to stderr
+ * cgrade convert --to csv --out x  // export the grades to the csv file x
  *
- * Improvements Pending:
- * - Instead of reading and writing the csv file manually whenever some
- *   change is required, abstract the file by providing a data structure
- *   that can hold grades and then implement a function that reads from
- *   the csv file into the data structure and a function that writes the
- *   data structure into the csv file. This way, the data can be manipulated
- *   on a C level rather than on OS based read/write operations.
+ * The csv file is abstracted by the GradeBook data structure:
+ * gradebook_load reads the csv file into it and gradebook_save
+ * writes it back, so commands manipulate grades on a C level
+ * rather than on OS based read/write operations.
+ *
+ * Besides the csv format, a grade book can be stored in a columnar
+ * binary format (see BinFileHeader). --csv accepts either, the
+ * format is detected by the magic at the start of the file.
  */
 
 #define APP_NAME "cgrade"
 #define DEFAULT_CSV_NAME "cgrade.csv"
-#define TMP_CSV_PATH "./tmp_cgrade.csv"
+#define CSV_EXTENSION ".csv"
+#define CSV_GLOB_CHARS "*?["
+#define TMP_CSV_SUFFIX ".XXXXXX"
 #define CSV_HEADER "subject;grade;comment"
+#define CSV_HEADER_TIMED "subject;grade;time;comment" // the time is part of the comment field
 #define CSV_DELIMITER ';'
+#define CSV_READER_BUF_SIZE (64 * 1024)
+#define CSV_WRITER_BUF_SIZE (64 * 1024)
+#define ARENA_BLOCK_SIZE (64 * 1024)
+#define OUT_BUF_SIZE (64 * 1024)
+#define OUT_LINE_MAX 512
+#define DEL_SUFFIX ".del"
+#define DEL_MAGIC "CGDL"
+#define DEL_VERSION 1
+#define DEL_COMPACT_DIVISOR 4 // compact once a quarter of the csv is deleted rows
+#define SIDECAR_SUFFIX ".idx"
+#define SIDECAR_MAGIC "CGIX"
+#define SIDECAR_VERSION 4
+#define SIDECAR_TAIL_SIZE 64
+#define SIDECAR_NAME_MAX 4096
+#define TIME_INDEX_SUFFIX ".tix"
+#define TIME_INDEX_MAGIC "CGTI"
+#define TIME_INDEX_VERSION 1
+#define TIME_INDEX_STRIDE 1024 // rows per entry of the time index
+#define BIN_MAGIC "CGBN"
+#define BIN_VERSION 1
+#define BIN_SEGMENT_MAGIC "CGSG"
+#define BIN_MAX_SUBJECTS 65535
+#define CSV_INDEX_BLOCK (64 * 1024)
+#define STATS_MIN_CHUNK (1024 * 1024) // smallest byte range worth a thread
+#define STATS_SPLIT_SIZE (8 * 1024 * 1024) // files from this size are split into several tasks
+#define STATS_TASK_SIZE (4 * 1024 * 1024)  // byte range of a task of a split file
+#define WATCH_EVENT_BUF_SIZE 4096
+#define HIST_MAX_GRADE 1000 // histograms count grades up to 10.00 in buckets
+#define HIST_BAR_WIDTH 40
 
 #define CMD_NAME_INIT "init"
 #define CMD_NAME_ADD "add"
 #define CMD_NAME_STATUS "status"
 #define CMD_NAME_RM "rm"
+#define CMD_NAME_SHELL "shell"
+#define CMD_NAME_BATCH "batch"
+#define CMD_NAME_SYNC "sync"
+#define CMD_NAME_EXIT "exit"
+#define CMD_NAME_SERVE "serve"
+#define CMD_NAME_CONVERT "convert"
+#define CMD_NAME_COMPACT "compact"
 
 #define CMD_USAGE_ADD "Add a new grade"
 #define CMD_USAGE_STATUS "Show grade stats"
+#define CMD_USAGE_RM "Remove grades"
+#define CMD_USAGE_SHELL "Run commands interactively on a loaded csv"
+#define CMD_USAGE_BATCH "Run the commands read from stdin on a loaded csv"
+#define CMD_USAGE_SERVE "Serve commands to local clients over a unix socket"
+#define CMD_USAGE_CONVERT "Convert the grade book between the csv and the binary format"
+#define CMD_USAGE_COMPACT "Rewrite the csv without the grades removed by rm"
 
 #define OPT_NAME_HELP "--help"
 #define OPT_NAME_CSV "--csv"
 
-#define OPT_USAGE_CSV "Path to the csv file that contains the grades"
+#define OPT_NAME_ALL "--all"
+#define OPT_NAME_STATS "--stats"
+#define OPT_NAME_STDIN "--stdin"
+#define OPT_NAME_FROM "--from"
+#define OPT_NAME_SOCKET "--socket"
+#define OPT_NAME_CONNECT "--connect"
+#define OPT_NAME_PROFILE "--profile"
+#define OPT_NAME_THREADS "--threads"
+#define OPT_NAME_TO "--to"
+#define OPT_NAME_OUT "--out"
+#define OPT_NAME_FORMAT "--format"
+#define OPT_NAME_NO_LIST "--no-list"
+#define OPT_NAME_WATCH "--watch"
+#define OPT_NAME_WHERE "--where"
+#define OPT_NAME_SINCE "--since"
+#define OPT_NAME_UNTIL "--until"
+#define OPT_NAME_TIME "--time"
+
+#define OPT_USAGE_CSV "Path to the csv file that contains the grades (status: repeatable, directory or pattern)"
+#define OPT_USAGE_ALL "Show stats of every subject, computed in a single pass"
+#define OPT_USAGE_STATS "Show median, percentiles, standard deviation and a histogram"
+#define OPT_USAGE_THREADS "Number of threads used to aggregate the csv (default: online cpus)"
+#define OPT_USAGE_STDIN "Add subject;grade;comment records read from stdin"
+#define OPT_USAGE_FROM "Add subject;grade;comment records read from FILE"
+#define OPT_USAGE_SOCKET "Path of the unix socket to serve on"
+#define OPT_USAGE_CONNECT "Send the command to the server listening on the unix socket"
+#define OPT_USAGE_PROFILE "Print phase timings and I/O counters to stderr at exit (as json with --profile json)"
+#define OPT_USAGE_TO "Target format, csv or bin"
+#define OPT_USAGE_OUT "Write the converted grade book to FILE instead of replacing it"
+#define OPT_USAGE_FORMAT "Output format, text (default), csv, tsv or json"
+#define OPT_USAGE_NO_LIST "Print only count and average, not every grade"
+#define OPT_USAGE_WATCH "Print the stats again whenever the csv changes, parsing only appended rows (single csv)"
+#define OPT_USAGE_WHERE "Only rows matching EXPR (repeatable): subject=A,B,PREFIX*  grade>=G (=,<,<=,>)  comment~TEXT"
+#define OPT_USAGE_SINCE "Only rows added at or after TIME: YYYY-MM-DD[THH:MM[:SS]] (local time) or @SECONDS"
+#define OPT_USAGE_UNTIL "Only rows added before TIME, see --since"
+#define OPT_USAGE_TIME "Store the time every row is added at (required by status --since and --until)"
+
+#define FORMAT_CSV "csv"
+#define FORMAT_BIN "bin"
+#define FORMAT_TEXT "text"
+#define FORMAT_TSV "tsv"
+#define FORMAT_JSON "json"
+
+#define SERVE_MAX_EVENTS 64
+#define SERVE_MAX_REQUEST (1024 * 1024)
 
 char *opt_default_csv = "./" DEFAULT_CSV_NAME;
+char **opt_csvs = NULL; // every --csv of the running command
+int n_opt_csvs = 0;
+int cap_opt_csvs = 0;
+char *opt_connect = NULL;
+bool serving = false; // whether the process is the server
+
+/*
+ * State of the running command. It is thread local, so that the
+ * library (libcgrade.c) can run operations on several threads.
+ */
+__thread FILE *cmd_out_file = NULL; // redirects the output of commands, NULL for stdout
+#define cmd_out (cmd_out_file != NULL ? cmd_out_file : stdout)
+
+__thread jmp_buf *cmd_exit_jmp = NULL; // set while a session, the CLI or a library call runs
+__thread int cmd_exit_code = 0;
+
+/**
+ * Terminates the current command. Control returns to whoever set
+ * cmd_exit_jmp: the session loop (shell, batch), the server, the
+ * CLI or a library call. Without it (e.g. in a worker thread) the
+ * process exits.
+ */
+void cmd_exit(int code) {
+    if (cmd_exit_jmp != NULL) {
+        cmd_exit_code = code;
+        longjmp(*cmd_exit_jmp, 1);
+    }
+    exit(code);
+}
+
+/**
+ * Prints msg (may be NULL) with the description of errno and
+ * terminates the current command with errno as exit code.
+ */
+void cmd_exit_errno(char *msg) {
+    int err = errno;
+    if (msg == NULL) fprintf(cmd_out, "%s (%d)\n", strerror(err), err);
+    else fprintf(cmd_out, "%s: %s (%d)\n", msg, strerror(err), err);
+    cmd_exit(err);
+}
+
+/**
+ * A resource of the running command that cmd_exit would otherwise
+ * leak: the jump skips the code that releases it. Locked fds, maps
+ * and grade books register themselves while they are open, whoever
+ * catches the jump releases what the command left behind with
+ * cmd_release. A grade book is registered by address, so only books
+ * that outlive the jump (those of library calls) can be registered.
+ */
+typedef struct cmd_resource {
+    void (*release)(struct cmd_resource *r);
+    int fd;
+    void *ptr;
+    size_t size;
+} CmdResource;
+
+#define CMD_MAX_RESOURCES 32
+
+__thread CmdResource cmd_resources[CMD_MAX_RESOURCES];
+__thread int cmd_n_resources = 0;
+
+void cmd_own(CmdResource r) {
+    if (cmd_n_resources < CMD_MAX_RESOURCES) cmd_resources[cmd_n_resources++] = r;
+}
+
+/**
+ * Removes the resource with fd (if ptr is NULL) or ptr, which its
+ * owner releases itself.
+ */
+void cmd_disown(int fd, void *ptr) {
+    for (int i = cmd_n_resources - 1; i >= 0; i--) {
+        CmdResource *r = &cmd_resources[i];
+        if (ptr != NULL ? r->ptr == ptr : r->ptr == NULL && r->fd == fd) {
+            memmove(r, r + 1, sizeof(CmdResource) * (cmd_n_resources - i - 1));
+            cmd_n_resources--;
+            return;
+        }
+    }
+}
+
+/**
+ * Releases the resources registered after mark (the number of
+ * resources when the caller set cmd_exit_jmp), newest first.
+ */
+void cmd_release(int mark) {
+    while (cmd_n_resources > mark) {
+        CmdResource r = cmd_resources[--cmd_n_resources];
+        r.release(&r);
+    }
+}
+
+void cmd_release_fd(CmdResource *r) {
+    close(r->fd);
+}
+
+void cmd_release_map(CmdResource *r) {
+    munmap(r->ptr, r->size);
+}
+
+/**
+ * Phases of a command that --profile reports separately.
+ */
+typedef enum profile_phase {
+    PHASE_OPTIONS,
+    PHASE_OPEN,
+    PHASE_PARSE,
+    PHASE_AGGREGATE,
+    PHASE_OUTPUT,
+    PHASE_WRITE,
+    PHASE_COUNT
+} ProfilePhase;
+
+const char *profile_phase_names[PHASE_COUNT] = { "options", "open", "parse", "aggregate", "output", "write" };
+
+/**
+ * Counters of --profile. The counters are only updated while
+ * profiling is enabled, atomically as the stats threads update
+ * them too.
+ */
+typedef struct profile {
+    bool enabled;
+    bool json;
+    ProfilePhase phase; // the running phase
+    double wall_start;  // start of the running phase
+    double cpu_start;
+    double wall[PHASE_COUNT];
+    double cpu[PHASE_COUNT];
+    uint64_t reads;
+    uint64_t bytes_read;
+    uint64_t writes;
+    uint64_t bytes_written;
+    uint64_t maps;
+    uint64_t bytes_mapped;
+    uint64_t allocs;
+} Profile;
+
+Profile profile;
+
+#define profile_count(counter, n) \
+    (profile.enabled ? (void) __atomic_add_fetch(&profile.counter, (n), __ATOMIC_RELAXED) : (void) 0)
+
+double profile_clock(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+/**
+ * Ends the running phase and starts phase p.
+ */
+void profile_phase(ProfilePhase p) {
+    if (!profile.enabled) return;
+    double wall = profile_clock(CLOCK_MONOTONIC);
+    double cpu = profile_clock(CLOCK_PROCESS_CPUTIME_ID);
+    profile.wall[profile.phase] += wall - profile.wall_start;
+    profile.cpu[profile.phase] += cpu - profile.cpu_start;
+    profile.phase = p;
+    profile.wall_start = wall;
+    profile.cpu_start = cpu;
+}
+
+/**
+ * Prints the profile to stderr, registered with atexit.
+ */
+void profile_report() {
+    profile_phase(profile.phase);
+    profile.enabled = false;
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    double wall = 0;
+    double cpu = 0;
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        wall += profile.wall[i];
+        cpu += profile.cpu[i];
+    }
+    FILE *f = stderr;
+    if (profile.json) {
+        fprintf(f, "{\"phases\": {");
+        for (int i = 0; i < PHASE_COUNT; i++) {
+            fprintf(f, "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f}", i ? ", " : "",
+                    profile_phase_names[i], profile.wall[i], profile.cpu[i]);
+        }
+        fprintf(f, "}, \"wall_ms\": %.3f, \"cpu_ms\": %.3f", wall, cpu);
+        fprintf(f, ", \"reads\": %llu, \"bytes_read\": %llu, \"writes\": %llu, \"bytes_written\": %llu",
+                (unsigned long long) profile.reads, (unsigned long long) profile.bytes_read,
+                (unsigned long long) profile.writes, (unsigned long long) profile.bytes_written);
+        fprintf(f, ", \"maps\": %llu, \"bytes_mapped\": %llu, \"allocs\": %llu, \"peak_rss_kb\": %ld}\n",
+                (unsigned long long) profile.maps, (unsigned long long) profile.bytes_mapped,
+                (unsigned long long) profile.allocs, ru.ru_maxrss);
+        return;
+    }
+    fprintf(f, "\n%-12s %10s %10s\n", "Phase", "Wall ms", "CPU ms");
+    for (int i = 0; i < PHASE_COUNT; i++) {
+        fprintf(f, "%-12s %10.3f %10.3f\n", profile_phase_names[i], profile.wall[i], profile.cpu[i]);
+    }
+    fprintf(f, "%-12s %10.3f %10.3f\n", "total", wall, cpu);
+    fprintf(f, "reads: %llu (%llu bytes), writes: %llu (%llu bytes), maps: %llu (%llu bytes)\n",
+            (unsigned long long) profile.reads, (unsigned long long) profile.bytes_read,
+            (unsigned long long) profile.writes, (unsigned long long) profile.bytes_written,
+            (unsigned long long) profile.maps, (unsigned long long) profile.bytes_mapped);
+    fprintf(f, "allocations: %llu, peak rss: %ld KB\n", (unsigned long long) profile.allocs, ru.ru_maxrss);
+}
+
+void profile_enable(bool json) {
+    if (!profile.enabled) atexit(profile_report);
+    profile.enabled = true;
+    profile.json = json;
+    profile.phase = PHASE_OPTIONS;
+    profile.wall_start = profile_clock(CLOCK_MONOTONIC);
+    profile.cpu_start = profile_clock(CLOCK_PROCESS_CPUTIME_ID);
+}
+
+/*
+ * Counting wrappers of the I/O and allocation functions. The macros
+ * below route every call in the rest of this file through them.
+ */
+ssize_t profile_read(int fd, void *buf, size_t n) {
+    ssize_t res = read(fd, buf, n);
+    profile_count(reads, 1);
+    profile_count(bytes_read, res > 0 ? res : 0);
+    return res;
+}
+
+ssize_t profile_pread(int fd, void *buf, size_t n, off_t offset) {
+    ssize_t res = pread(fd, buf, n, offset);
+    profile_count(reads, 1);
+    profile_count(bytes_read, res > 0 ? res : 0);
+    return res;
+}
+
+ssize_t profile_write(int fd, const void *buf, size_t n) {
+    ssize_t res = write(fd, buf, n);
+    profile_count(writes, 1);
+    profile_count(bytes_written, res > 0 ? res : 0);
+    return res;
+}
+
+ssize_t profile_pwrite(int fd, const void *buf, size_t n, off_t offset) {
+    ssize_t res = pwrite(fd, buf, n, offset);
+    profile_count(writes, 1);
+    profile_count(bytes_written, res > 0 ? res : 0);
+    return res;
+}
+
+void *profile_mmap(void *addr, size_t len, int prot, int flags, int fd, off_t offset) {
+    void *res = mmap(addr, len, prot, flags, fd, offset);
+    profile_count(maps, 1);
+    profile_count(bytes_mapped, res != MAP_FAILED ? len : 0);
+    return res;
+}
+
+void *profile_malloc(size_t n) {
+    profile_count(allocs, 1);
+    return malloc(n);
+}
+
+void *profile_calloc(size_t n, size_t size) {
+    profile_count(allocs, 1);
+    return calloc(n, size);
+}
+
+void *profile_realloc(void *p, size_t n) {
+    profile_count(allocs, 1);
+    return realloc(p, n);
+}
+
+char *profile_strdup(const char *s) {
+    profile_count(allocs, 1);
+    return strdup(s);
+}
+
+char *profile_strndup(const char *s, size_t n) {
+    profile_count(allocs, 1);
+    return strndup(s, n);
+}
+
+#undef strdup
+#undef strndup
+#define read(fd, buf, n) profile_read(fd, buf, n)
+#define pread(fd, buf, n, offset) profile_pread(fd, buf, n, offset)
+#define write(fd, buf, n) profile_write(fd, buf, n)
+#define pwrite(fd, buf, n, offset) profile_pwrite(fd, buf, n, offset)
+#define mmap(addr, len, prot, flags, fd, offset) profile_mmap(addr, len, prot, flags, fd, offset)
+#define malloc(n) profile_malloc(n)
+#define calloc(n, size) profile_calloc(n, size)
+#define realloc(p, n) profile_realloc(p, n)
+#define strdup(s) profile_strdup(s)
+#define strndup(s, n) profile_strndup(s, n)
+
+/**
+ * Bump allocator. Allocations are carved out of large blocks and
+ * released all at once with arena_free, so strings that have to
+ * outlive a read buffer cost no heap allocation of their own.
+ */
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} ArenaBlock;
+
+typedef struct arena {
+    ArenaBlock *head; // the block allocations are carved from
+} Arena;
+
+/**
+ * Strings of the running command that are released after it (by
+ * the session loop, the server and library calls, a single command
+ * exits anyway).
+ */
+__thread Arena cmd_arena;
+
+void arena_init(Arena *a) {
+    a->head = NULL;
+}
+
+/**
+ * returns n bytes aligned to align (a power of two)
+ */
+void *arena_bump(Arena *a, size_t n, size_t align) {
+    ArenaBlock *b = a->head;
+    size_t off = b != NULL ? (b->used + align - 1) & ~(align - 1) : 0;
+    if (b == NULL || off + n > b->cap) {
+        size_t cap = n > ARENA_BLOCK_SIZE ? n : ARENA_BLOCK_SIZE;
+        b = malloc(sizeof(ArenaBlock) + cap);
+        if (b == NULL) cmd_exit_errno("arena malloc failed");
+        b->next = a->head;
+        b->used = 0;
+        b->cap = cap;
+        a->head = b;
+        off = 0;
+    }
+    b->used = off + n;
+    return b->data + off;
+}
+
+void *arena_alloc(Arena *a, size_t n) {
+    return arena_bump(a, n, sizeof(void *));
+}
+
+/**
+ * returns a \0 terminated copy of the first n chars of s
+ */
+char *arena_strndup(Arena *a, const char *s, size_t n) {
+    char *out = arena_bump(a, n + 1, 1);
+    memcpy(out, s, n);
+    out[n] = '\0';
+    return out;
+}
+
+void arena_free(Arena *a) {
+    while (a->head != NULL) {
+        ArenaBlock *next = a->head->next;
+        free(a->head);
+        a->head = next;
+    }
+}
+
+/**
+ * Grades are fixed-point numbers in hundredths (5.25 is stored
+ * as 525), so they are parsed independent of the locale and
+ * summed exactly in 64 bit integers.
+ */
+typedef int32_t grade_t;
+
+#define GRADE_SCALE 100
+#define GRADE_DECIMALS 2
+#define GRADE_MAX_DIGITS 7 // integer digits, keeps grades far from overflowing
+#define GRADE_INVALID INT32_MIN
+#define GRADE_FORMAT_SIZE 16
+
+/**
+ * Parses a grade written as DIGITS[.DIGITS] with at most
+ * GRADE_DECIMALS decimals. Anything else (signs, exponents,
+ * whitespace, trailing characters, empty strings) is rejected.
+ * arg(s)    the grade, not necessarily \0 terminated
+ * arg(len)  length of s
+ * arg(out)  output parameter, the grade in hundredths
+ * returns false if s is not a well formed grade
+ */
+bool grade_parse(const char *s, size_t len, grade_t *out) {
+    size_t i = 0;
+    int32_t value = 0;
+    while (i < len && s[i] >= '0' && s[i] <= '9') {
+        if (i == GRADE_MAX_DIGITS) return false;
+        value = value * 10 + (s[i++] - '0');
+    }
+    if (i == 0) return false;
+    int decimals = 0;
+    if (i < len && s[i] == '.') {
+        i++;
+        while (i < len && s[i] >= '0' && s[i] <= '9') {
+            if (++decimals > GRADE_DECIMALS) return false;
+            value = value * 10 + (s[i++] - '0');
+        }
+        if (decimals == 0) return false;
+    }
+    if (i != len) return false;
+    for (; decimals < GRADE_DECIMALS; decimals++) value *= 10;
+    *out = value;
+    return true;
+}
+
+/**
+ * Reads a grade stored in a grade book. Unlike grade_parse, more
+ * than GRADE_DECIMALS decimals are accepted and rounded half up,
+ * rows written before grades were validated keep their value.
+ * returns false if s is not a decimal number
+ */
+bool grade_read(const char *s, size_t len, grade_t *out) {
+    if (grade_parse(s, len, out)) return true;
+    size_t i = 0;
+    while (i < len && s[i] >= '0' && s[i] <= '9') i++;
+    size_t cut = i + 1 + GRADE_DECIMALS; // first decimal that is rounded away
+    if (cut >= len || s[i] != '.') return false;
+    for (size_t j = i + 1; j < len; j++) {
+        if (s[j] < '0' || s[j] > '9') return false;
+    }
+    if (!grade_parse(s, cut, out)) return false;
+    if (s[cut] >= '5') (*out)++;
+    return true;
+}
+
+/**
+ * returns the average of count grades that sum up to sum
+ */
+double grade_avg(int64_t sum, int64_t count) {
+    return (double) sum / count / GRADE_SCALE;
+}
+
+/**
+ * Formats a grade with two decimals, like printf("%.2f") would.
+ * arg(buf) output buffer of at least GRADE_FORMAT_SIZE chars
+ * returns buf
+ */
+char *grade_format(grade_t grade, char *buf) {
+    snprintf(buf, GRADE_FORMAT_SIZE, "%d.%02d", grade / GRADE_SCALE, grade % GRADE_SCALE);
+    return buf;
+}
+
+typedef struct subject {
+    char *name;
+    grade_t *grades;   // GRADE_INVALID for malformed grades
+    char **grade_strs; // grades as written in the csv, NULL if not loaded
+    char **comments;   // NULL if not loaded, owned by the arena of the book
+    int *rows;         // csv row (0-based, header excluded) of every grade
+    int n_grades;
+    int cap_grades;
+} Subject;
+
+Subject subject_create(char* name) {
+    Subject s;
+    s.name = name;
+    s.grades = NULL;
+    s.grade_strs = NULL;
+    s.comments = NULL;
+    s.rows = NULL;
+    s.n_grades = 0;
+    s.cap_grades = 0;
+    return s;
+}
+
+/**
+ * Appends a grade to a subject. The grade arrays grow
+ * geometrically so that n inserts cost O(n).
+ * arg(grade_str)  the grade as written in the csv or NULL
+ * arg(comment)    the comment or NULL
+ * arg(row)        the csv row of the grade
+ */
+void subject_insert_row(Subject *subject, grade_t grade, char *grade_str, char *comment, int row) {
+    if (subject->n_grades == subject->cap_grades) {
+        subject->cap_grades = subject->cap_grades ? subject->cap_grades * 2 : 4;
+        subject->grades = (grade_t *) realloc(subject->grades, sizeof(grade_t) * subject->cap_grades);
+        subject->grade_strs = (char **) realloc(subject->grade_strs, sizeof(char *) * subject->cap_grades);
+        subject->comments = (char **) realloc(subject->comments, sizeof(char *) * subject->cap_grades);
+        subject->rows = (int *) realloc(subject->rows, sizeof(int) * subject->cap_grades);
+    }
+    subject->grades[subject->n_grades] = grade;
+    subject->grade_strs[subject->n_grades] = grade_str;
+    subject->comments[subject->n_grades] = comment;
+    subject->rows[subject->n_grades] = row;
+    subject->n_grades++;
+}
+
+void subject_insert_grade(Subject *subject, grade_t grade) {
+    subject_insert_row(subject, grade, NULL, NULL, subject->n_grades);
+}
+
+/**
+ * Removes the i-th grade of a subject.
+ */
+void subject_remove_grade(Subject *subject, int i) {
+    int tail = subject->n_grades - i - 1;
+    memmove(subject->grades + i, subject->grades + i + 1, sizeof(grade_t) * tail);
+    memmove(subject->grade_strs + i, subject->grade_strs + i + 1, sizeof(char *) * tail);
+    memmove(subject->comments + i, subject->comments + i + 1, sizeof(char *) * tail);
+    memmove(subject->rows + i, subject->rows + i + 1, sizeof(int) * tail);
+    subject->n_grades--;
+}
+
+void subject_free(Subject *subject) {
+    free(subject->grades);
+    free(subject->grade_strs);
+    free(subject->comments);
+    free(subject->rows);
+    subject->n_grades = 0;
+    subject->cap_grades = 0;
+}
+
+/**
+ * Open addressing (linear probing) hash table that maps subject
+ * names to ids. Names are not copied, they have to outlive the index.
+ */
+typedef struct subject_slot {
+    const char *name; // NULL if the slot is empty
+    size_t len;
+    uint32_t hash;
+    int id;
+} SubjectSlot;
+
+typedef struct subject_index {
+    SubjectSlot *slots;
+    int cap; // always a power of two
+    int n;
+} SubjectIndex;
+
+uint32_t subject_hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+void subject_index_init(SubjectIndex *idx) {
+    idx->cap = 16;
+    idx->n = 0;
+    idx->slots = calloc(idx->cap, sizeof(SubjectSlot));
+}
+
+void subject_index_free(SubjectIndex *idx) {
+    free(idx->slots);
+    idx->slots = NULL;
+    idx->cap = 0;
+    idx->n = 0;
+}
+
+SubjectSlot *subject_index_slot(SubjectIndex *idx, const char *name, size_t len, uint32_t hash) {
+    int mask = idx->cap - 1;
+    int i = hash & mask;
+    while (idx->slots[i].name != NULL) {
+        SubjectSlot *slot = &idx->slots[i];
+        if (slot->hash == hash && slot->len == len && memcmp(slot->name, name, len) == 0) break;
+        i = (i + 1) & mask;
+    }
+    return &idx->slots[i];
+}
+
+/**
+ * returns the id of a subject or -1 if it is not in the index
+ */
+int subject_index_find(SubjectIndex *idx, const char *name, size_t len) {
+    SubjectSlot *slot = subject_index_slot(idx, name, len, subject_hash(name, len));
+    return slot->name != NULL ? slot->id : -1;
+}
+
+/**
+ * Inserts a subject that is not yet in the index. The table
+ * doubles when it gets more than half full.
+ */
+void subject_index_insert(SubjectIndex *idx, const char *name, size_t len, int id) {
+    if ((idx->n + 1) * 2 > idx->cap) {
+        SubjectSlot *old = idx->slots;
+        int old_cap = idx->cap;
+        idx->cap *= 2;
+        idx->slots = calloc(idx->cap, sizeof(SubjectSlot));
+        for (int i = 0; i < old_cap; i++) {
+            if (old[i].name == NULL) continue;
+            *subject_index_slot(idx, old[i].name, old[i].len, old[i].hash) = old[i];
+        }
+        free(old);
+    }
+    uint32_t hash = subject_hash(name, len);
+    SubjectSlot *slot = subject_index_slot(idx, name, len, hash);
+    slot->name = name;
+    slot->len = len;
+    slot->hash = hash;
+    slot->id = id;
+    idx->n++;
+}
+
+void exit_usage(int exit_code) {
+    fprintf(cmd_out, "\nUsage: %s COMMAND\n", APP_NAME);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "A lightweight tool to manage school grades\n");
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Commands:\n");
+    fprintf(cmd_out, "\tadd \t%s\n", CMD_USAGE_ADD);
+    fprintf(cmd_out, "\tstatus \t%s\n", CMD_USAGE_STATUS);
+    fprintf(cmd_out, "\trm \t%s\n", CMD_USAGE_RM);
+    fprintf(cmd_out, "\tshell \t%s\n", CMD_USAGE_SHELL);
+    fprintf(cmd_out, "\tbatch \t%s\n", CMD_USAGE_BATCH);
+    fprintf(cmd_out, "\tserve \t%s\n", CMD_USAGE_SERVE);
+    fprintf(cmd_out, "\tconvert \t%s\n", CMD_USAGE_CONVERT);
+    fprintf(cmd_out, "\tcompact \t%s\n", CMD_USAGE_COMPACT);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Options:\n");
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_CSV, OPT_USAGE_CSV);
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_CONNECT, OPT_USAGE_CONNECT);
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_PROFILE, OPT_USAGE_PROFILE);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Run '%s COMMAND --help' for more information on a command.\n", APP_NAME);
+    cmd_exit(exit_code);
+}
+
+void exit_unknown_option(char *option) {
+    fprintf(cmd_out, "Unknown option %s\n", option);
+    cmd_exit(1);
+}
+
+void cmd_exit_usage_missing_value(char *option) {
+    fprintf(cmd_out, "Option %s requires a value\n", option);
+    cmd_exit(1);
+}
+
+void exit_no_csv() {
+    fprintf(cmd_out, "%s does not exist. Init a new .csv file with:\n\t%s %s\n", opt_default_csv, APP_NAME, CMD_NAME_INIT);
+    cmd_exit(1);
+}
+
+void exit_unknown_cmd(char *cmd) {
+    fprintf(cmd_out, "Unknown command '%s'\n", cmd);
+    cmd_exit(1);
+}
+
+void exit_csv_already_initialized() {
+    fprintf(cmd_out, "%s already initialized.\n", DEFAULT_CSV_NAME);
+    cmd_exit(1);
+}
+
+void command_add_usage(int exit_code) {
+    fprintf(cmd_out, "\nUsage: %s add SUBJECT GRADE [COMMENT]\n", APP_NAME);
+    fprintf(cmd_out, "       %s add %s|%s FILE\n", APP_NAME, OPT_NAME_STDIN, OPT_NAME_FROM);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "%s\n", CMD_USAGE_ADD);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Options:\n");
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_STDIN, OPT_USAGE_STDIN);
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_FROM, OPT_USAGE_FROM);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Examples:\n");
+    fprintf(cmd_out, "\t%s add math 5.2\n", APP_NAME);
+    fprintf(cmd_out, "\t%s add math 5.5 \"second exam\"\n", APP_NAME);
+    fprintf(cmd_out, "\t%s add %s grades.csv\n", APP_NAME, OPT_NAME_FROM);
+    fprintf(cmd_out, "\n");
+    cmd_exit(exit_code);
+}
+
+void command_status_usage(int exit_code) {
+    fprintf(cmd_out, "\nUsage: %s status [SUBJECT] [OPTIONS]\n", APP_NAME);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "%s\n", CMD_USAGE_STATUS);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Options:\n");
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_ALL, OPT_USAGE_ALL);
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_STATS, OPT_USAGE_STATS);
+    fprintf(cmd_out, "\t%s N \t%s\n", OPT_NAME_THREADS, OPT_USAGE_THREADS);
+    fprintf(cmd_out, "\t%s FORMAT \t%s\n", OPT_NAME_FORMAT, OPT_USAGE_FORMAT);
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_NO_LIST, OPT_USAGE_NO_LIST);
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_WATCH, OPT_USAGE_WATCH);
+    fprintf(cmd_out, "\t%s EXPR \t%s\n", OPT_NAME_WHERE, OPT_USAGE_WHERE);
+    fprintf(cmd_out, "\t%s TIME \t%s\n", OPT_NAME_SINCE, OPT_USAGE_SINCE);
+    fprintf(cmd_out, "\t%s TIME \t%s\n", OPT_NAME_UNTIL, OPT_USAGE_UNTIL);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Examples:\n");
+    fprintf(cmd_out, "\t%s status\n", APP_NAME);
+    fprintf(cmd_out, "\t%s status math\n", APP_NAME);
+    fprintf(cmd_out, "\t%s status %s\n", APP_NAME, OPT_NAME_ALL);
+    fprintf(cmd_out, "\t%s status math %s\n", APP_NAME, OPT_NAME_STATS);
+    fprintf(cmd_out, "\t%s status %s %s %s\n", APP_NAME, OPT_NAME_ALL, OPT_NAME_FORMAT, FORMAT_JSON);
+    fprintf(cmd_out, "\t%s %s 2023/ %s 2024/ status math\n", APP_NAME, OPT_NAME_CSV, OPT_NAME_CSV);
+    fprintf(cmd_out, "\t%s status %s\n", APP_NAME, OPT_NAME_WATCH);
+    fprintf(cmd_out, "\t%s status %s %s 'subject=math,bio' %s 'grade>=4'\n", APP_NAME, OPT_NAME_ALL, OPT_NAME_WHERE, OPT_NAME_WHERE);
+    fprintf(cmd_out, "\t%s status %s 'comment~exam' %s\n", APP_NAME, OPT_NAME_WHERE, OPT_NAME_NO_LIST);
+    fprintf(cmd_out, "\t%s status %s %s 2026-09-01 %s 2027-02-01\n", APP_NAME, OPT_NAME_ALL, OPT_NAME_SINCE, OPT_NAME_UNTIL);
+    fprintf(cmd_out, "\n");
+    cmd_exit(exit_code);
+}
+
+bool csv_exists() {
+    struct stat st;
+    return stat(opt_default_csv, &st) != -1;
+}
+
+/**
+ * Ensures that the csv file exists.
+ */
+void csv_must_exist() {
+    struct stat st;
+    profile_phase(PHASE_OPEN);
+    if (!csv_exists()) {
+        exit_no_csv();
+    }
+}
+
+/**
+ * writes a \0 terminated string to an fd or exits
+ * if write did not work
+ */
+ssize_t csv_write_string(int fd, char *s) {
+    ssize_t b = write(fd, s, sizeof(*s) * strlen(s));
+    if (b == -1) {
+        cmd_exit_errno("write failed");
+    }
+    return b;
+}
+
+
+
+/**
+ * Buffered reader over a csv file descriptor.
+ * Reads the file in blocks of CSV_READER_BUF_SIZE bytes
+ * so that scanning a csv costs one read() per block
+ * instead of one read() per byte.
+ */
+typedef struct csv_reader {
+    int fd;
+    char *buf;
+    size_t cap;  // size of buf, grows for lines longer than the buffer
+    size_t pos;  // cursor into buf
+    size_t len;  // number of valid bytes in buf
+    bool eof;
+    int error;   // errno of the last failed read, 0 if none
+} CsvReader;
+
+void csv_reader_init(CsvReader *r, int fd) {
+    r->fd = fd;
+    r->buf = malloc(CSV_READER_BUF_SIZE);
+    if (r->buf == NULL) cmd_exit_errno("csv_reader_init malloc failed");
+    r->cap = CSV_READER_BUF_SIZE;
+    r->pos = 0;
+    r->len = 0;
+    r->eof = false;
+    r->error = 0;
+}
+
+void csv_reader_free(CsvReader *r) {
+    free(r->buf);
+    r->buf = NULL;
+}
+
+/**
+ * Refills the buffer if all of its bytes have been consumed.
+ * returns false if no more bytes are available (eof)
+ */
+bool csv_reader_fill(CsvReader *r) {
+    if (r->pos < r->len) return true;
+    if (r->eof) return false;
+    ssize_t n = read(r->fd, r->buf, r->cap);
+    if (n == -1) {
+        r->error = errno;
+        cmd_exit_errno("csv read failed");
+    }
+    r->pos = 0;
+    r->len = n;
+    if (n == 0) r->eof = true;
+    return n > 0;
+}
+
+/**
+ * Reads more bytes behind the unread bytes of the buffer, which are
+ * moved to its start first. The buffer grows if it is full.
+ * returns false if no more bytes are available (eof)
+ */
+bool csv_reader_more(CsvReader *r) {
+    if (r->eof) return false;
+    memmove(r->buf, r->buf + r->pos, r->len - r->pos);
+    r->len -= r->pos;
+    r->pos = 0;
+    if (r->len == r->cap) {
+        r->cap *= 2;
+        r->buf = realloc(r->buf, r->cap);
+        if (r->buf == NULL) cmd_exit_errno("csv_reader_more realloc failed");
+    }
+    ssize_t n = read(r->fd, r->buf + r->len, r->cap - r->len);
+    if (n == -1) {
+        r->error = errno;
+        cmd_exit_errno("csv read failed");
+    }
+    if (n == 0) r->eof = true;
+    r->len += n;
+    return n > 0;
+}
+
+/**
+ * Reads the next line. The line is a view into the buffer of the
+ * reader and stays valid until the reader is used again.
+ * arg(o_line)  output parameter, the line without newline
+ * arg(o_len)   output parameter, the length of the line
+ * returns false if there are no more lines
+ */
+bool csv_reader_line(CsvReader *r, const char **o_line, size_t *o_len) {
+    size_t scanned = 0; // unread bytes known to contain no newline
+    while (true) {
+        char *start = r->buf + r->pos;
+        size_t avail = r->len - r->pos;
+        char *nl = memchr(start + scanned, '\n', avail - scanned);
+        if (nl != NULL) {
+            *o_line = start;
+            *o_len = nl - start;
+            r->pos += *o_len + 1;
+            return true;
+        }
+        scanned = avail;
+        if (!csv_reader_more(r)) {
+            if (r->len == r->pos) return false;
+            *o_line = r->buf + r->pos; // last line without newline
+            *o_len = r->len - r->pos;
+            r->pos = r->len;
+            return true;
+        }
+    }
+}
+
+/**
+ * Reads exactly n bytes.
+ * returns false if eof is reached before n bytes have been read
+ */
+bool csv_reader_read(CsvReader *r, void *out, size_t n) {
+    char *o = out;
+    while (n > 0 && csv_reader_fill(r)) {
+        size_t c = r->len - r->pos < n ? r->len - r->pos : n;
+        memcpy(o, r->buf + r->pos, c);
+        r->pos += c;
+        o += c;
+        n -= c;
+    }
+    return n == 0;
+}
+
+/**
+ * A field of a csv row that points into memory owned by
+ * someone else (e.g. a mapped file). Not \0 terminated.
+ */
+typedef struct csv_field {
+    const char *ptr;
+    size_t len;
+} CsvField;
+
+/**
+ * An entry of the delete log "<csv>.del": a row that has been
+ * removed by rm but is still in the csv.
+ */
+typedef struct del_entry {
+    uint64_t offset; // start of the row in the csv
+    uint32_t len;    // length of the row including its newline
+    uint32_t reserved;
+} DelEntry;
+
+/**
+ * The deleted rows of a csv, sorted by offset.
+ */
+typedef struct csv_dead {
+    DelEntry *entries;
+    size_t n;
+    uint64_t bytes;    // total length of the deleted rows
+    uint64_t log_size; // size of the log they come from, 0 if there is none
+} CsvDead;
+
+/**
+ * returns whether the row starting at offset has been deleted
+ */
+bool csv_dead_has(const CsvDead *d, size_t offset) {
+    size_t lo = 0;
+    size_t hi = d->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (d->entries[mid].offset < offset) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo < d->n && d->entries[lo].offset == offset;
+}
+
+/**
+ * A subject of a subject predicate: an exact name or, if it ends
+ * with '*' in the expression, a prefix.
+ */
+typedef struct subject_pattern {
+    CsvField name;
+    bool prefix;
+} SubjectPattern;
+
+/**
+ * The predicates of status --where, --since and --until. A row
+ * passes if its subject matches one of subjects (if there are any),
+ * its grade is within [min, max] (if has_grade), its time within
+ * [since, until) (if has_time, rows without time fail) and its
+ * comment contains every string of comments. Strings point into
+ * the expressions, the arrays are allocated from the arena passed
+ * to row_filter_parse.
+ */
+typedef struct row_filter {
+    SubjectPattern *subjects;
+    int n_subjects;
+    bool has_grade;
+    grade_t min;
+    grade_t max;
+    bool has_time;
+    int64_t since;
+    int64_t until;
+    CsvField *comments;
+    int n_comments;
+} RowFilter;
+
+void row_filter_init(RowFilter *f) {
+    memset(f, 0, sizeof(*f));
+    f->min = GRADE_INVALID + 1;
+    f->max = INT32_MAX;
+    f->since = INT64_MIN;
+    f->until = INT64_MAX;
+}
+
+/**
+ * Parses the time field of a row, seconds since the epoch.
+ * returns false if the field is empty or not a number
+ */
+bool csv_time_parse(const char *s, size_t len, int64_t *out) {
+    if (len == 0 || len > 18) return false;
+    int64_t value = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        value = value * 10 + (s[i] - '0');
+    }
+    *out = value;
+    return true;
+}
+
+/**
+ * Parses a --since or --until value: YYYY-MM-DD, YYYY-MM-DDTHH:MM
+ * or YYYY-MM-DDTHH:MM:SS in local time, or @SECONDS since the epoch.
+ * returns false if s is malformed
+ */
+bool time_arg_parse(char *s, int64_t *out) {
+    if (s[0] == '@') return csv_time_parse(s + 1, strlen(s + 1), out);
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int n = 0;
+    if (sscanf(s, "%4d-%2d-%2d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n) != 3 || n != 10) return false;
+    if (s[n] == 'T') {
+        int k = 0;
+        if (sscanf(s + n, "T%2d:%2d%n", &tm.tm_hour, &tm.tm_min, &k) != 2 || k != 6) return false;
+        n += k;
+        if (s[n] == ':') {
+            if (sscanf(s + n, ":%2d%n", &tm.tm_sec, &k) != 1 || k != 3) return false;
+            n += k;
+        }
+    }
+    if (s[n] != '\0' || tm.tm_mon < 1 || tm.tm_mon > 12 || tm.tm_mday < 1 || tm.tm_mday > 31) return false;
+    tm.tm_year -= 1900;
+    tm.tm_mon--;
+    tm.tm_isdst = -1;
+    time_t t = mktime(&tm);
+    if (t == -1) return false;
+    *out = t;
+    return true;
+}
+
+/**
+ * Adds the predicate of an expression to the filter:
+ *   subject=NAME[,NAME]...   subject is one of the names, NAME* matches a prefix
+ *   grade=G, grade<G, grade<=G, grade>G, grade>=G
+ *   comment~TEXT             comment contains TEXT
+ * returns false if the expression is malformed or a second subject
+ *         predicate
+ */
+bool row_filter_parse(RowFilter *f, char *expr, Arena *arena) {
+    if (strncmp(expr, "subject=", 8) == 0) {
+        if (f->n_subjects > 0) return false;
+        for (char *name = expr + 8; ; ) {
+            char *end = strchr(name, ',');
+            size_t len = end != NULL ? (size_t) (end - name) : strlen(name);
+            bool prefix = len > 0 && name[len - 1] == '*';
+            if (prefix) len--;
+            if (len == 0 && !prefix) return false;
+            SubjectPattern *subjects = arena_alloc(arena, sizeof(SubjectPattern) * (f->n_subjects + 1));
+            memcpy(subjects, f->subjects, sizeof(SubjectPattern) * f->n_subjects);
+            f->subjects = subjects;
+            f->subjects[f->n_subjects].name.ptr = name;
+            f->subjects[f->n_subjects].name.len = len;
+            f->subjects[f->n_subjects++].prefix = prefix;
+            if (end == NULL) return true;
+            name = end + 1;
+        }
+    }
+    if (strncmp(expr, "comment~", 8) == 0) {
+        CsvField *comments = arena_alloc(arena, sizeof(CsvField) * (f->n_comments + 1));
+        memcpy(comments, f->comments, sizeof(CsvField) * f->n_comments);
+        f->comments = comments;
+        f->comments[f->n_comments].ptr = expr + 8;
+        f->comments[f->n_comments++].len = strlen(expr + 8);
+        return true;
+    }
+    if (strncmp(expr, "grade", 5) != 0 || expr[5] == '\0') return false;
+    char *op = expr + 5;
+    char *value = op + (op[0] != '\0' && op[1] == '=' ? 2 : 1);
+    grade_t g;
+    if (!grade_parse(value, strlen(value), &g)) return false;
+    grade_t min = f->min;
+    grade_t max = f->max;
+    if (op[0] == '=' && value == op + 1) min = max = g;
+    else if (op[0] == '>') min = value == op + 2 ? g : g + 1;
+    else if (op[0] == '<') max = value == op + 2 ? g : g - 1;
+    else return false;
+    f->has_grade = true;
+    f->min = min > f->min ? min : f->min;
+    f->max = max < f->max ? max : f->max;
+    return true;
+}
+
+/**
+ * returns whether a subject passes the subject predicate
+ */
+bool row_filter_subject(const RowFilter *f, const char *name, size_t len) {
+    if (f->n_subjects == 0) return true;
+    for (int i = 0; i < f->n_subjects; i++) {
+        const SubjectPattern *p = &f->subjects[i];
+        if ((p->prefix ? len >= p->name.len : len == p->name.len) && memcmp(name, p->name.ptr, p->name.len) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * returns whether a grade passes the grade predicates, malformed
+ * grades (GRADE_INVALID) only pass if there are none
+ */
+bool row_filter_grade(const RowFilter *f, grade_t g) {
+    return !f->has_grade || (g >= f->min && g <= f->max);
+}
+
+/**
+ * returns whether a comment contains every string of the comment predicates
+ */
+bool row_filter_comment(const RowFilter *f, const char *comment, size_t len) {
+    for (int i = 0; i < f->n_comments; i++) {
+        CsvField s = f->comments[i];
+        if (s.len == 0) continue;
+        const char *p = comment;
+        const char *end = comment + len;
+        bool found = false;
+        while (!found && (size_t) (end - p) >= s.len) {
+            p = memchr(p, s.ptr[0], end - p - s.len + 1);
+            if (p == NULL) break;
+            found = memcmp(p, s.ptr, s.len) == 0;
+            p++;
+        }
+        if (!found) return false;
+    }
+    return true;
+}
+
+/**
+ * Evaluates the time and comment predicates on the comment field
+ * of a row, which starts with the time in timed books.
+ * arg(timed) whether the row is in a timed book
+ */
+bool row_filter_rest(const RowFilter *f, const char *rest, size_t len, bool timed) {
+    if (timed && (f->has_time || f->n_comments > 0)) {
+        const char *end = rest + len;
+        const char *d = memchr(rest, CSV_DELIMITER, len);
+        int64_t time;
+        if (f->has_time && (!csv_time_parse(rest, (d != NULL ? d : end) - rest, &time) || time < f->since || time >= f->until)) return false;
+        rest = d != NULL ? d + 1 : end;
+        len = end - rest;
+    } else if (f->has_time) {
+        return false;
+    }
+    return row_filter_comment(f, rest, len);
+}
+
+/**
+ * Evaluates the filter on a row of a csv, cheapest predicate first:
+ * the subject, then the grade and only then the time and the
+ * comment, which are located behind the grade only if a predicate
+ * needs them.
+ * arg(end)     end of the row (excluding its newline)
+ * arg(timed)   whether the csv is timed
+ * arg(o_grade) output parameter for the parsed grade, may be NULL
+ */
+bool row_filter_match(const RowFilter *f, CsvField subject, CsvField grade, const char *end, bool timed, grade_t *o_grade) {
+    if (!row_filter_subject(f, subject.ptr, subject.len)) return false;
+    grade_t g;
+    if (!grade_read(grade.ptr, grade.len, &g)) g = GRADE_INVALID;
+    if (!row_filter_grade(f, g)) return false;
+    if (o_grade != NULL) *o_grade = g;
+    if (f->n_comments == 0 && !f->has_time) return true;
+    const char *comment = grade.ptr + grade.len;
+    if (comment < end) comment++; // skip delimiter
+    return row_filter_rest(f, comment, end - comment, timed);
+}
+
+/**
+ * A csv file mapped into memory for read-only scanning.
+ */
+typedef struct csv_map {
+    char *data;
+    size_t size;
+    const CsvDead *dead; // rows the scanners skip, NULL if none
+    const RowFilter *filter; // rows that fail it are skipped, NULL if none
+    bool timed; // whether the rows carry a time (see CSV_HEADER_TIMED)
+} CsvMap;
+
+/**
+ * returns whether the text at the start of a csv is the header of
+ * a timed csv
+ * arg(len) bytes available at s, the header may be followed by more
+ */
+bool csv_header_timed(const char *s, size_t len) {
+    size_t n = strlen(CSV_HEADER_TIMED);
+    return len >= n && memcmp(s, CSV_HEADER_TIMED, n) == 0 && (len == n || s[n] == '\n' || s[n] == '\r');
+}
+
+/**
+ * Maps the file behind fd into memory and advises the kernel
+ * that it will be read sequentially.
+ * returns false if the file can not be mapped (e.g. pipes or
+ * empty files), in which case the caller should fall back to
+ * a CsvReader.
+ */
+bool csv_map_open(CsvMap *m, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) cmd_exit_errno("csv_map_open fstat failed");
+    if (!S_ISREG(st.st_mode) || st.st_size == 0) return false;
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) return false;
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    m->data = data;
+    m->size = st.st_size;
+    m->dead = NULL;
+    m->filter = NULL;
+    m->timed = csv_header_timed(data, st.st_size);
+    cmd_own((CmdResource) { cmd_release_map, -1, data, st.st_size });
+    return true;
+}
+
+void csv_map_close(CsvMap *m) {
+    cmd_disown(-1, (void *) m->data);
+    if (munmap(m->data, m->size) == -1) cmd_exit_errno("csv_map_close munmap failed");
+    m->data = NULL;
+    m->size = 0;
+}
+
+/**
+ * Splits a line (without newline) into subject, grade and comment.
+ * Missing fields are empty, the comment is the rest of the line.
+ * arg(comment) output parameter for the comment, may be NULL
+ */
+void csv_split_row(const char *line, size_t line_len, CsvField *subject, CsvField *grade, CsvField *comment) {
+    const char *d1 = memchr(line, CSV_DELIMITER, line_len);
+    subject->ptr = line;
+    subject->len = d1 != NULL ? (size_t) (d1 - line) : line_len;
+    grade->ptr = line + line_len;
+    grade->len = 0;
+    if (d1 != NULL) {
+        grade->ptr = d1 + 1;
+        const char *d2 = memchr(grade->ptr, CSV_DELIMITER, line + line_len - grade->ptr);
+        grade->len = (d2 != NULL ? d2 : line + line_len) - grade->ptr;
+    }
+    if (comment != NULL) {
+        comment->ptr = grade->ptr + grade->len;
+        if (comment->ptr < line + line_len) comment->ptr++; // skip delimiter
+        comment->len = line + line_len - comment->ptr;
+    }
+}
+
+/**
+ * Tokenizes the row starting at *pos in place. Deleted rows
+ * (m->dead) and rows that fail m->filter are skipped.
+ * arg(m)        the mapped csv
+ * arg(pos)      in/out offset, moved behind the row's newline
+ * arg(subject)  output field for the subject column
+ * arg(grade)    output field for the grade column
+ * arg(comment)  output field for the rest of the row, may be NULL
+ * returns false if there are no more rows
+ */
+bool csv_map_next_row(CsvMap *m, size_t *pos, CsvField *subject, CsvField *grade, CsvField *comment) {
+    while (*pos < m->size) {
+        const char *line = m->data + *pos;
+        size_t avail = m->size - *pos;
+        const char *nl = memchr(line, '\n', avail);
+        size_t line_len = nl != NULL ? (size_t) (nl - line) : avail;
+        *pos += nl != NULL ? line_len + 1 : line_len;
+        if (m->dead != NULL && csv_dead_has(m->dead, line - m->data)) continue;
+        csv_split_row(line, line_len, subject, grade, comment);
+        if (m->filter == NULL || row_filter_match(m->filter, *subject, *grade, line + line_len, m->timed, NULL)) return true;
+    }
+    return false;
+}
+
+/**
+ * Reads the next row of a csv reader as views into its buffer,
+ * which stay valid until the reader is used again.
+ * arg(comment) output parameter for the comment, may be NULL
+ * returns false if there are no more rows
+ */
+bool csv_reader_next_row(CsvReader *r, CsvField *subject, CsvField *grade, CsvField *comment) {
+    const char *line;
+    size_t line_len;
+    if (!csv_reader_line(r, &line, &line_len)) return false;
+    csv_split_row(line, line_len, subject, grade, comment);
+    return true;
+}
+
+
+bool csv_field_eq(CsvField f, char *s) {
+    return strlen(s) == f.len && memcmp(f.ptr, s, f.len) == 0;
+}
+
+/**
+ * Reads a field as grade, see grade_read.
+ * returns the grade or GRADE_INVALID if the field is malformed
+ */
+grade_t csv_field_to_grade(CsvField f) {
+    grade_t g;
+    return grade_read(f.ptr, f.len, &g) ? g : GRADE_INVALID;
+}
+
+/**
+ * Get array with all well formed grades.
+ * Rows are read as views into the buffer of the reader,
+ * nothing but the output array is allocated.
+ * arg(r) the csv reader
+ * arg(*o_size) an output parameter, containing the size of the output array 
+ * returns a grade array containing all grades
+ */
+grade_t *csv_grades(CsvReader *r, int *o_size) {
+    int cap = 16;
+    grade_t *out = malloc(sizeof(grade_t) * cap);
+    *o_size = 0;
+    CsvField s; // subject
+    CsvField g; // grade
+    csv_reader_next_row(r, &s, &g, NULL); // skip header
+    while (csv_reader_next_row(r, &s, &g, NULL) && s.len > 0) {
+        if (*o_size == cap) {
+            cap *= 2;
+            out = (grade_t *) realloc(out, sizeof(grade_t) * cap);
+        }
+        if (grade_read(g.ptr, g.len, &out[*o_size])) (*o_size)++;
+    } 
+    return out;
+}
+
+/**
+ * Get array with all well formed grades of a subject.
+ * arg(r) the csv reader
+ * arg(*subject) the target subject
+ * arg(*o_size) an output parameter, containing the size 
+ * of the returned array.
+ * returns a grade array containing all grades
+ * of a subject. 
+ */
+grade_t *csv_subject_grades(CsvReader *r, char *subject, int *o_size) {
+    int cap = 16;
+    grade_t *out = malloc(sizeof(grade_t) * cap);
+    *o_size = 0;
+    CsvField s; // subject
+    CsvField g; // grade
+    csv_reader_next_row(r, &s, &g, NULL); // skip header
+    while (csv_reader_next_row(r, &s, &g, NULL)) {
+        if (csv_field_eq(s, subject)) {
+            if (*o_size == cap) {
+                cap *= 2;
+                out = (grade_t *) realloc(out, sizeof(grade_t) * cap);
+            }
+            if (grade_read(g.ptr, g.len, &out[*o_size])) (*o_size)++;
+        }
+    } 
+    return out;
+}
+
+/**
+ * Structural index: the offsets of every delimiter and newline of
+ * a block, in ascending order. The tokenizer walks these offsets
+ * instead of looking at every byte. There are SSE2 and AVX2 kernels
+ * (picked at runtime by csv_index) and a portable scalar one.
+ *
+ * arg(buf)        the block to index
+ * arg(len)        size of the block
+ * arg(positions)  output array with room for len offsets
+ * returns the number of offsets written
+ */
+size_t csv_index_scalar_from(const char *buf, size_t i, size_t len, uint32_t *positions) {
+    size_t n = 0;
+    for (; i < len; i++) {
+        positions[n] = i;
+        n += buf[i] == CSV_DELIMITER || buf[i] == '\n';
+    }
+    return n;
+}
+
+size_t csv_index_scalar(const char *buf, size_t len, uint32_t *positions) {
+    return csv_index_scalar_from(buf, 0, len, positions);
+}
+
+#ifdef CSV_INDEX_X86
+__attribute__((target("sse2")))
+size_t csv_index_sse2(const char *buf, size_t len, uint32_t *positions) {
+    size_t n = 0;
+    size_t i = 0;
+    __m128i delim = _mm_set1_epi8(CSV_DELIMITER);
+    __m128i nl = _mm_set1_epi8('\n');
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (buf + i));
+        __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(v, delim), _mm_cmpeq_epi8(v, nl));
+        uint32_t mask = _mm_movemask_epi8(hits);
+        while (mask) {
+            positions[n++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return n + csv_index_scalar_from(buf, i, len, positions + n);
+}
+
+__attribute__((target("avx2")))
+size_t csv_index_avx2(const char *buf, size_t len, uint32_t *positions) {
+    size_t n = 0;
+    size_t i = 0;
+    __m256i delim = _mm256_set1_epi8(CSV_DELIMITER);
+    __m256i nl = _mm256_set1_epi8('\n');
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (buf + i));
+        __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(v, delim), _mm256_cmpeq_epi8(v, nl));
+        uint32_t mask = _mm256_movemask_epi8(hits);
+        while (mask) {
+            positions[n++] = i + __builtin_ctz(mask);
+            mask &= mask - 1;
+        }
+    }
+    return n + csv_index_scalar_from(buf, i, len, positions + n);
+}
+#endif
+
+size_t (*csv_index_kernel)(const char *, size_t, uint32_t *) = NULL;
+pthread_once_t csv_index_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Selects the fastest kernel the cpu supports, once per process
+ * since scans run on several threads.
+ */
+void csv_index_select() {
+    csv_index_kernel = csv_index_scalar;
+#ifdef CSV_INDEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) csv_index_kernel = csv_index_sse2;
+    if (__builtin_cpu_supports("avx2")) csv_index_kernel = csv_index_avx2;
+#endif
+}
+
+/**
+ * Builds the structural index of a block with the fastest kernel
+ * the cpu supports.
+ */
+size_t csv_index(const char *buf, size_t len, uint32_t *positions) {
+    pthread_once(&csv_index_once, csv_index_select);
+    return csv_index_kernel(buf, len, positions);
+}
+
+/**
+ * Get array with all well formed grades (or all grades of a subject)
+ * from a mapped csv. Rows are tokenized in place, no field is
+ * copied to the heap.
+ * arg(m)        the mapped csv
+ * arg(subject)  the target subject or NULL for all subjects
+ * arg(*o_size)  an output parameter, containing the size of the output array
+ * returns a grade array containing the grades
+ */
+grade_t *csv_map_grades(CsvMap *m, char *subject, int *o_size) {
+    int cap = 16;
+    grade_t *out = malloc(sizeof(grade_t) * cap);
+    *o_size = 0;
+    size_t pos = 0;
+    CsvField s, g;
+    csv_map_next_row(m, &pos, &s, &g, NULL); // skip header
+    while (csv_map_next_row(m, &pos, &s, &g, NULL)) {
+        if (s.len == 0) continue;
+        if (subject != NULL && !csv_field_eq(s, subject)) continue;
+        if (*o_size == cap) {
+            cap *= 2;
+            out = (grade_t *) realloc(out, sizeof(grade_t) * cap);
+        }
+        if (grade_read(g.ptr, g.len, &out[*o_size])) (*o_size)++;
+    }
+    return out;
+}
+
+/**
+ * Buffered writer on a file descriptor. Collects small writes
+ * in a CSV_WRITER_BUF_SIZE buffer and hands them to the kernel
+ * in one write() per full buffer.
+ */
+typedef struct csv_writer {
+    int fd;
+    char *buf;
+    size_t len;
+} CsvWriter;
+
+void csv_writer_init(CsvWriter *w, int fd) {
+    w->fd = fd;
+    w->buf = malloc(CSV_WRITER_BUF_SIZE);
+    if (w->buf == NULL) cmd_exit_errno("csv_writer_init malloc failed");
+    w->len = 0;
+}
+
+/**
+ * writes all buffered bytes to the fd or exits
+ * if write did not work
+ */
+void csv_writer_flush(CsvWriter *w) {
+    size_t off = 0;
+    while (off < w->len) {
+        ssize_t b = write(w->fd, w->buf + off, w->len - off);
+        if (b == -1) {
+            if (errno == EINTR) continue;
+            cmd_exit_errno("write failed");
+        }
+        off += b;
+    }
+    w->len = 0;
+}
+
+void csv_writer_write(CsvWriter *w, const char *s, size_t n) {
+    if (w->len + n > CSV_WRITER_BUF_SIZE) csv_writer_flush(w);
+    if (n > CSV_WRITER_BUF_SIZE) {
+        // too big for the buffer, write it directly
+        char *buf = w->buf;
+        w->buf = (char *) s;
+        w->len = n;
+        csv_writer_flush(w);
+        w->buf = buf;
+        return;
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+void csv_writer_puts(CsvWriter *w, char *s) {
+    csv_writer_write(w, s, strlen(s));
+}
+
+/**
+ * Writes a subject;grade;comment row.
+ */
+void csv_write_row(CsvWriter *w, char *subject, char *grade, char *comment) {
+    csv_writer_puts(w, subject);
+    csv_writer_write(w, ";", 1);
+    csv_writer_puts(w, grade);
+    csv_writer_write(w, ";", 1);
+    csv_writer_puts(w, comment);
+    csv_writer_write(w, "\n", 1);
+}
+
+/**
+ * Writes a subject;grade;comment row of fields, with time in front
+ * of the comment unless time is NULL.
+ * arg(time) "SECONDS;" of a row of a timed csv, or NULL
+ */
+void csv_write_fields(CsvWriter *w, CsvField subject, CsvField grade, char *time, CsvField comment) {
+    csv_writer_write(w, subject.ptr, subject.len);
+    csv_writer_write(w, ";", 1);
+    csv_writer_write(w, grade.ptr, grade.len);
+    csv_writer_write(w, ";", 1);
+    if (time != NULL) csv_writer_puts(w, time);
+    csv_writer_write(w, comment.ptr, comment.len);
+    csv_writer_write(w, "\n", 1);
+}
+
+/**
+ * flushes and releases the writer (does not close the fd)
+ */
+void csv_writer_free(CsvWriter *w) {
+    csv_writer_flush(w);
+    free(w->buf);
+    w->buf = NULL;
+}
+
+/**
+ * Output formats of status.
+ */
+typedef enum out_format {
+    OUT_TEXT,
+    OUT_CSV,
+    OUT_TSV,
+    OUT_JSON
+} OutFormat;
+
+/**
+ * Buffered writer on the command output. Small writes are
+ * collected in an OUT_BUF_SIZE buffer that is handed to cmd_out
+ * in one fwrite per full buffer, so listing many grades does not
+ * cost a printf call each.
+ */
+typedef struct out_buf {
+    char *buf;
+    size_t len;
+} OutBuf;
+
+void out_init(OutBuf *o) {
+    o->buf = malloc(OUT_BUF_SIZE);
+    if (o->buf == NULL) cmd_exit_errno("out_init malloc failed");
+    o->len = 0;
+}
+
+void out_flush(OutBuf *o) {
+    if (o->len > 0 && fwrite(o->buf, 1, o->len, cmd_out) != o->len) cmd_exit_errno("write failed");
+    o->len = 0;
+}
+
+void out_write(OutBuf *o, const char *s, size_t n) {
+    if (o->len + n > OUT_BUF_SIZE) out_flush(o);
+    if (n > OUT_BUF_SIZE) {
+        if (fwrite(s, 1, n, cmd_out) != n) cmd_exit_errno("write failed");
+        return;
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+void out_puts(OutBuf *o, const char *s) {
+    out_write(o, s, strlen(s));
+}
+
+void out_printf(OutBuf *o, const char *fmt, ...) {
+    char line[OUT_LINE_MAX];
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) return;
+    if ((size_t) n < sizeof(line)) {
+        out_write(o, line, n);
+        return;
+    }
+    // longer than OUT_LINE_MAX (e.g. a long subject), formatted again on the heap
+    char *heap = malloc(n + 1);
+    if (heap == NULL) cmd_exit_errno("out_printf malloc failed");
+    va_start(ap, fmt);
+    vsnprintf(heap, n + 1, fmt, ap);
+    va_end(ap);
+    out_write(o, heap, n);
+    free(heap);
+}
+
+/**
+ * Writes a grade with two decimals like grade_format, without
+ * going through printf.
+ */
+void out_grade(OutBuf *o, grade_t grade) {
+    char buf[GRADE_FORMAT_SIZE];
+    char *p = buf + sizeof(buf);
+    uint32_t v = grade < 0 ? -(uint32_t) grade : (uint32_t) grade;
+    *--p = '0' + v % 10;
+    *--p = '0' + v / 10 % 10;
+    *--p = '.';
+    v /= GRADE_SCALE;
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while (v > 0);
+    if (grade < 0) *--p = '-';
+    out_write(o, p, buf + sizeof(buf) - p);
+}
+
+/**
+ * Writes s as json string (with quotes).
+ */
+void out_json_string(OutBuf *o, const char *s) {
+    out_write(o, "\"", 1);
+    for (const char *p = s; *p; p++) {
+        unsigned char c = *p;
+        if (c == '"' || c == '\\') {
+            out_write(o, "\\", 1);
+            out_write(o, p, 1);
+        } else if (c < 0x20) {
+            out_printf(o, "\\u%04x", c);
+        } else {
+            out_write(o, p, 1);
+        }
+    }
+    out_write(o, "\"", 1);
+}
+
+/**
+ * Writes s as csv cell. Cells with a separator, a quote or a line
+ * break are quoted, with quotes doubled.
+ */
+void out_csv_string(OutBuf *o, const char *s) {
+    if (strpbrk(s, ";\"\r\n") == NULL) {
+        out_puts(o, s);
+        return;
+    }
+    out_write(o, "\"", 1);
+    for (const char *p = s; *p; p++) {
+        if (*p == '"') out_write(o, "\"", 1);
+        out_write(o, p, 1);
+    }
+    out_write(o, "\"", 1);
+}
+
+/**
+ * Writes s as tsv cell. Tabs, line breaks and backslashes are
+ * escaped as \t, \n, \r and \\.
+ */
+void out_tsv_string(OutBuf *o, const char *s) {
+    if (strpbrk(s, "\t\r\n\\") == NULL) {
+        out_puts(o, s);
+        return;
+    }
+    for (const char *p = s; *p; p++) {
+        if (*p == '\t') out_write(o, "\\t", 2);
+        else if (*p == '\r') out_write(o, "\\r", 2);
+        else if (*p == '\n') out_write(o, "\\n", 2);
+        else if (*p == '\\') out_write(o, "\\\\", 2);
+        else out_write(o, p, 1);
+    }
+}
+
+/**
+ * flushes and releases the writer
+ */
+void out_free(OutBuf *o) {
+    out_flush(o);
+    free(o->buf);
+    o->buf = NULL;
+}
+
+/**
+ * A table written as csv, tsv or json (an array of objects with
+ * the columns as keys). Values are added cell by cell, left to
+ * right, rows are closed with out_table_end_row.
+ */
+typedef struct out_table {
+    OutBuf *o;
+    OutFormat format;
+    const char **cols;
+    int n_cols;
+    int col;  // column of the next cell
+    int rows; // number of finished rows
+} OutTable;
+
+void out_table_begin(OutTable *t, OutBuf *o, OutFormat format, const char **cols, int n_cols) {
+    t->o = o;
+    t->format = format;
+    t->cols = cols;
+    t->n_cols = n_cols;
+    t->col = 0;
+    t->rows = 0;
+    if (format == OUT_JSON) {
+        out_write(o, "[", 1);
+        return;
+    }
+    for (int i = 0; i < n_cols; i++) {
+        if (i > 0) out_write(o, format == OUT_TSV ? "\t" : ";", 1);
+        out_puts(o, cols[i]);
+    }
+    out_write(o, "\n", 1);
+}
+
+/**
+ * Writes the separator (and for json the key) of the next cell.
+ */
+void out_table_cell(OutTable *t) {
+    if (t->format == OUT_JSON) {
+        out_puts(t->o, t->col > 0 ? "," : t->rows > 0 ? ",\n{" : "\n{");
+        out_json_string(t->o, t->cols[t->col]);
+        out_write(t->o, ":", 1);
+    } else if (t->col > 0) {
+        out_write(t->o, t->format == OUT_TSV ? "\t" : ";", 1);
+    }
+    t->col++;
+}
+
+void out_table_str(OutTable *t, const char *s) {
+    out_table_cell(t);
+    if (t->format == OUT_JSON) out_json_string(t->o, s);
+    else if (t->format == OUT_TSV) out_tsv_string(t->o, s);
+    else out_csv_string(t->o, s);
+}
+
+void out_table_int(OutTable *t, int64_t v) {
+    out_table_cell(t);
+    out_printf(t->o, "%lld", (long long) v);
+}
+
+void out_table_grade(OutTable *t, grade_t g) {
+    out_table_cell(t);
+    out_grade(t->o, g);
+}
+
+/**
+ * Writes a number of grades (e.g. an average) with two decimals.
+ */
+void out_table_num(OutTable *t, double v) {
+    out_table_cell(t);
+    out_printf(t->o, "%.2f", v);
+}
+
+/**
+ * Writes a missing value (null in json, empty otherwise).
+ */
+void out_table_null(OutTable *t) {
+    out_table_cell(t);
+    if (t->format == OUT_JSON) out_puts(t->o, "null");
+}
+
+void out_table_end_row(OutTable *t) {
+    out_write(t->o, t->format == OUT_JSON ? "}" : "\n", 1);
+    t->col = 0;
+    t->rows++;
+}
+
+void out_table_end(OutTable *t) {
+    if (t->format == OUT_JSON) out_puts(t->o, t->rows > 0 ? "\n]\n" : "]\n");
+}
+
+/**
+ * Creates a temporary file next to path (i.e. on the same file
+ * system) that can atomically replace it with csv_tmp_commit.
+ * The temporary file gets the permissions of path.
+ * arg(o_tmp_path) output parameter, the heap allocated tmp path
+ * returns the fd of the temporary file
+ */
+int csv_tmp_create(char *path, char **o_tmp_path) {
+    char *tmp_path = malloc(strlen(path) + strlen(TMP_CSV_SUFFIX) + 1);
+    strcpy(tmp_path, path);
+    strcat(tmp_path, TMP_CSV_SUFFIX);
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) cmd_exit_errno("create tmp file failed");
+    struct stat st;
+    if (stat(path, &st) == 0) fchmod(fd, st.st_mode & 0777);
+    *o_tmp_path = tmp_path;
+    return fd;
+}
+
+/**
+ * Creates a temporary file next to path like csv_tmp_create, but
+ * with the permissions of a new file: it is created with mode 0666
+ * under a random name, so the kernel applies the umask (which must
+ * not be changed, other threads may create files meanwhile).
+ * arg(o_tmp_path) output parameter, the heap allocated tmp path
+ * returns the fd of the temporary file
+ */
+int csv_tmp_create_new(char *path, char **o_tmp_path) {
+    size_t len = strlen(path) + strlen(TMP_CSV_SUFFIX) + 1;
+    char *tmp_path = malloc(len);
+    while (true) {
+        uint32_t r;
+        if (getrandom(&r, sizeof(r), 0) != sizeof(r)) r = (uint32_t) profile_clock(CLOCK_MONOTONIC) ^ getpid();
+        snprintf(tmp_path, len, "%s.%06x", path, r & 0xffffff);
+        int fd = open(tmp_path, O_WRONLY | O_CREAT | O_EXCL, 0666);
+        if (fd != -1) {
+            *o_tmp_path = tmp_path;
+            return fd;
+        }
+        if (errno != EEXIST) cmd_exit_errno("create tmp file failed");
+    }
+}
+
+/**
+ * Closes the temporary file and renames it to path.
+ */
+void csv_tmp_commit(int fd, char *tmp_path, char *path) {
+    if (close(fd) == -1) cmd_exit_errno(NULL);
+    if (rename(tmp_path, path) != 0) {
+        unlink(tmp_path);
+        cmd_exit_errno("failed to rename tmp csv");
+    }
+    free(tmp_path);
+}
+
+/**
+ * Header of the delete log. The log belongs to the csv file with
+ * the given device and inode, a log of a replaced csv is stale.
+ */
+typedef struct del_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t dev;
+    uint64_t ino;
+} DelHeader;
+
+/**
+ * Writes the delete log path of a csv into buf.
+ * arg(buf) output buffer of PATH_MAX chars
+ * returns buf
+ */
+char *csv_dead_path(char *csv_path, char *buf) {
+    snprintf(buf, PATH_MAX, "%s%s", csv_path, DEL_SUFFIX);
+    return buf;
+}
+
+/**
+ * returns whether h is the header of a delete log of the csv behind csv_fd
+ */
+bool csv_dead_header_ok(DelHeader *h, int csv_fd) {
+    struct stat st;
+    if (fstat(csv_fd, &st) == -1) cmd_exit_errno("fstat failed");
+    return memcmp(h->magic, DEL_MAGIC, 4) == 0 && h->version == DEL_VERSION
+        && h->dev == (uint64_t) st.st_dev && h->ino == (uint64_t) st.st_ino;
+}
+
+int del_entry_cmp(const void *a, const void *b) {
+    uint64_t x = ((const DelEntry *) a)->offset;
+    uint64_t y = ((const DelEntry *) b)->offset;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Loads the delete log of a csv. A missing, stale or broken log
+ * yields no deleted rows.
+ * arg(d)      output parameter, to be freed with csv_dead_free
+ * arg(csv_fd) the open csv
+ */
+void csv_dead_load(CsvDead *d, char *csv_path, int csv_fd) {
+    memset(d, 0, sizeof(*d));
+    char path[PATH_MAX];
+    int fd = open(csv_dead_path(csv_path, path), O_RDONLY);
+    if (fd == -1) return;
+    struct stat st;
+    DelHeader h;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(h)
+            && pread(fd, &h, sizeof(h), 0) == sizeof(h) && csv_dead_header_ok(&h, csv_fd)) {
+        size_t n = (st.st_size - sizeof(h)) / sizeof(DelEntry);
+        d->entries = malloc((n > 0 ? n : 1) * sizeof(DelEntry));
+        ssize_t bytes = pread(fd, d->entries, n * sizeof(DelEntry), sizeof(h));
+        if (bytes < 0) bytes = 0;
+        n = bytes / sizeof(DelEntry);
+        qsort(d->entries, n, sizeof(DelEntry), del_entry_cmp);
+        for (size_t i = 0; i < n; i++) {
+            if (d->n > 0 && d->entries[d->n - 1].offset == d->entries[i].offset) continue;
+            d->entries[d->n++] = d->entries[i];
+            d->bytes += d->entries[i].len;
+        }
+        d->log_size = st.st_size;
+    }
+    close(fd);
+}
+
+void csv_dead_free(CsvDead *d) {
+    free(d->entries);
+    memset(d, 0, sizeof(*d));
+}
+
+/**
+ * Appends entries to a delete log, starting a new log if there is
+ * none or it is stale. The caller holds the csv lock.
+ * arg(log_path) the delete log, see csv_dead_path
+ * arg(csv_fd)   the open csv
+ */
+void csv_dead_append(char *log_path, int csv_fd, DelEntry *entries, size_t n) {
+    int fd = open(log_path, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+    if (fd == -1) cmd_exit_errno("open delete log failed");
+    DelHeader h;
+    if (pread(fd, &h, sizeof(h), 0) != sizeof(h) || !csv_dead_header_ok(&h, csv_fd)) {
+        struct stat st;
+        if (fstat(csv_fd, &st) == -1) cmd_exit_errno("fstat failed");
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, DEL_MAGIC, 4);
+        h.version = DEL_VERSION;
+        h.dev = st.st_dev;
+        h.ino = st.st_ino;
+        if (ftruncate(fd, 0) == -1) cmd_exit_errno("truncate failed");
+        if (write(fd, &h, sizeof(h)) != sizeof(h)) cmd_exit_errno("write delete log failed");
+    }
+    if (lseek(fd, 0, SEEK_END) == -1) cmd_exit_errno("lseek failed");
+    size_t len = n * sizeof(DelEntry);
+    if (write(fd, entries, len) != (ssize_t) len) cmd_exit_errno("write delete log failed");
+    if (close(fd) == -1) cmd_exit_errno(NULL);
+}
+
+void csv_dead_remove(char *csv_path) {
+    char path[PATH_MAX];
+    unlink(csv_dead_path(csv_path, path));
+}
+
+/**
+ * Drops the entries of rows at or behind size from the delete log,
+ * before the csv is truncated to size. The shortened log replaces
+ * the old one atomically. The caller holds the csv lock.
+ */
+void csv_dead_truncate(char *csv_path, int csv_fd, size_t size) {
+    CsvDead d;
+    csv_dead_load(&d, csv_path, csv_fd);
+    size_t n = 0;
+    while (n < d.n && d.entries[n].offset < size) n++;
+    if (n == 0) {
+        csv_dead_remove(csv_path);
+    } else if (n < d.n) {
+        char path[PATH_MAX];
+        char *tmp_path;
+        int fd = csv_tmp_create(csv_dead_path(csv_path, path), &tmp_path);
+        csv_dead_append(tmp_path, csv_fd, d.entries, n);
+        csv_tmp_commit(fd, tmp_path, path);
+    }
+    csv_dead_free(&d);
+}
+
+/**
+ * The time index of a timed csv in "<csv>.tix" maps times to byte
+ * offsets. Rows are appended when they are added, so their times
+ * grow with their offsets. The index has an entry per block of
+ * TIME_INDEX_STRIDE rows: the offset of its first row, the smallest
+ * time of the block and the largest time of all rows up to the end
+ * of the block. Keeping the largest time as running maximum keeps
+ * the entries sorted, even if concurrent writers append rows a few
+ * seconds out of order. Like the stats sidecar, the index is
+ * extended by the queries that use it. Deleted rows keep their
+ * offsets, rewrites and truncations remove the index.
+ *
+ * Layout: TimeIndexHeader followed by n_entries TimeIndexEntry
+ */
+typedef struct time_index_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;      // bytes of the csv that have been indexed, always behind a newline
+    uint32_t n_entries;
+    uint32_t last_rows; // rows of the last block
+} TimeIndexHeader;
+
+typedef struct time_index_entry {
+    uint64_t offset; // first row of the block
+    int64_t min;     // smallest time of the block
+    int64_t max;     // largest time of the rows up to the end of the block
+} TimeIndexEntry;
+
+typedef struct time_index {
+    TimeIndexHeader h;
+    TimeIndexEntry *entries;
+    uint32_t cap;
+} TimeIndex;
+
+/**
+ * Writes the time index path of a csv followed by suffix into buf.
+ * arg(buf) output buffer of PATH_MAX chars
+ * returns buf
+ */
+char *time_index_path(char *csv_path, char *suffix, char *buf) {
+    snprintf(buf, PATH_MAX, "%s%s%s", csv_path, TIME_INDEX_SUFFIX, suffix);
+    return buf;
+}
+
+/**
+ * Loads the time index of a mapped csv, an empty index if there is
+ * none or it does not belong to the csv.
+ * arg(st) the identity of the csv
+ */
+void time_index_load(TimeIndex *idx, char *csv_path, CsvMap *m, struct stat *st) {
+    memset(&idx->h, 0, sizeof(idx->h));
+    memcpy(idx->h.magic, TIME_INDEX_MAGIC, 4);
+    idx->h.version = TIME_INDEX_VERSION;
+    idx->h.dev = st->st_dev;
+    idx->h.ino = st->st_ino;
+    idx->entries = NULL;
+    idx->cap = 0;
+    char path[PATH_MAX];
+    int fd = open(time_index_path(csv_path, "", path), O_RDONLY);
+    if (fd == -1) return;
+    TimeIndexHeader h;
+    if (read(fd, &h, sizeof(h)) == sizeof(h) && memcmp(h.magic, TIME_INDEX_MAGIC, 4) == 0
+            && h.version == TIME_INDEX_VERSION && h.dev == idx->h.dev && h.ino == idx->h.ino
+            && h.size <= m->size && (h.size == 0 || m->data[h.size - 1] == '\n')) {
+        size_t bytes = sizeof(TimeIndexEntry) * h.n_entries;
+        TimeIndexEntry *entries = malloc(bytes ? bytes : 1);
+        if (read(fd, entries, bytes) == bytes) {
+            idx->h = h;
+            idx->entries = entries;
+            idx->cap = h.n_entries;
+        } else {
+            free(entries);
+        }
+    }
+    close(fd);
+}
+
+void time_index_free(TimeIndex *idx) {
+    free(idx->entries);
+    idx->entries = NULL;
+    idx->cap = 0;
+}
+
+/**
+ * Indexes the complete rows of a mapped timed csv behind the part
+ * that is already indexed. Rows with malformed times are counted,
+ * but do not change the times of their block.
+ * returns false if there are no new rows
+ */
+bool time_index_extend(TimeIndex *idx, CsvMap *m) {
+    size_t end = m->size;
+    while (end > idx->h.size && m->data[end - 1] != '\n') end--;
+    if (end <= idx->h.size) return false;
+    CsvMap rows = { m->data, end, NULL, NULL, true };
+    size_t pos = idx->h.size;
+    CsvField s, g, c;
+    if (pos == 0) csv_map_next_row(&rows, &pos, &s, &g, NULL); // skip header
+    for (size_t start = pos; csv_map_next_row(&rows, &pos, &s, &g, &c); start = pos) {
+        TimeIndexEntry *e = idx->h.n_entries > 0 ? &idx->entries[idx->h.n_entries - 1] : NULL;
+        if (e == NULL || idx->h.last_rows == TIME_INDEX_STRIDE) {
+            if (idx->h.n_entries == idx->cap) {
+                idx->cap = idx->cap ? idx->cap * 2 : 64;
+                idx->entries = realloc(idx->entries, sizeof(TimeIndexEntry) * idx->cap);
+            }
+            int64_t max = e != NULL ? e->max : INT64_MIN;
+            e = &idx->entries[idx->h.n_entries++];
+            e->offset = start;
+            e->min = INT64_MAX;
+            e->max = max;
+            idx->h.last_rows = 0;
+        }
+        idx->h.last_rows++;
+        const char *d = memchr(c.ptr, CSV_DELIMITER, c.len);
+        int64_t time;
+        if (!csv_time_parse(c.ptr, d != NULL ? (size_t) (d - c.ptr) : c.len, &time)) continue;
+        if (time < e->min) e->min = time;
+        if (time > e->max) e->max = time;
+    }
+    idx->h.size = end;
+    return true;
+}
+
+/**
+ * Replaces the time index of a csv. Failures are ignored, the
+ * index is rebuilt by the next query.
+ */
+void time_index_write(char *csv_path, TimeIndex *idx) {
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    time_index_path(csv_path, "", path);
+    time_index_path(csv_path, TMP_CSV_SUFFIX, tmp_path);
+    int fd = mkstemp(tmp_path);
+    if (fd == -1) return;
+    CsvWriter w;
+    csv_writer_init(&w, fd);
+    csv_writer_write(&w, (char *) &idx->h, sizeof(idx->h));
+    csv_writer_write(&w, (char *) idx->entries, sizeof(TimeIndexEntry) * idx->h.n_entries);
+    csv_writer_free(&w);
+    close(fd);
+    if (rename(tmp_path, path) != 0) unlink(tmp_path);
+}
+
+void time_index_remove(char *csv_path) {
+    char path[PATH_MAX];
+    unlink(time_index_path(csv_path, "", path));
+}
+
+/**
+ * Narrows the rows of a csv with times in [since, until) down to
+ * the byte range [*o_start, *o_end): every row before it is older
+ * than since and every row behind it is not older than until. The
+ * start is searched binary on the running maximum, the end by
+ * walking back over the blocks that are entirely too new.
+ * arg(size) the size of the csv
+ */
+void time_index_range(TimeIndex *idx, int64_t since, int64_t until, size_t size, size_t *o_start, size_t *o_end) {
+    TimeIndexEntry *e = idx->entries;
+    int n = idx->h.n_entries;
+    int lo = 0;
+    int hi = n;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (e[mid].max < since) lo = mid + 1;
+        else hi = mid;
+    }
+    *o_start = lo < n ? e[lo].offset : idx->h.size;
+    *o_end = size;
+    if (idx->h.size < size) return; // a row that is being written has no known time
+    int64_t min = INT64_MAX;
+    for (int i = n - 1; i >= lo; i--) {
+        if (e[i].min < min) min = e[i].min;
+        if (min < until) break;
+        *o_end = e[i].offset;
+    }
+}
+
+/**
+ * returns the comment field of a row of a timed csv: time followed
+ * by comment, allocated from arena
+ */
+char *csv_time_comment(Arena *arena, int64_t time, const char *comment, size_t len) {
+    char *buf = arena_alloc(arena, len + 24);
+    int n = snprintf(buf, 24, "%lld;", (long long) time);
+    memcpy(buf + n, comment, len);
+    buf[n + len] = '\0';
+    return buf;
+}
+
+/**
+ * returns whether the csv at path is timed, false for binary books
+ */
+bool csv_is_timed(char *path) {
+    char buf[sizeof(CSV_HEADER_TIMED) + 1];
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    ssize_t n = read(fd, buf, sizeof(buf));
+    close(fd);
+    return n > 0 && csv_header_timed(buf, n);
+}
+
+/**
+ * Creates the csv with its header. The header is written to a
+ * temporary file which is then linked to the csv path, so the csv
+ * never exists without header (and link fails if it exists).
+ * arg(timed) whether the rows of the csv carry their time
+ * returns false if the csv already exists
+ */
+bool csv_init_file(char *path, bool timed) {
+    char *tmp_path;
+    int fd = csv_tmp_create_new(path, &tmp_path);
+    csv_write_string(fd, timed ? CSV_HEADER_TIMED "\n" : CSV_HEADER "\n");
+    if (close(fd) == -1) cmd_exit_errno(NULL);
+    int res = link(tmp_path, path);
+    int err = errno;
+    unlink(tmp_path);
+    free(tmp_path);
+    if (res == -1 && err == EEXIST) return false;
+    errno = err;
+    if (res == -1) cmd_exit_errno("init csv failed");
+    csv_dead_remove(path); // left by a deleted csv whose inode may be reused
+    time_index_remove(path);
+    return true;
+}
+
+/**
+ * Opens path and takes an exclusive advisory lock on it. add, rm
+ * and rewrites hold the lock while they modify a grade book. As a
+ * rewrite replaces the file at path, the lock is taken again until
+ * it is held on the file that is currently at path.
+ * returns the locked fd or -1 if path does not exist
+ */
+int csv_open_locked(char *path, int flags) {
+    while (true) {
+        int fd = open(path, flags);
+        if (fd == -1 && errno == ENOENT) return -1;
+        if (fd == -1) cmd_exit_errno("open file failed");
+        while (flock(fd, LOCK_EX) == -1) {
+            if (errno != EINTR) cmd_exit_errno("lock failed");
+        }
+        struct stat fd_st, path_st;
+        if (fstat(fd, &fd_st) == -1) cmd_exit_errno("fstat failed");
+        if (stat(path, &path_st) == 0 && path_st.st_dev == fd_st.st_dev && path_st.st_ino == fd_st.st_ino) {
+            cmd_own((CmdResource) { cmd_release_fd, fd, NULL, 0 });
+            return fd;
+        }
+        close(fd);
+    }
+}
+
+/**
+ * Closes an fd of csv_open_locked, which releases the lock.
+ * returns the result of close
+ */
+int csv_close_locked(int fd) {
+    cmd_disown(fd, NULL);
+    return close(fd);
+}
+
+/**
+ * Counting histogram of grades. Grades in [0, HIST_MAX_GRADE] are
+ * counted in one bucket per hundredth, so order statistics are exact
+ * and memory does not grow with the number of grades. The rare grades
+ * above the domain are kept in an overflow list.
+ */
+typedef struct grade_hist {
+    int64_t counts[HIST_MAX_GRADE + 1];
+    grade_t *overflow;
+    int n_overflow;
+    int cap_overflow;
+    bool sorted; // whether overflow is sorted
+} GradeHist;
+
+GradeHist *grade_hist_create() {
+    return calloc(1, sizeof(GradeHist));
+}
+
+void grade_hist_free(GradeHist *h) {
+    if (h == NULL) return;
+    free(h->overflow);
+    free(h);
+}
+
+void grade_hist_add(GradeHist *h, grade_t grade) {
+    if (grade >= 0 && grade <= HIST_MAX_GRADE) {
+        h->counts[grade]++;
+        return;
+    }
+    if (h->n_overflow == h->cap_overflow) {
+        h->cap_overflow = h->cap_overflow ? h->cap_overflow * 2 : 8;
+        h->overflow = realloc(h->overflow, sizeof(grade_t) * h->cap_overflow);
+    }
+    h->overflow[h->n_overflow++] = grade;
+    h->sorted = false;
+}
+
+void grade_hist_merge(GradeHist *dst, GradeHist *src) {
+    for (int g = 0; g <= HIST_MAX_GRADE; g++) dst->counts[g] += src->counts[g];
+    for (int i = 0; i < src->n_overflow; i++) grade_hist_add(dst, src->overflow[i]);
+}
+
+int grade_cmp(const void *a, const void *b) {
+    grade_t x = *(const grade_t *) a;
+    grade_t y = *(const grade_t *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * returns the k-th (0-based) smallest grade of the histogram,
+ * k has to be smaller than the number of grades
+ */
+grade_t grade_hist_kth(GradeHist *h, int64_t k) {
+    for (int g = 0; g <= HIST_MAX_GRADE; g++) {
+        if (k < h->counts[g]) return g;
+        k -= h->counts[g];
+    }
+    if (!h->sorted) {
+        qsort(h->overflow, h->n_overflow, sizeof(grade_t), grade_cmp);
+        h->sorted = true;
+    }
+    return h->overflow[k];
+}
+
+/**
+ * returns the median of count grades (the mean of the two middle
+ * grades if count is even) in hundredths
+ */
+double grade_hist_median(GradeHist *h, int64_t count) {
+    return (grade_hist_kth(h, (count - 1) / 2) + (double) grade_hist_kth(h, count / 2)) / 2;
+}
+
+/**
+ * returns the p-th percentile of count grades (nearest rank)
+ */
+grade_t grade_hist_percentile(GradeHist *h, int64_t count, int p) {
+    int64_t rank = (count * p + 99) / 100;
+    return grade_hist_kth(h, rank > 0 ? rank - 1 : 0);
+}
+
+/**
+ * returns the population standard deviation of count grades with
+ * the given mean, both in hundredths
+ */
+double grade_hist_stddev(GradeHist *h, int64_t count, double mean) {
+    double sq = 0;
+    for (int g = 0; g <= HIST_MAX_GRADE; g++) {
+        if (h->counts[g] > 0) sq += h->counts[g] * (g - mean) * (g - mean);
+    }
+    for (int i = 0; i < h->n_overflow; i++) sq += (h->overflow[i] - mean) * (h->overflow[i] - mean);
+    return sqrt(sq / count);
+}
+
+/**
+ * Aggregated grades of one subject.
+ */
+typedef struct subject_stats {
+    char *name;
+    int64_t count;
+    int64_t sum; // exact sum of the grades in hundredths
+    grade_t min;
+    grade_t max;
+    int64_t n_invalid; // rows whose grade could not be read
+    GradeHist *hist; // NULL unless the table keeps histograms
+} SubjectStats;
+
+/**
+ * Per subject aggregates, hashed by subject name. Subjects are
+ * kept in order of their first occurrence.
+ */
+typedef struct stats_table {
+    SubjectIndex index;
+    SubjectStats *stats;
+    int n;
+    int cap;
+    bool hist; // whether a histogram is kept per subject
+} StatsTable;
+
+void stats_table_init(StatsTable *t) {
+    subject_index_init(&t->index);
+    t->stats = NULL;
+    t->n = 0;
+    t->cap = 0;
+    t->hist = false;
+}
+
+void stats_table_free(StatsTable *t) {
+    for (int i = 0; i < t->n; i++) {
+        free(t->stats[i].name);
+        grade_hist_free(t->stats[i].hist);
+    }
+    free(t->stats);
+    subject_index_free(&t->index);
+    t->stats = NULL;
+    t->n = 0;
+    t->cap = 0;
+}
+
+/**
+ * returns the stats of a subject, creates them if the subject is new
+ */
+SubjectStats *stats_table_get(StatsTable *t, const char *name, size_t len) {
+    int id = subject_index_find(&t->index, name, len);
+    if (id != -1) return &t->stats[id];
+    if (t->n == t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 8;
+        t->stats = (SubjectStats *) realloc(t->stats, sizeof(SubjectStats) * t->cap);
+    }
+    SubjectStats *st = &t->stats[t->n];
+    st->name = strndup(name, len);
+    st->count = 0;
+    st->sum = 0;
+    st->min = 0;
+    st->max = 0;
+    st->n_invalid = 0;
+    st->hist = t->hist ? grade_hist_create() : NULL;
+    subject_index_insert(&t->index, st->name, len, t->n++);
+    return st;
+}
+
+/**
+ * Adds a grade to the stats, malformed grades are only counted.
+ */
+void subject_stats_add(SubjectStats *st, grade_t grade) {
+    if (grade == GRADE_INVALID) {
+        st->n_invalid++;
+        return;
+    }
+    if (st->count == 0 || grade < st->min) st->min = grade;
+    if (st->count == 0 || grade > st->max) st->max = grade;
+    st->count++;
+    st->sum += grade;
+    if (st->hist != NULL) grade_hist_add(st->hist, grade);
+}
+
+/**
+ * Adds the stats of src to dst. Subjects that are new to dst are
+ * appended in the order of src.
+ */
+void stats_table_merge(StatsTable *dst, StatsTable *src) {
+    for (int i = 0; i < src->n; i++) {
+        SubjectStats *s = &src->stats[i];
+        SubjectStats *d = stats_table_get(dst, s->name, strlen(s->name));
+        d->n_invalid += s->n_invalid;
+        if (s->count == 0) continue;
+        if (d->count == 0 || s->min < d->min) d->min = s->min;
+        if (d->count == 0 || s->max > d->max) d->max = s->max;
+        d->count += s->count;
+        d->sum += s->sum;
+        if (d->hist != NULL && s->hist != NULL) grade_hist_merge(d->hist, s->hist);
+    }
+}
+
+/**
+ * Aggregates the rows of the mapped csv in [pos, m->size) into t.
+ * Rows that fail m->filter are rejected before they are aggregated.
+ */
+void csv_map_stats(CsvMap *m, size_t pos, StatsTable *t) {
+    uint32_t *idx = malloc(sizeof(uint32_t) * CSV_INDEX_BLOCK);
+    CsvField s, g;
+    while (pos < m->size) {
+        const char *block = m->data + pos;
+        size_t len = m->size - pos < CSV_INDEX_BLOCK ? m->size - pos : CSV_INDEX_BLOCK;
+        size_t n = csv_index(block, len, idx);
+        size_t row = 0; // start of the current row within block
+        size_t i = 0;
+        // walk the rows that end within the block
+        while (i < n) {
+            size_t p1 = idx[i++];
+            s.ptr = block + row;
+            s.len = p1 - row;
+            g.ptr = block + p1;
+            g.len = 0;
+            if (block[p1] != '\n') {
+                if (i == n) break;
+                size_t p2 = idx[i++];
+                g.ptr = block + p1 + 1;
+                g.len = p2 - p1 - 1;
+                while (block[p2] != '\n' && i < n) p2 = idx[i++];
+                if (block[p2] != '\n') break;
+                row = p2 + 1;
+            } else {
+                row = p1 + 1;
+            }
+            if (s.len == 0 || (m->dead != NULL && csv_dead_has(m->dead, s.ptr - m->data))) continue;
+            grade_t grade;
+            if (m->filter == NULL) grade = csv_field_to_grade(g);
+            else if (!row_filter_match(m->filter, s, g, block + row - 1, m->timed, &grade)) continue;
+            subject_stats_add(stats_table_get(t, s.ptr, s.len), grade);
+        }
+        if (row > 0) {
+            pos += row;
+        } else if (csv_map_next_row(m, &pos, &s, &g, NULL) && s.len > 0) {
+            // a row longer than a block or the last row without newline
+            subject_stats_add(stats_table_get(t, s.ptr, s.len), csv_field_to_grade(g));
+        }
+    }
+    free(idx);
+}
+
+/**
+ * A byte range of a mapped csv aggregated by one thread.
+ */
+typedef struct stats_chunk {
+    CsvMap map;   // the csv, truncated to the end of the range
+    size_t start; // start of the range, always the start of a row
+    StatsTable t;
+    pthread_t thread;
+} StatsChunk;
+
+void *stats_chunk_run(void *arg) {
+    StatsChunk *c = arg;
+    csv_map_stats(&c->map, c->start, &c->t);
+    return NULL;
+}
+
+/**
+ * Splits [pos, m->size) into n_threads ranges that start at rows,
+ * aggregates every range in its own thread and merges the partial
+ * tables in file order, so subjects end up in the same order as
+ * with a serial scan.
+ */
+void csv_map_stats_parallel(CsvMap *m, size_t pos, StatsTable *t, int n_threads) {
+    StatsChunk *chunks = malloc(sizeof(StatsChunk) * n_threads);
+    size_t range = (m->size - pos) / n_threads;
+    size_t start = pos;
+    for (int i = 0; i < n_threads; i++) {
+        size_t end = i == n_threads - 1 ? m->size : pos + range * (i + 1);
+        if (end < start) end = start;
+        // snap the end behind the next newline
+        if (end < m->size && end > 0 && m->data[end - 1] != '\n') {
+            char *nl = memchr(m->data + end, '\n', m->size - end);
+            end = nl != NULL ? (size_t) (nl - m->data) + 1 : m->size;
+        }
+        chunks[i].map.data = m->data;
+        chunks[i].map.size = end;
+        chunks[i].map.dead = m->dead;
+        chunks[i].map.filter = m->filter;
+        chunks[i].map.timed = m->timed;
+        chunks[i].start = start;
+        stats_table_init(&chunks[i].t);
+        chunks[i].t.hist = t->hist;
+        if (pthread_create(&chunks[i].thread, NULL, stats_chunk_run, &chunks[i]) != 0) {
+            stats_chunk_run(&chunks[i]); // no thread available, do it here
+            chunks[i].thread = pthread_self();
+        }
+        start = end;
+    }
+    for (int i = 0; i < n_threads; i++) {
+        if (!pthread_equal(chunks[i].thread, pthread_self())) pthread_join(chunks[i].thread, NULL);
+        stats_table_merge(t, &chunks[i].t);
+        stats_table_free(&chunks[i].t);
+    }
+    free(chunks);
+}
+
+/**
+ * returns the number of online cpus
+ */
+int cpu_count() {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+}
+
+/**
+ * Aggregates the rows of the mapped csv in [pos, m->size) into t,
+ * large ranges with up to n_threads threads (0 for the number of
+ * cpus).
+ */
+void csv_map_stats_threads(CsvMap *m, size_t pos, StatsTable *t, int n_threads) {
+    if (n_threads == 0) n_threads = cpu_count();
+    size_t max_threads = (m->size - pos) / STATS_MIN_CHUNK + 1;
+    if (n_threads > max_threads) n_threads = max_threads;
+    if (n_threads > 1) csv_map_stats_parallel(m, pos, t, n_threads);
+    else csv_map_stats(m, pos, t);
+}
+
+/**
+ * Aggregates the rows of a csv file into t in a single pass.
+ * The file is mapped if possible, otherwise read with a CsvReader.
+ * Large mapped files are aggregated by several threads.
+ * arg(fd)        the csv file
+ * arg(t)         the table to aggregate into
+ * arg(offset)    byte offset of the first row to aggregate, 0 to
+ *                aggregate the whole file (the header is skipped)
+ * arg(n_threads) maximum number of threads, 0 for the number of cpus
+ * arg(dead)      deleted rows that are skipped, may be NULL
+ * arg(filter)    rows that are aggregated, may be NULL for all
+ * returns the offset up to which the file has been aggregated
+ */
+size_t csv_stats(int fd, StatsTable *t, size_t offset, int n_threads, const CsvDead *dead, const RowFilter *filter) {
+    CsvMap m;
+    if (csv_map_open(&m, fd)) {
+        m.dead = dead;
+        size_t pos = offset;
+        CsvField s, g;
+        if (offset == 0) csv_map_next_row(&m, &pos, &s, &g, NULL); // skip header
+        m.filter = filter;
+        csv_map_stats_threads(&m, pos, t, n_threads);
+        size_t size = m.size;
+        csv_map_close(&m);
+        return size;
+    }
+    if (offset > 0 && lseek(fd, offset, SEEK_SET) == -1) cmd_exit_errno("csv_stats lseek failed");
+    CsvReader r;
+    csv_reader_init(&r, fd);
+    CsvField s, g, c;
+    bool timed = false;
+    if (offset == 0 && csv_reader_next_row(&r, &s, &g, &c)) timed = csv_header_timed(s.ptr, c.ptr + c.len - s.ptr); // skip header
+    while (csv_reader_next_row(&r, &s, &g, &c)) {
+        if (s.len == 0) continue;
+        grade_t grade;
+        if (filter == NULL) grade = csv_field_to_grade(g);
+        else if (!row_filter_match(filter, s, g, c.ptr + c.len, timed, &grade)) continue;
+        subject_stats_add(stats_table_get(t, s.ptr, s.len), grade);
+    }
+    csv_reader_free(&r);
+    off_t end = lseek(fd, 0, SEEK_CUR);
+    return end == -1 ? 0 : end;
+}
+
+/**
+ * Like csv_stats, but stops before an incomplete last row (one that
+ * is still being written), so the returned offset is a row boundary
+ * that the aggregation can be resumed at.
+ */
+size_t csv_stats_complete(int fd, StatsTable *t, size_t offset, int n_threads, const CsvDead *dead) {
+    CsvMap m;
+    if (!csv_map_open(&m, fd)) return csv_stats(fd, t, offset, n_threads, dead, NULL);
+    m.dead = dead;
+    size_t pos = offset;
+    CsvField s, g;
+    if (offset == 0) csv_map_next_row(&m, &pos, &s, &g, NULL); // skip header
+    size_t size = m.size, end = size;
+    while (end > pos && m.data[end-1] != '\n') end--;
+    if (end < pos) end = pos;
+    m.size = end;
+    csv_map_stats_threads(&m, pos, t, n_threads);
+    m.size = size;
+    csv_map_close(&m);
+    return end;
+}
+
+/**
+ * The stats sidecar caches the StatsTable of a csv file in
+ * "<csv>.idx" together with the size, mtime and inode of the
+ * csv it was built from. Since add only appends to the csv, a
+ * grown csv is brought up to date by aggregating the appended
+ * tail. Any other change, including a change of the delete log,
+ * invalidates the sidecar.
+ *
+ * Layout: StatsSidecarHeader followed by n_subjects entries of
+ * { uint32 name_len, name, int64 count, int64 sum, int32 min, int32 max }
+ */
+typedef struct stats_sidecar_header {
+    char magic[4];
+    uint32_t version;
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;       // bytes of the csv that have been aggregated
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t del_size;   // size of the delete log that has been applied
+    uint32_t n_subjects;
+    uint32_t tail_len;
+    char tail[SIDECAR_TAIL_SIZE]; // last bytes before size, to detect in place edits
+} StatsSidecarHeader;
+
+/**
+ * Writes the sidecar path of a csv followed by suffix into buf.
+ * arg(buf) output buffer of PATH_MAX chars
+ * returns buf
+ */
+char *stats_sidecar_path(char *csv_path, char *suffix, char *buf) {
+    snprintf(buf, PATH_MAX, "%s%s%s", csv_path, SIDECAR_SUFFIX, suffix);
+    return buf;
+}
+
+/**
+ * Reads the last bytes before offset into the header.
+ */
+bool stats_sidecar_tail(int fd, size_t offset, StatsSidecarHeader *h) {
+    h->tail_len = offset < SIDECAR_TAIL_SIZE ? offset : SIDECAR_TAIL_SIZE;
+    return pread(fd, h->tail, h->tail_len, offset - h->tail_len) == h->tail_len;
+}
+
+/**
+ * Loads a sidecar into an empty table.
+ * returns false if there is no valid sidecar
+ */
+bool stats_sidecar_read(char *csv_path, StatsTable *t, StatsSidecarHeader *h) {
+    char path[PATH_MAX];
+    int fd = open(stats_sidecar_path(csv_path, "", path), O_RDONLY);
+    if (fd == -1) return false;
+    bool ok = read(fd, h, sizeof(*h)) == sizeof(*h)
+        && memcmp(h->magic, SIDECAR_MAGIC, 4) == 0
+        && h->version == SIDECAR_VERSION;
+    CsvReader r;
+    csv_reader_init(&r, fd);
+    for (uint32_t i = 0; ok && i < h->n_subjects; i++) {
+        uint32_t len;
+        char name[SIDECAR_NAME_MAX];
+        ok = csv_reader_read(&r, &len, sizeof(len)) && len < sizeof(name)
+            && csv_reader_read(&r, name, len);
+        if (!ok) break;
+        SubjectStats *st = stats_table_get(t, name, len);
+        ok = csv_reader_read(&r, &st->count, sizeof(st->count))
+            && csv_reader_read(&r, &st->sum, sizeof(st->sum))
+            && csv_reader_read(&r, &st->min, sizeof(st->min))
+            && csv_reader_read(&r, &st->max, sizeof(st->max))
+            && csv_reader_read(&r, &st->n_invalid, sizeof(st->n_invalid));
+    }
+    csv_reader_free(&r);
+    close(fd);
+    return ok;
+}
+
+/**
+ * Writes the sidecar of a csv. Failures are ignored, the sidecar
+ * is only a cache.
+ */
+void stats_sidecar_write(char *csv_path, StatsTable *t, int csv_fd, struct stat *st, size_t size, uint64_t del_size) {
+    StatsSidecarHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, SIDECAR_MAGIC, 4);
+    h.version = SIDECAR_VERSION;
+    h.dev = st->st_dev;
+    h.ino = st->st_ino;
+    h.size = size;
+    h.mtime_sec = st->st_mtim.tv_sec;
+    h.mtime_nsec = st->st_mtim.tv_nsec;
+    h.del_size = del_size;
+    h.n_subjects = t->n;
+    if (!stats_sidecar_tail(csv_fd, size, &h)) return;
+
+    char path[PATH_MAX];
+    char tmp_path[PATH_MAX];
+    stats_sidecar_path(csv_path, "", path);
+    stats_sidecar_path(csv_path, TMP_CSV_SUFFIX, tmp_path);
+    int fd = mkstemp(tmp_path); // unique, concurrent writers do not share it
+    if (fd != -1) {
+        CsvWriter w;
+        csv_writer_init(&w, fd);
+        csv_writer_write(&w, (char *) &h, sizeof(h));
+        for (int i = 0; i < t->n; i++) {
+            SubjectStats *s = &t->stats[i];
+            uint32_t len = strlen(s->name);
+            if (len >= SIDECAR_NAME_MAX) len = SIDECAR_NAME_MAX; // makes the sidecar invalid on read
+            csv_writer_write(&w, (char *) &len, sizeof(len));
+            csv_writer_write(&w, s->name, len);
+            csv_writer_write(&w, (char *) &s->count, sizeof(s->count));
+            csv_writer_write(&w, (char *) &s->sum, sizeof(s->sum));
+            csv_writer_write(&w, (char *) &s->min, sizeof(s->min));
+            csv_writer_write(&w, (char *) &s->max, sizeof(s->max));
+            csv_writer_write(&w, (char *) &s->n_invalid, sizeof(s->n_invalid));
+        }
+        csv_writer_free(&w);
+        close(fd);
+        if (rename(tmp_path, path) != 0) unlink(tmp_path);
+    }
+}
+
+void stats_sidecar_remove(char *csv_path) {
+    char path[PATH_MAX];
+    unlink(stats_sidecar_path(csv_path, "", path));
+}
+
+/**
+ * Writes the sidecar of the complete rows aggregated in t up to size,
+ * then adds an incomplete last row to t, which is not cached since
+ * it may still change.
+ */
+void csv_stats_cached_finish(char *csv_path, int fd, StatsTable *t, struct stat *st, size_t size, CsvDead *dead) {
+    stats_sidecar_write(csv_path, t, fd, st, size, dead->log_size);
+    if (size < (size_t) st->st_size) csv_stats(fd, t, size, 1, dead, NULL);
+    csv_dead_free(dead);
+}
+
+/**
+ * Fills t with the stats of the csv behind fd, using and updating
+ * the sidecar of regular files.
+ * arg(n_threads) maximum number of threads, 0 for the number of cpus
+ */
+void csv_stats_cached(char *csv_path, int fd, StatsTable *t, int n_threads) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) cmd_exit_errno("fstat failed");
+    if (!S_ISREG(st.st_mode)) {
+        csv_stats(fd, t, 0, n_threads, NULL, NULL);
+        return;
+    }
+    CsvDead dead;
+    csv_dead_load(&dead, csv_path, fd);
+    StatsSidecarHeader h;
+    if (stats_sidecar_read(csv_path, t, &h) && h.dev == st.st_dev && h.ino == st.st_ino
+            && h.del_size == dead.log_size) {
+        if (h.size == st.st_size && h.mtime_sec == st.st_mtim.tv_sec && h.mtime_nsec == st.st_mtim.tv_nsec) {
+            csv_dead_free(&dead);
+            return; // up to date
+        }
+        StatsSidecarHeader now;
+        if (h.size < st.st_size && stats_sidecar_tail(fd, h.size, &now)
+                && now.tail_len == h.tail_len && memcmp(now.tail, h.tail, h.tail_len) == 0) {
+            size_t size = csv_stats_complete(fd, t, h.size, n_threads, &dead); // only the appended rows
+            csv_stats_cached_finish(csv_path, fd, t, &st, size, &dead);
+            return;
+        }
+    }
+    stats_table_free(t);
+    stats_table_init(t);
+    size_t size = csv_stats_complete(fd, t, 0, n_threads, &dead);
+    csv_stats_cached_finish(csv_path, fd, t, &st, size, &dead);
+}
+
+/**
+ * Aggregates the rows of a csv that pass filter, which has a time
+ * predicate, into t. Only the byte range that the time index leaves
+ * is scanned, so queries on recent rows read the tail of the csv.
+ * The index is brought up to date first. Rows of csv files that are
+ * not timed never pass.
+ * arg(dead) deleted rows that are skipped, may be NULL
+ */
+void csv_stats_timed(char *csv_path, int fd, StatsTable *t, int n_threads, const CsvDead *dead, const RowFilter *filter) {
+    CsvMap m;
+    if (!csv_map_open(&m, fd)) {
+        csv_stats(fd, t, 0, n_threads, dead, filter);
+        return;
+    }
+    if (!m.timed) {
+        csv_map_close(&m);
+        return;
+    }
+    size_t pos = 0;
+    CsvField s, g;
+    csv_map_next_row(&m, &pos, &s, &g, NULL); // skip header
+    struct stat st;
+    if (fstat(fd, &st) == -1) cmd_exit_errno("fstat failed");
+    TimeIndex idx;
+    time_index_load(&idx, csv_path, &m, &st);
+    if (time_index_extend(&idx, &m)) time_index_write(csv_path, &idx);
+    size_t start, end;
+    time_index_range(&idx, filter->since, filter->until, m.size, &start, &end);
+    time_index_free(&idx);
+    if (start < pos) start = pos;
+    CsvMap range = { m.data, end > start ? end : start, dead, filter, true };
+    csv_map_stats_threads(&range, start, t, n_threads);
+    csv_map_close(&m);
+}
+
+/**
+ * In-memory representation of a csv file. Grades are grouped
+ * by subject, the original row order is kept in Subject.rows.
+ */
+typedef struct grade_book {
+    char *header;
+    Subject *subjects;
+    int n_subjects;
+    int cap_subjects;
+    SubjectIndex index; // subject name -> position in subjects
+    int n_rows;
+    int n_persisted; // rows [0, n_persisted) are stored in the csv file
+    bool rewrite;    // rows have been removed, the csv must be rewritten on save
+    bool text;       // whether grade_strs and comments are held
+    bool binary;     // whether the book is stored in the binary format
+    const RowFilter *filter; // only rows that pass are loaded, such a book is never saved
+    ino_t ino;       // inode of the file as of the last load or save, 0 if unknown
+    off_t size;      // its size then, -1 if it has been changed by someone else since
+    off_t del_size;  // size of its delete log then
+    Arena arena;     // owns the header, subject names, grade strings and comments
+} GradeBook;
+
+/**
+ * The grade book of the running session (shell, batch) or NULL.
+ * Commands work on it instead of the csv file, which is only
+ * written on sync and at the end of the session.
+ */
+GradeBook *session_gb = NULL;
+
+/**
+ * A reference to the i-th grade of a subject.
+ */
+typedef struct grade_ref {
+    Subject *subject;
+    int i;
+} GradeRef;
+
+/**
+ * Initializes an empty grade book.
+ * arg(text) whether grade strings and comments are kept, which
+ * is required to save rewritten books.
+ */
+void gradebook_init(GradeBook *gb, bool text) {
+    arena_init(&gb->arena);
+    gb->header = CSV_HEADER;
+    gb->subjects = NULL;
+    gb->n_subjects = 0;
+    gb->cap_subjects = 0;
+    subject_index_init(&gb->index);
+    gb->n_rows = 0;
+    gb->n_persisted = 0;
+    gb->rewrite = false;
+    gb->text = text;
+    gb->binary = false;
+    gb->filter = NULL;
+    gb->ino = 0;
+    gb->size = 0;
+    gb->del_size = 0;
+}
+
+void gradebook_free(GradeBook *gb) {
+    cmd_disown(-1, gb);
+    for (int i = 0; i < gb->n_subjects; i++) subject_free(&gb->subjects[i]);
+    free(gb->subjects);
+    subject_index_free(&gb->index);
+    arena_free(&gb->arena);
+    gb->subjects = NULL;
+    gb->header = NULL;
+    gb->n_subjects = 0;
+    gb->n_rows = 0;
+}
+
+void cmd_release_book(CmdResource *r) {
+    gradebook_free(r->ptr);
+}
+
+/**
+ * Lets cmd_release free the book if the running command fails. The
+ * book must outlive the jump (see CmdResource).
+ */
+void gradebook_own(GradeBook *gb) {
+    cmd_own((CmdResource) { cmd_release_book, -1, gb, 0 });
+}
+
+/**
+ * returns whether the book is a timed csv, whose comments start
+ * with the time of the row
+ */
+bool gradebook_timed(GradeBook *gb) {
+    return !gb->binary && streq(gb->header, CSV_HEADER_TIMED);
+}
+
+/**
+ * Finds the subject with the given name.
+ * arg(create) whether the subject should be created if it does not exist
+ * returns the subject or NULL
+ */
+Subject *gradebook_subject(GradeBook *gb, const char *name, size_t name_len, bool create) {
+    int id = subject_index_find(&gb->index, name, name_len);
+    if (id != -1) return &gb->subjects[id];
+    if (!create) return NULL;
+    if (gb->n_subjects == gb->cap_subjects) {
+        gb->cap_subjects = gb->cap_subjects ? gb->cap_subjects * 2 : 8;
+        gb->subjects = (Subject *) realloc(gb->subjects, sizeof(Subject) * gb->cap_subjects);
+    }
+    Subject *s = &gb->subjects[gb->n_subjects];
+    *s = subject_create(arena_strndup(&gb->arena, name, name_len));
+    subject_index_insert(&gb->index, s->name, name_len, gb->n_subjects++);
+    return s;
+}
+
+/**
+ * Appends a row to the grade book.
+ */
+void gradebook_add_row(GradeBook *gb, CsvField subject, CsvField grade, CsvField comment) {
+    Subject *s = gradebook_subject(gb, subject.ptr, subject.len, true);
+    char *grade_str = NULL;
+    char *comment_str = NULL;
+    if (gb->text) {
+        grade_str = arena_strndup(&gb->arena, grade.ptr, grade.len);
+        comment_str = arena_strndup(&gb->arena, comment.ptr, comment.len);
+    }
+    subject_insert_row(s, csv_field_to_grade(grade), grade_str, comment_str, gb->n_rows++);
+}
+
+void gradebook_add(GradeBook *gb, char *subject, char *grade, char *comment) {
+    CsvField s = { subject, strlen(subject) };
+    CsvField g = { grade, strlen(grade) };
+    CsvField c = { comment, strlen(comment) };
+    gradebook_add_row(gb, s, g, c);
+}
+
+/**
+ * Removes the i-th grade of a subject of the grade book.
+ */
+void gradebook_remove_at(GradeBook *gb, Subject *s, int i) {
+    int row = s->rows[i];
+    subject_remove_grade(s, i);
+    for (int j = 0; j < gb->n_subjects; j++) {
+        Subject *o = &gb->subjects[j];
+        for (int k = 0; k < o->n_grades; k++) {
+            if (o->rows[k] > row) o->rows[k]--;
+        }
+    }
+    gb->n_rows--;
+    if (row < gb->n_persisted) {
+        gb->n_persisted--;
+        gb->rewrite = true;
+    }
+}
+
+/**
+ * returns whether the i-th grade of a subject is written as grade.
+ * Grades of binary books are compared by value, their text is not stored.
+ */
+bool gradebook_grade_eq(GradeBook *gb, Subject *s, int i, char *grade) {
+    if (!gb->binary) return streq(s->grade_strs[i], grade);
+    grade_t g;
+    return grade_parse(grade, strlen(grade), &g) && g == s->grades[i];
+}
+
+/**
+ * Removes the index-th (0-based) grade of subject that equals grade.
+ * returns true if a grade has been removed
+ */
+bool gradebook_remove(GradeBook *gb, char *subject, char *grade, int index) {
+    Subject *s = gradebook_subject(gb, subject, strlen(subject), false);
+    if (s == NULL) return false;
+    for (int i = 0; i < s->n_grades; i++) {
+        if (!gradebook_grade_eq(gb, s, i, grade) || index-- > 0) continue;
+        gradebook_remove_at(gb, s, i);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * Removes the last row of the grade book.
+ * returns false if the book is empty
+ */
+bool gradebook_remove_last(GradeBook *gb) {
+    for (int j = 0; j < gb->n_subjects; j++) {
+        Subject *s = &gb->subjects[j];
+        if (s->n_grades > 0 && s->rows[s->n_grades - 1] == gb->n_rows - 1) {
+            gradebook_remove_at(gb, s, s->n_grades - 1);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * returns an array with a reference to every grade in csv row order
+ */
+GradeRef *gradebook_order(GradeBook *gb) {
+    GradeRef *order = malloc(sizeof(GradeRef) * (gb->n_rows ? gb->n_rows : 1));
+    for (int i = 0; i < gb->n_subjects; i++) {
+        Subject *s = &gb->subjects[i];
+        for (int k = 0; k < s->n_grades; k++) {
+            order[s->rows[k]].subject = s;
+            order[s->rows[k]].i = k;
+        }
+    }
+    return order;
+}
+
+/**
+ * returns whether a grade of the book passes the filter (comment
+ * predicates see an empty comment if the book holds no text)
+ */
+bool gradebook_row_passes(GradeBook *gb, const RowFilter *f, GradeRef ref) {
+    Subject *s = ref.subject;
+    if (!row_filter_subject(f, s->name, strlen(s->name)) || !row_filter_grade(f, s->grades[ref.i])) return false;
+    char *comment = gb->text ? s->comments[ref.i] : "";
+    return row_filter_rest(f, comment, strlen(comment), gradebook_timed(gb));
+}
+
+/**
+ * Aggregates the grades of the book that pass filter (may be NULL
+ * for all) into t.
+ */
+void gradebook_stats(GradeBook *gb, StatsTable *t, const RowFilter *filter) {
+    GradeRef *order = gradebook_order(gb);
+    for (int i = 0; i < gb->n_rows; i++) {
+        Subject *s = order[i].subject;
+        if (filter != NULL && !gradebook_row_passes(gb, filter, order[i])) continue;
+        subject_stats_add(stats_table_get(t, s->name, strlen(s->name)), s->grades[order[i].i]);
+    }
+    free(order);
+}
+
+/**
+ * Binary grade book. The file starts with a BinFileHeader followed
+ * by segments that store a batch of rows column by column:
+ *
+ *   BinSegmentHeader
+ *   dictionary { uint32 len, name }           subjects first used in the segment
+ *   grades     int32[n_rows]                  grade_t of every row
+ *   subjects   uint16[n_rows]                 dictionary id of every row
+ *   comments   { uint32 row, uint32 len, comment }  non empty comments only
+ *
+ * Every part is padded to 4 bytes. Dictionary ids count the
+ * subjects of all preceding segments. Appending rows writes a new
+ * segment, rewriting a book stores all rows in a single segment.
+ */
+typedef struct bin_file_header {
+    char magic[4];
+    uint32_t version;
+} BinFileHeader;
+
+typedef struct bin_segment_header {
+    char magic[4];
+    uint32_t n_rows;
+    uint32_t n_subjects;    // dictionary entries of the segment
+    uint32_t dict_size;     // bytes of the dictionary, padded
+    uint32_t comments_size; // bytes of the comment column, padded
+} BinSegmentHeader;
+
+/**
+ * A segment of a mapped binary grade book.
+ */
+typedef struct bin_segment {
+    BinSegmentHeader h;
+    const char *dict;
+    const int32_t *grades;
+    const uint16_t *subjects;
+    const char *comments;
+} BinSegment;
+
+#define BIN_PAD(n) (((n) + 3) & ~(size_t) 3)
+
+/**
+ * returns whether fd refers to a binary grade book
+ */
+bool bin_is_book(int fd) {
+    char magic[sizeof(BIN_MAGIC) - 1];
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, BIN_MAGIC, sizeof(magic)) == 0;
+}
+
+/**
+ * returns whether the file at path is a binary grade book
+ */
+bool book_is_binary(char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) return false;
+    bool binary = bin_is_book(fd);
+    close(fd);
+    return binary;
+}
+
+/**
+ * returns whether a mapped binary grade book has a supported version
+ */
+bool bin_map_supported(CsvMap *m) {
+    BinFileHeader h;
+    if (m->size < sizeof(h)) return false;
+    memcpy(&h, m->data, sizeof(h));
+    return h.version == BIN_VERSION;
+}
+
+/**
+ * Maps a binary grade book and checks its header.
+ */
+void bin_map_open(CsvMap *m, int fd) {
+    if (!csv_map_open(m, fd)) {
+        fprintf(cmd_out, "binary grade book can not be mapped\n");
+        cmd_exit(1);
+    }
+    if (!bin_map_supported(m)) {
+        csv_map_close(m);
+        fprintf(cmd_out, "unsupported binary grade book\n");
+        cmd_exit(1);
+    }
+}
+
+/**
+ * Reads the segment at *pos and advances *pos behind it.
+ * returns false at the end of the file or at a truncated segment,
+ * which is what an interrupted append leaves behind
+ */
+bool bin_next_segment(CsvMap *m, size_t *pos, BinSegment *seg) {
+    if (*pos + sizeof(seg->h) > m->size) return false;
+    memcpy(&seg->h, m->data + *pos, sizeof(seg->h));
+    if (memcmp(seg->h.magic, BIN_SEGMENT_MAGIC, sizeof(seg->h.magic)) != 0) return false;
+    if (seg->h.dict_size % 4 != 0 || seg->h.comments_size % 4 != 0) return false;
+    size_t grades_size = (size_t) seg->h.n_rows * sizeof(int32_t);
+    size_t subjects_size = BIN_PAD((size_t) seg->h.n_rows * sizeof(uint16_t));
+    size_t size = sizeof(seg->h) + seg->h.dict_size + grades_size + subjects_size + seg->h.comments_size;
+    if (size > m->size - *pos) return false;
+    const char *p = m->data + *pos + sizeof(seg->h);
+    seg->dict = p;
+    p += seg->h.dict_size;
+    seg->grades = (const int32_t *) p;
+    p += grades_size;
+    seg->subjects = (const uint16_t *) p;
+    p += subjects_size;
+    seg->comments = p;
+    *pos += size;
+    return true;
+}
+
+/**
+ * Reads a { uint32 len, bytes } entry of a column of size bytes.
+ * returns false at the end of the column or if the entry is malformed
+ */
+bool bin_read_string(const char *col, size_t size, size_t *off, CsvField *out) {
+    uint32_t len;
+    if (*off + sizeof(len) > size) return false;
+    memcpy(&len, col + *off, sizeof(len));
+    if (len > size - *off - sizeof(len)) return false;
+    out->ptr = col + *off + sizeof(len);
+    out->len = len;
+    *off += sizeof(len) + len;
+    return true;
+}
+
+/**
+ * Reads the next entry of the comment column of a segment.
+ * returns false at the end of the column
+ */
+bool bin_next_comment(BinSegment *seg, size_t *off, uint32_t *row, CsvField *comment) {
+    if (*off + sizeof(*row) > seg->h.comments_size) return false;
+    memcpy(row, seg->comments + *off, sizeof(*row));
+    *off += sizeof(*row);
+    return bin_read_string(seg->comments, seg->h.comments_size, off, comment);
+}
+
+/**
+ * Aggregates the grades of a mapped binary grade book into t.
+ * Only the dictionaries, grades and subject ids are read, the
+ * comment columns are skipped unless a comment predicate of the
+ * filter needs them. The subject predicate is evaluated once per
+ * dictionary entry.
+ * arg(filter) rows that are aggregated, may be NULL for all
+ */
+void bin_stats(CsvMap *m, StatsTable *t, const RowFilter *filter) {
+    int *ids = NULL; // dictionary id -> position in t->stats, -1 if rejected, -2 until a row passes
+    CsvField *names = NULL; // dictionary id -> subject name
+    int n_ids = 0;
+    size_t pos = sizeof(BinFileHeader);
+    BinSegment seg;
+    while (bin_next_segment(m, &pos, &seg)) {
+        ids = realloc(ids, sizeof(int) * (n_ids + seg.h.n_subjects + 1));
+        names = realloc(names, sizeof(CsvField) * (n_ids + seg.h.n_subjects + 1));
+        size_t off = 0;
+        for (uint32_t i = 0; i < seg.h.n_subjects && bin_read_string(seg.dict, seg.h.dict_size, &off, &names[n_ids]); i++) {
+            bool pass = filter == NULL || row_filter_subject(filter, names[n_ids].ptr, names[n_ids].len);
+            ids[n_ids++] = pass ? -2 : -1;
+        }
+        const int32_t *grades = seg.grades;
+        const uint16_t *subjects = seg.subjects;
+        bool comments = filter != NULL && (filter->n_comments > 0 || filter->has_time);
+        off = 0;
+        uint32_t comment_row = 0;
+        CsvField comment;
+        bool has_comment = comments && bin_next_comment(&seg, &off, &comment_row, &comment);
+        for (uint32_t i = 0; i < seg.h.n_rows; i++) {
+            uint16_t id = subjects[i];
+            if (id >= n_ids || ids[id] == -1) continue;
+            if (filter != NULL && !row_filter_grade(filter, grades[i])) continue;
+            if (comments) {
+                while (has_comment && comment_row < i) has_comment = bin_next_comment(&seg, &off, &comment_row, &comment);
+                bool row_comment = has_comment && comment_row == i;
+                if (!row_filter_rest(filter, row_comment ? comment.ptr : "", row_comment ? comment.len : 0, false)) continue;
+            }
+            if (ids[id] == -2) {
+                SubjectStats *st = stats_table_get(t, names[id].ptr, names[id].len);
+                ids[id] = st - t->stats; // read after stats_table_get, which may move t->stats
+            }
+            subject_stats_add(&t->stats[ids[id]], grades[i]);
+        }
+    }
+    free(ids);
+    free(names);
+}
+
+/**
+ * Loads a mapped binary grade book into an empty grade book.
+ * Comments are only read if the book holds text or gb->filter has
+ * a comment predicate.
+ */
+void bin_load(GradeBook *gb, CsvMap *m) {
+    int *ids = NULL; // dictionary id -> position in gb->subjects
+    int n_ids = 0;
+    size_t pos = sizeof(BinFileHeader);
+    BinSegment seg;
+    CsvField name, comment;
+    char buf[GRADE_FORMAT_SIZE];
+    while (bin_next_segment(m, &pos, &seg)) {
+        ids = realloc(ids, sizeof(int) * (n_ids + seg.h.n_subjects + 1));
+        size_t off = 0;
+        for (uint32_t i = 0; i < seg.h.n_subjects && bin_read_string(seg.dict, seg.h.dict_size, &off, &name); i++) {
+            bool pass = gb->filter == NULL || row_filter_subject(gb->filter, name.ptr, name.len);
+            int id = -1;
+            if (pass) {
+                Subject *s = gradebook_subject(gb, name.ptr, name.len, true);
+                id = s - gb->subjects; // read after gradebook_subject, which may move gb->subjects
+            }
+            ids[n_ids++] = id;
+        }
+        bool comments = gb->text || (gb->filter != NULL && gb->filter->n_comments > 0);
+        off = 0;
+        uint32_t comment_row = 0;
+        bool has_comment = comments && bin_next_comment(&seg, &off, &comment_row, &comment);
+        for (uint32_t i = 0; i < seg.h.n_rows; i++) {
+            if (seg.subjects[i] >= n_ids || ids[seg.subjects[i]] == -1) continue;
+            grade_t g = seg.grades[i];
+            if (gb->filter != NULL && !row_filter_grade(gb->filter, g)) continue;
+            bool row_comment = false;
+            if (comments) {
+                while (has_comment && comment_row < i) has_comment = bin_next_comment(&seg, &off, &comment_row, &comment);
+                row_comment = has_comment && comment_row == i;
+            }
+            if (gb->filter != NULL && !row_filter_rest(gb->filter, row_comment ? comment.ptr : "", row_comment ? comment.len : 0, false)) continue;
+            char *grade_str = NULL;
+            char *comment_str = NULL;
+            if (gb->text) {
+                grade_str = g != GRADE_INVALID ? grade_format(g, buf) : "";
+                grade_str = arena_strndup(&gb->arena, grade_str, strlen(grade_str));
+                comment_str = row_comment ? arena_strndup(&gb->arena, comment.ptr, comment.len) : "";
+            }
+            subject_insert_row(&gb->subjects[ids[seg.subjects[i]]], g, grade_str, comment_str, gb->n_rows++);
+        }
+    }
+    free(ids);
+}
+
+/**
+ * Appends a { uint32 len, bytes } entry to p.
+ * returns p behind the entry
+ */
+char *bin_put_string(char *p, const char *s, uint32_t len) {
+    memcpy(p, &len, sizeof(len));
+    memcpy(p + sizeof(len), s, len);
+    return p + sizeof(len) + len;
+}
+
+/**
+ * Encodes grades as a segment.
+ * arg(order)   references to the grades, in row order
+ * arg(n_rows)  size of order
+ * arg(dict)    subject name -> dictionary id of the file, subjects
+ *              that are not yet in the dictionary are added
+ * arg(n_dict)  number of dictionary ids in use, gets updated
+ * arg(o_len)   output parameter, the size of the segment
+ * returns the heap allocated segment
+ */
+char *bin_encode_segment(GradeRef *order, int n_rows, SubjectIndex *dict, int *n_dict, size_t *o_len) {
+    uint16_t *ids = malloc(sizeof(uint16_t) * (n_rows ? n_rows : 1));
+    Subject **new_subjects = malloc(sizeof(Subject *) * (n_rows ? n_rows : 1));
+    BinSegmentHeader h;
+    memcpy(h.magic, BIN_SEGMENT_MAGIC, sizeof(h.magic));
+    h.n_rows = n_rows;
+    h.n_subjects = 0;
+    h.dict_size = 0;
+    h.comments_size = 0;
+    for (int i = 0; i < n_rows; i++) {
+        Subject *s = order[i].subject;
+        size_t len = strlen(s->name);
+        int id = subject_index_find(dict, s->name, len);
+        if (id == -1) {
+            if (*n_dict == BIN_MAX_SUBJECTS) {
+                free(ids);
+                free(new_subjects);
+                fprintf(cmd_out, "the binary format is limited to %d subjects\n", BIN_MAX_SUBJECTS);
+                cmd_exit(1);
+            }
+            id = (*n_dict)++;
+            subject_index_insert(dict, s->name, len, id);
+            new_subjects[h.n_subjects++] = s;
+            h.dict_size += sizeof(uint32_t) + len;
+        }
+        ids[i] = id;
+        char *comment = s->comments != NULL ? s->comments[order[i].i] : NULL;
+        if (comment != NULL && *comment) h.comments_size += 2 * sizeof(uint32_t) + strlen(comment);
+    }
+    h.dict_size = BIN_PAD(h.dict_size);
+    h.comments_size = BIN_PAD(h.comments_size);
+    size_t subjects_size = BIN_PAD(sizeof(uint16_t) * n_rows);
+    size_t len = sizeof(h) + h.dict_size + sizeof(int32_t) * n_rows + subjects_size + h.comments_size;
+    char *seg = calloc(1, len);
+    memcpy(seg, &h, sizeof(h));
+
+    char *p = seg + sizeof(h);
+    for (uint32_t i = 0; i < h.n_subjects; i++) {
+        p = bin_put_string(p, new_subjects[i]->name, strlen(new_subjects[i]->name));
+    }
+    p = seg + sizeof(h) + h.dict_size;
+    int32_t *grades = (int32_t *) p;
+    for (int i = 0; i < n_rows; i++) grades[i] = order[i].subject->grades[order[i].i];
+    p += sizeof(int32_t) * n_rows;
+    memcpy(p, ids, sizeof(uint16_t) * n_rows);
+    p += subjects_size;
+    for (int i = 0; i < n_rows; i++) {
+        Subject *s = order[i].subject;
+        char *comment = s->comments != NULL ? s->comments[order[i].i] : NULL;
+        if (comment == NULL || !*comment) continue;
+        uint32_t row = i;
+        memcpy(p, &row, sizeof(row));
+        p = bin_put_string(p + sizeof(row), comment, strlen(comment));
+    }
+    free(ids);
+    free(new_subjects);
+    *o_len = len;
+    return seg;
+}
+
+/**
+ * Writes all grades into a new binary grade book that replaces path.
+ */
+void bin_save(char *path, GradeRef *order, int n_rows) {
+    SubjectIndex dict;
+    subject_index_init(&dict);
+    int n_dict = 0;
+    size_t len;
+    char *seg = bin_encode_segment(order, n_rows, &dict, &n_dict, &len);
+    subject_index_free(&dict);
+
+    BinFileHeader h;
+    memcpy(h.magic, BIN_MAGIC, sizeof(h.magic));
+    h.version = BIN_VERSION;
+    char *tmp_path;
+    int fd = csv_tmp_create(path, &tmp_path);
+    CsvWriter w;
+    csv_writer_init(&w, fd);
+    csv_writer_write(&w, (char *) &h, sizeof(h));
+    csv_writer_write(&w, seg, len);
+    csv_writer_free(&w);
+    csv_tmp_commit(fd, tmp_path, path);
+    free(seg);
+}
+
+/**
+ * Appends grades as a new segment to a binary grade book, with a
+ * single write. Subjects that are already in the file keep their
+ * dictionary id. A truncated segment left by an interrupted append
+ * is overwritten.
+ * arg(fd) the grade book, opened for reading and writing
+ */
+void bin_append(int fd, GradeRef *order, int n_rows) {
+    CsvMap m;
+    bin_map_open(&m, fd);
+    SubjectIndex dict;
+    subject_index_init(&dict);
+    int n_dict = 0;
+    size_t end = sizeof(BinFileHeader);
+    BinSegment seg;
+    CsvField name;
+    while (bin_next_segment(&m, &end, &seg)) {
+        size_t off = 0;
+        for (uint32_t i = 0; i < seg.h.n_subjects && bin_read_string(seg.dict, seg.h.dict_size, &off, &name); i++) {
+            if (subject_index_find(&dict, name.ptr, name.len) == -1) subject_index_insert(&dict, name.ptr, name.len, n_dict);
+            n_dict++;
+        }
+    }
+    size_t len;
+    char *data = bin_encode_segment(order, n_rows, &dict, &n_dict, &len);
+    subject_index_free(&dict);
+    bool truncated = end < m.size;
+    csv_map_close(&m);
+
+    for (size_t written = 0; written < len;) {
+        ssize_t n = pwrite(fd, data + written, len - written, end + written);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) cmd_exit_errno("write failed");
+        written += n;
+    }
+    if (truncated && ftruncate(fd, end + len) == -1) cmd_exit_errno("truncate failed");
+    free(data);
+}
+
+/**
+ * Records the state of the file of the book: the file behind fd of
+ * which the book holds the first size bytes, with the delete log of
+ * del_size bytes applied.
+ */
+void gradebook_file_record(GradeBook *gb, int fd, off_t size, off_t del_size) {
+    struct stat st;
+    if (fstat(fd, &st) == -1) cmd_exit_errno("fstat failed");
+    gb->ino = st.st_ino;
+    gb->size = size;
+    gb->del_size = del_size;
+}
+
+/**
+ * returns whether the file behind fd (-1 if it is missing) is still
+ * the file the book was loaded from or last saved to
+ */
+bool gradebook_file_unchanged(GradeBook *gb, char *path, int fd) {
+    if (gb->ino == 0) return true; // the book was not loaded from a file
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_ino != gb->ino || st.st_size != gb->size) return false;
+    CsvDead dead;
+    csv_dead_load(&dead, path, fd);
+    bool unchanged = dead.log_size == (size_t) gb->del_size;
+    csv_dead_free(&dead);
+    return unchanged;
+}
+
+/**
+ * Loads a grade book file into an empty grade book. Binary grade
+ * books are detected by their magic. A csv file is mapped if
+ * possible, otherwise it is read with a CsvReader. Rows in the
+ * delete log of a mapped csv and rows that fail gb->filter are
+ * skipped before anything is copied.
+ */
+void gradebook_load(GradeBook *gb, char *path) {
+    profile_phase(PHASE_OPEN);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) cmd_exit_errno("open file failed");
+    profile_phase(PHASE_PARSE);
+    CsvMap m;
+    CsvField s, g, c;
+    off_t size = 0; // the bytes of the file that have been loaded
+    off_t del_size = 0;
+    gb->binary = bin_is_book(fd);
+    if (gb->binary) {
+        bin_map_open(&m, fd);
+        bin_load(gb, &m);
+        size = m.size;
+        csv_map_close(&m);
+    } else if (csv_map_open(&m, fd)) {
+        CsvDead dead;
+        csv_dead_load(&dead, path, fd);
+        del_size = dead.log_size;
+        m.dead = &dead;
+        size_t pos = 0;
+        csv_map_next_row(&m, &pos, &s, &g, &c);
+        gb->header = arena_strndup(&gb->arena, s.ptr, c.ptr + c.len - s.ptr);
+        m.filter = gb->filter;
+        m.timed = gradebook_timed(gb);
+        while (csv_map_next_row(&m, &pos, &s, &g, &c)) {
+            if (s.len == 0) continue;
+            gradebook_add_row(gb, s, g, c);
+        }
+        size = m.size;
+        csv_map_close(&m);
+        csv_dead_free(&dead);
+    } else {
+        CsvReader r;
+        csv_reader_init(&r, fd);
+        if (csv_reader_next_row(&r, &s, &g, &c)) {
+            gb->header = arena_strndup(&gb->arena, s.ptr, c.ptr + c.len - s.ptr);
+        }
+        while (csv_reader_next_row(&r, &s, &g, &c)) {
+            if (s.len == 0) continue;
+            if (gb->filter == NULL || row_filter_match(gb->filter, s, g, c.ptr + c.len, gradebook_timed(gb), NULL)) gradebook_add_row(gb, s, g, c);
+        }
+        csv_reader_free(&r);
+        size = lseek(fd, 0, SEEK_CUR); // the reader stopped at the end it has seen
+    }
+    gb->n_persisted = gb->n_rows;
+    gradebook_file_record(gb, fd, size, del_size);
+    if (size == -1) gb->ino = 0; // not a regular file, can not be checked
+    if (close(fd) == -1) cmd_exit_errno(NULL);
+}
+
+void gradebook_write_row(CsvWriter *w, GradeRef ref) {
+    Subject *s = ref.subject;
+    csv_write_row(w, s->name, s->grade_strs[ref.i], s->comments[ref.i]);
+}
+
+/**
+ * returns a copy of s in arena, NULL stays NULL
+ */
+char *arena_strdup_or_null(Arena *arena, const char *s) {
+    return s != NULL ? arena_strndup(arena, s, strlen(s)) : NULL;
+}
+
+/**
+ * Copies the strings of the book into a new arena and frees the old
+ * one, which still holds the strings of every removed row. The
+ * subject index points to the names, so it is rebuilt as well.
+ */
+void gradebook_arena_rebuild(GradeBook *gb) {
+    Arena arena;
+    arena_init(&arena);
+    gb->header = arena_strdup_or_null(&arena, gb->header);
+    subject_index_free(&gb->index);
+    subject_index_init(&gb->index);
+    for (int i = 0; i < gb->n_subjects; i++) {
+        Subject *s = &gb->subjects[i];
+        s->name = arena_strdup_or_null(&arena, s->name);
+        subject_index_insert(&gb->index, s->name, strlen(s->name), i);
+        for (int j = 0; j < s->n_grades; j++) {
+            s->grade_strs[j] = arena_strdup_or_null(&arena, s->grade_strs[j]);
+            s->comments[j] = arena_strdup_or_null(&arena, s->comments[j]);
+        }
+    }
+    arena_free(&gb->arena);
+    gb->arena = arena;
+}
+
+/**
+ * Writes the grade book to a file. If only rows have been added
+ * since the book was loaded, the new rows are appended to the file
+ * in the format of the file. Otherwise the whole file is rewritten
+ * (in the format of the book) into a temporary file that replaces it,
+ * which fails if the file has been changed since the book was loaded
+ * (the changes would be lost).
+ */
+void gradebook_save(GradeBook *gb, char *path) {
+    profile_phase(PHASE_WRITE);
+    GradeRef *order = gradebook_order(gb);
+    CsvWriter w;
+    if (gb->rewrite) {
+        int lock_fd = csv_open_locked(path, O_RDONLY);
+        if (!gradebook_file_unchanged(gb, path, lock_fd)) {
+            if (lock_fd != -1) csv_close_locked(lock_fd);
+            free(order);
+            fprintf(cmd_out, "%s has been changed by another process, changes not saved\n", path);
+            cmd_exit(1);
+        }
+        if (gb->binary) {
+            bin_save(path, order, gb->n_rows);
+        } else {
+            char *tmp_path;
+            int fd = csv_tmp_create(path, &tmp_path);
+            csv_writer_init(&w, fd);
+            csv_writer_puts(&w, gb->header);
+            csv_writer_write(&w, "\n", 1);
+            for (int i = 0; i < gb->n_rows; i++) gradebook_write_row(&w, order[i]);
+            csv_writer_free(&w);
+            csv_tmp_commit(fd, tmp_path, path);
+        }
+        csv_dead_remove(path); // the deleted rows are not in the book
+        stats_sidecar_remove(path);
+        time_index_remove(path);
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) cmd_exit_errno("open file failed");
+        struct stat st;
+        if (fstat(fd, &st) == -1) cmd_exit_errno("fstat failed");
+        gradebook_file_record(gb, fd, st.st_size, 0);
+        close(fd);
+        if (lock_fd != -1) csv_close_locked(lock_fd);
+        gradebook_arena_rebuild(gb); // sessions and the server keep using the book
+    } else if (gb->n_persisted < gb->n_rows) {
+        // rows are appended under the lock, the csv writer emits
+        // them with a single write unless they exceed its buffer
+        int fd = csv_open_locked(path, O_RDWR);
+        if (fd == -1) cmd_exit_errno("open file failed");
+        bool unchanged = gradebook_file_unchanged(gb, path, fd);
+        if (bin_is_book(fd)) {
+            bin_append(fd, order + gb->n_persisted, gb->n_rows - gb->n_persisted);
+        } else {
+            if (lseek(fd, 0, SEEK_END) == -1) cmd_exit_errno("lseek failed");
+            csv_writer_init(&w, fd);
+            for (int i = gb->n_persisted; i < gb->n_rows; i++) gradebook_write_row(&w, order[i]);
+            csv_writer_free(&w);
+        }
+        struct stat st; // the lock is still held, the book has every row
+        if (fstat(fd, &st) == -1) cmd_exit_errno("fstat failed");
+        gradebook_file_record(gb, fd, unchanged ? st.st_size : -1, gb->del_size); // -1: rows of others are missing
+        if (csv_close_locked(fd) == -1) cmd_exit_errno(NULL);
+    }
+    gb->n_persisted = gb->n_rows;
+    gb->rewrite = false;
+    free(order);
+}
+
+/**
+ * Copies the rows of a mapped csv that have not been deleted to a
+ * temporary file, which replaces the csv, and removes the delete
+ * log. The caller holds the csv lock.
+ * arg(dead) the deleted rows of the csv
+ * returns the number of dropped rows
+ */
+int csv_compact_map(char *path, CsvMap *m, const CsvDead *dead) {
+    char *tmp_path;
+    int fd = csv_tmp_create(path, &tmp_path);
+    CsvWriter w;
+    csv_writer_init(&w, fd);
+    size_t copied = 0; // everything before has been copied or dropped
+    int dropped = 0;
+    for (size_t i = 0; i < dead->n; i++) {
+        const DelEntry *e = &dead->entries[i];
+        if (e->offset < copied || e->offset >= m->size) continue;
+        csv_writer_write(&w, m->data + copied, e->offset - copied);
+        copied = e->offset + e->len < m->size ? e->offset + e->len : m->size;
+        dropped++;
+    }
+    csv_writer_write(&w, m->data + copied, m->size - copied);
+    csv_writer_free(&w);
+    csv_tmp_commit(fd, tmp_path, path);
+    csv_dead_remove(path);
+    stats_sidecar_remove(path);
+    time_index_remove(path);
+    return dropped;
+}
+
+/**
+ * Rewrites the csv without the rows of its delete log.
+ * returns the number of dropped rows
+ */
+int csv_compact(char *path) {
+    profile_phase(PHASE_OPEN);
+    int fd = csv_open_locked(path, O_RDONLY); // held until the csv is replaced
+    if (fd == -1) cmd_exit_errno("open file failed");
+    profile_phase(PHASE_WRITE);
+    int dropped = 0;
+    CsvMap m;
+    if (csv_map_open(&m, fd)) {
+        CsvDead dead;
+        csv_dead_load(&dead, path, fd);
+        if (dead.log_size > 0) dropped = csv_compact_map(path, &m, &dead);
+        csv_dead_free(&dead);
+        csv_map_close(&m);
+    }
+    if (csv_close_locked(fd) == -1) cmd_exit_errno(NULL);
+    return dropped;
+}
+
+/**
+ * A grade to be removed from the csv: the index-th (0-based) row
+ * of subject whose grade is written as grade.
+ */
+typedef struct rm_target {
+    char *subject;
+    char *grade;
+    int index;
+    int seen;     // matching rows seen so far
+    bool removed;
+} RmTarget;
+
+/**
+ * Removes the rows matching the targets in a single scan. Indexes
+ * refer to the csv before the removal (without the rows deleted
+ * earlier). The rows are not removed from the csv but appended to
+ * its delete log, which the readers apply. Once the deleted rows
+ * make up 1/DEL_COMPACT_DIVISOR of the csv, it is compacted. A
+ * target that repeats an earlier one refers to the same row, which
+ * is removed once, so the repetition stays not removed.
+ * returns the number of removed rows
+ */
+int csv_remove_rows(char *path, RmTarget *targets, int n_targets) {
+    profile_phase(PHASE_OPEN);
+    int fd = csv_open_locked(path, O_RDONLY); // held until the log is written
+    if (fd == -1) cmd_exit_errno("open file failed");
+    profile_phase(PHASE_WRITE);
+    CsvMap m;
+    if (!csv_map_open(&m, fd)) {
+        csv_close_locked(fd);
+        return 0; // nothing to remove from an empty csv
+    }
+    CsvDead dead;
+    csv_dead_load(&dead, path, fd);
+    m.dead = &dead;
+
+    size_t pos = 0;
+    CsvField s, g;
+    DelEntry *entries = malloc(sizeof(DelEntry) * n_targets);
+    bool *repeated = calloc(n_targets, sizeof(bool));
+    int n_rows = n_targets; // distinct targets
+    for (int i = 0; i < n_targets; i++) {
+        for (int j = 0; j < i && !repeated[i]; j++) {
+            repeated[i] = targets[i].index == targets[j].index && streq(targets[i].subject, targets[j].subject)
+                && streq(targets[i].grade, targets[j].grade);
+        }
+        if (repeated[i]) n_rows--;
+    }
+    int removed = 0;
+    uint64_t bytes = dead.bytes;
+    csv_map_next_row(&m, &pos, &s, &g, NULL); // keep header
+    while (removed < n_rows && csv_map_next_row(&m, &pos, &s, &g, NULL)) {
+        bool drop = false;
+        // every target counts the row, also once an earlier target
+        // drops it, as the indexes refer to the csv before the removal
+        for (int i = 0; i < n_targets; i++) {
+            RmTarget *t = &targets[i];
+            if (repeated[i] || t->removed || !csv_field_eq(s, t->subject) || !csv_field_eq(g, t->grade)) continue;
+            if (t->seen++ == t->index) {
+                t->removed = true;
+                drop = true;
+            }
+        }
+        if (drop) {
+            DelEntry *e = &entries[removed++];
+            e->offset = s.ptr - m.data;
+            e->len = pos - e->offset;
+            e->reserved = 0;
+            bytes += e->len;
+        }
+    }
+    if (removed > 0) {
+        char log_path[PATH_MAX];
+        csv_dead_append(csv_dead_path(path, log_path), fd, entries, removed);
+        stats_sidecar_remove(path);
+        if (bytes * DEL_COMPACT_DIVISOR > m.size) {
+            csv_dead_free(&dead);
+            csv_dead_load(&dead, path, fd);
+            csv_compact_map(path, &m, &dead);
+        }
+    }
+    free(entries);
+    free(repeated);
+    csv_dead_free(&dead);
+    csv_map_close(&m);
+    if (csv_close_locked(fd) == -1) cmd_exit_errno(NULL);
+    return removed;
+}
+
+/**
+ * Removes the last row of the csv that has not been deleted by
+ * searching its start backwards from the end of the file and
+ * truncating the file there. Deleted rows behind it are dropped
+ * from the file and the delete log as well.
+ * arg(o_line) output parameter, the removed row (allocated from
+ *             cmd_arena) or NULL if the csv has no rows
+ */
+void csv_remove_last_row(char *path, char **o_line) {
+    *o_line = NULL;
+    profile_phase(PHASE_OPEN);
+    int fd = csv_open_locked(path, O_RDWR);
+    if (fd == -1) cmd_exit_errno("open file failed");
+    profile_phase(PHASE_WRITE);
+    CsvDead dead;
+    csv_dead_load(&dead, path, fd);
+    struct stat st;
+    if (fstat(fd, &st) == -1) cmd_exit_errno("fstat failed");
+    char *buf = malloc(CSV_READER_BUF_SIZE);
+    off_t end = st.st_size;   // end of the last row (excluding newlines)
+    off_t start = -1;         // start of the last row
+    bool trailing = true;     // still skipping trailing newlines
+    for (off_t block_end = st.st_size; block_end > 0 && start == -1; ) {
+        off_t block_start = block_end > CSV_READER_BUF_SIZE ? block_end - CSV_READER_BUF_SIZE : 0;
+        ssize_t n = pread(fd, buf, block_end - block_start, block_start);
+        if (n == -1) cmd_exit_errno("csv_remove_last_row read failed");
+        for (ssize_t i = n - 1; i >= 0; i--) {
+            if (trailing) {
+                if (buf[i] == '\n') {
+                    end = block_start + i;
+                    continue;
+                }
+                trailing = false;
+            }
+            if (buf[i] == '\n') {
+                start = block_start + i + 1;
+                if (!csv_dead_has(&dead, start)) break;
+                // a deleted row, continue with the row before
+                start = -1;
+                end = block_start + i;
+                trailing = true;
+            }
+        }
+        block_end = block_start;
+    }
+    free(buf);
+    if (start != -1) { // otherwise the only row is the header
+        *o_line = arena_alloc(&cmd_arena, end - start + 1);
+        if (pread(fd, *o_line, end - start, start) != end - start) cmd_exit_errno("csv_remove_last_row read failed");
+        (*o_line)[end - start] = '\0';
+        csv_dead_truncate(path, fd, start);
+        if (ftruncate(fd, start) == -1) cmd_exit_errno("truncate failed");
+        stats_sidecar_remove(path);
+        time_index_remove(path);
+    }
+    csv_dead_free(&dead);
+    if (csv_close_locked(fd) == -1) cmd_exit_errno(NULL);
+}
+
+/**
+ * traverses an array and searches for an option value.
+ * e.g. let arr=["cgrade", "--csv", "cgrade.csv", "--more-options"]
+ * then cmd_get_option(4, arr, "--csv") returns cgrade.csv
+ * everything that starts with "-" is considered an option
+ * and not a value.
+ * 
+ * arg(n) the size of the cmd array
+ * arg(cmd) the cmd array to be traversed
+ * arg(option) the option to be searched
+ *
+ * returns the value for the first option occurence or NULL if the option could not be found.
+ * if the option is directly followed by another option, then an empty string is returned,
+ * which indicates that the option was present without any value.
+ */
+char *cmd_get_option(int n, char **cmd, char *option) {
+    for (int i = 0; i < n; i++) {
+        if (strcmp(option, cmd[i]) == 0) {
+            if (i+1 < n && cmd[i+1][0] != '-') {
+                return cmd[i+1];
+            } else {
+                return "";
+            }
+        }
+    }
+    return NULL;
+}
+
+bool cmd_is_option(char *cmd) {
+    if (cmd[0] == '-') return true;
+    return false;
+}
+
+/**
+ * moves the cmd array pointer forward to the first string
+ * that is not an option. Everything that starts with
+ * an '-' is considered an option.
+ *
+ * arg(n)   size of the cmd array
+ * arg(cmd) a pointer to an array of strings
+ *
+ * returns a pointer that points to the first string of 
+ * the cmd array which isn't an option. Furthermore, the
+ * size pointer arg(n) will be set to the correct size
+ * of the new cmd array
+ */
+char **cmd_skip_options(int *n, char *cmd[]) {
+    int counter = 0;
+    int prevSkipped = 0;
+    while (*n > 0 && (cmd[0][0] == '-' || prevSkipped)) {
+        prevSkipped = !prevSkipped;
+        cmd++;
+        *n -= 1;
+    }
+    return cmd;
+}
+
+/**
+ * Checks whether grade is a valid grade for add.
+ */
+bool grade_valid(char *grade) {
+    grade_t g;
+    return grade_parse(grade, strlen(grade), &g) && g != 0;
+}
+
+/**
+ * Adds all subject;grade;comment records read from fd to the csv.
+ * Records are validated like single adds and appended through one
+ * CsvWriter, so the csv is opened once and written in large blocks.
+ * A leading csv header line is skipped.
+ *
+ * arg(fd) the file descriptor to read the records from
+ */
+void command_add_bulk(int fd) {
+    int out_fd = -1;
+    CsvWriter w;
+    GradeBook local;
+    GradeBook *gb = session_gb;
+    bool timed = gb != NULL ? gradebook_timed(gb) : csv_is_timed(opt_default_csv);
+    int64_t now = time(NULL); // the records get the time of the command
+    char stamp[24];
+    snprintf(stamp, sizeof(stamp), "%lld;", (long long) now);
+    if (gb == NULL && book_is_binary(opt_default_csv)) {
+        // binary books get the records appended as one segment
+        gradebook_init(&local, true);
+        gb = &local;
+    } else if (gb == NULL) {
+        // the lock is held until the last record has been written,
+        // so the records are not interleaved with other writes
+        out_fd = csv_open_locked(opt_default_csv, O_RDWR);
+        if (out_fd == -1) cmd_exit_errno("open file failed");
+        if (lseek(out_fd, 0, SEEK_END) == -1) cmd_exit_errno("lseek failed");
+        csv_writer_init(&w, out_fd);
+    }
+    profile_phase(PHASE_PARSE);
+    CsvReader r;
+    csv_reader_init(&r, fd);
+
+    int line = 0;
+    int added = 0;
+    int rejected = 0;
+    CsvField subject, grade, comment;
+    while (csv_reader_next_row(&r, &subject, &grade, &comment)) {
+        line++;
+        bool header = line == 1 && csv_field_eq(subject, "subject") && csv_field_eq(grade, "grade");
+        bool blank = subject.len == 0 && grade.len == 0 && comment.len == 0;
+        grade_t g;
+        if (!grade_parse(grade.ptr, grade.len, &g)) g = GRADE_INVALID;
+        if (header || blank) {
+            // nothing to add
+        } else if (subject.len == 0) {
+            fprintf(cmd_out, "line %d rejected: missing subject\n", line);
+            rejected++;
+        } else if (g == GRADE_INVALID || g == 0) {
+            fprintf(cmd_out, "line %d rejected: invalid grade '%.*s'\n", line, (int) grade.len, grade.ptr);
+            rejected++;
+        } else {
+            if (gb == NULL) {
+                csv_write_fields(&w, subject, grade, timed ? stamp : NULL, comment);
+            } else if (timed) {
+                char *c = csv_time_comment(&cmd_arena, now, comment.ptr, comment.len);
+                gradebook_add_row(gb, subject, grade, (CsvField) { c, strlen(c) });
+            } else {
+                gradebook_add_row(gb, subject, grade, comment);
+            }
+            added++;
+        }
+    }
+    csv_reader_free(&r);
+    profile_phase(PHASE_WRITE);
+    if (out_fd != -1) {
+        csv_writer_free(&w);
+        if (csv_close_locked(out_fd) == -1) cmd_exit_errno(NULL);
+    }
+    if (gb == &local) {
+        gradebook_save(&local, opt_default_csv);
+        gradebook_free(&local);
+    }
+
+    profile_phase(PHASE_OUTPUT);
+    fprintf(cmd_out, "added %d grades, rejected %d lines\n", added, rejected);
+    if (rejected > 0) cmd_exit(1);
+}
+
+/**
+ * Execute add command.
+ *
+ * arg(length)   size of args
+ * arg(args)     array with the command arguments
+ */
+void command_add(int length, char *args[]) {
+    if (length > 0 && streq(*args, OPT_NAME_HELP)) command_add_usage(0);
+    if (length > 0 && streq(*args, OPT_NAME_STDIN)) {
+        if (session_gb != NULL || serving) {
+            fprintf(cmd_out, "%s is not available in a session or on the server, use %s\n", OPT_NAME_STDIN, OPT_NAME_FROM);
+            cmd_exit(-1);
+        }
+        csv_must_exist();
+        command_add_bulk(STDIN_FILENO);
+        return;
+    }
+    if (length > 0 && streq(*args, OPT_NAME_FROM)) {
+        if (length < 2) command_add_usage(-1);
+        csv_must_exist();
+        int fd = open(args[1], O_RDONLY);
+        if (fd == -1) cmd_exit_errno("open file failed");
+        command_add_bulk(fd);
+        if (close(fd) == -1) cmd_exit_errno(NULL);
+        return;
+    }
+    if (length < 2) command_add_usage(-1);
+    csv_must_exist();
+    char *subject = args[0];
+    char *grade = args[1];
+    if (!grade_valid(grade)) {
+        fprintf(cmd_out, "invalid grade '%s'\n", grade);
+        cmd_exit(-1);
+    }
+    char *msg = "";
+    if (length > 2) msg = args[2];
+    bool timed = session_gb != NULL ? gradebook_timed(session_gb) : csv_is_timed(opt_default_csv);
+    if (timed) msg = csv_time_comment(&cmd_arena, time(NULL), msg, strlen(msg));
+
+    if (session_gb != NULL) {
+        gradebook_add(session_gb, subject, grade, msg);
+    } else {
+        GradeBook gb;
+        gradebook_init(&gb, true);
+        gradebook_add(&gb, subject, grade, msg);
+        gradebook_save(&gb, opt_default_csv);
+        gradebook_free(&gb);
+    }
+
+    profile_phase(PHASE_OUTPUT);
+    grade_t g;
+    char buf[GRADE_FORMAT_SIZE];
+    grade_parse(grade, strlen(grade), &g);
+    fprintf(cmd_out, "added grade %s to %s!\n", grade_format(g, buf), subject);
+}
+
+typedef struct stats_task StatsTask;
+
+/**
+ * A grade book aggregated as part of a multi file status.
+ */
+typedef struct stats_file {
+    char *path;
+    CsvMap map;      // the mapped csv if it is split into several tasks
+    CsvDead dead;    // the deleted rows of a split csv
+    bool split;
+    StatsTable t;    // the stats of the file, merged from its tasks
+    int error;       // errno of a failed open, -1 for an unsupported binary book
+    StatsTask *tasks; // the tasks of the file in row order
+    int n_tasks;
+    int n_merged;    // the first n_merged tasks are merged into t
+    pthread_mutex_t lock; // guards t and n_merged while the pool runs
+} StatsFile;
+
+/**
+ * A unit of work of the pool: a whole file or, for large csv files,
+ * a range of rows of a mapped file.
+ */
+struct stats_task {
+    StatsFile *file;
+    size_t start; // range of a split file, start of a row
+    size_t end;
+    size_t size;  // bytes to aggregate, used to order the tasks
+    bool hist;
+    const RowFilter *filter;
+    StatsTable t;
+    bool done;    // t is complete, set under the lock of the file
+};
+
+/**
+ * Tasks of a worker. The owner takes tasks from the tail, idle
+ * workers steal from the head.
+ */
+typedef struct stats_deque {
+    pthread_mutex_t lock;
+    StatsTask **tasks;
+    int head;
+    int tail;
+} StatsDeque;
+
+typedef struct stats_pool {
+    StatsDeque *deques;
+    int n_workers;
+} StatsPool;
+
+typedef struct stats_worker {
+    StatsPool *pool;
+    int id;
+    pthread_t thread;
+} StatsWorker;
+
+/**
+ * returns whether the sidecar of a csv is up to date
+ * arg(csv_fd) the csv file
+ * arg(st)     stat of the csv file
+ */
+bool stats_sidecar_fresh(char *csv_path, int csv_fd, struct stat *st) {
+    char path[PATH_MAX];
+    int fd = open(stats_sidecar_path(csv_path, "", path), O_RDONLY);
+    if (fd == -1) return false;
+    StatsSidecarHeader h;
+    bool fresh = read(fd, &h, sizeof(h)) == sizeof(h)
+        && memcmp(h.magic, SIDECAR_MAGIC, 4) == 0 && h.version == SIDECAR_VERSION
+        && h.dev == st->st_dev && h.ino == st->st_ino && h.size == st->st_size
+        && h.mtime_sec == st->st_mtim.tv_sec && h.mtime_nsec == st->st_mtim.tv_nsec;
+    close(fd);
+    if (!fresh) return false;
+    CsvDead dead; // a stale delete log counts as none, like in csv_stats_cached
+    csv_dead_load(&dead, csv_path, csv_fd);
+    fresh = h.del_size == dead.log_size;
+    csv_dead_free(&dead);
+    return fresh;
+}
+
+/**
+ * Aggregates a whole grade book file. Errors are recorded in the
+ * file instead of exiting, since this runs in a worker thread: the
+ * scan runs with its own cmd_exit_jmp, a failing command function
+ * ends the task with its exit code (the errno) as error.
+ */
+void stats_task_run_file(StatsTask *task) {
+    StatsFile *f = task->file;
+    int fd = open(f->path, O_RDONLY);
+    if (fd == -1) {
+        f->error = errno;
+        return;
+    }
+    jmp_buf jmp;
+    jmp_buf *outer_jmp = cmd_exit_jmp;
+    FILE *outer_out = cmd_out_file;
+    int mark = cmd_n_resources;
+    char msg[256]; // the message of a failure, the error is reported instead
+    cmd_out_file = fmemopen(msg, sizeof(msg), "w");
+    cmd_exit_jmp = &jmp;
+    if (setjmp(jmp) != 0) {
+        f->error = cmd_exit_code > 0 ? cmd_exit_code : EIO;
+        cmd_release(mark);
+    } else if (bin_is_book(fd)) {
+        CsvMap m;
+        if (csv_map_open(&m, fd)) {
+            if (bin_map_supported(&m)) bin_stats(&m, &task->t, task->filter);
+            else f->error = -1;
+            csv_map_close(&m);
+        } else {
+            f->error = -1;
+        }
+    } else if (task->hist || task->filter != NULL) {
+        CsvDead dead;
+        csv_dead_load(&dead, f->path, fd);
+        csv_stats(fd, &task->t, 0, 1, &dead, task->filter);
+        csv_dead_free(&dead);
+    } else {
+        csv_stats_cached(f->path, fd, &task->t, 1);
+    }
+    cmd_exit_jmp = outer_jmp;
+    if (cmd_out_file != NULL) fclose(cmd_out_file);
+    cmd_out_file = outer_out;
+    close(fd);
+}
+
+void stats_task_run(StatsTask *task) {
+    if (!task->file->split) {
+        stats_task_run_file(task);
+        return;
+    }
+    CsvMap range = { task->file->map.data, task->end, &task->file->dead, task->filter, task->file->map.timed };
+    csv_map_stats(&range, task->start, &task->t);
+}
+
+/**
+ * returns the next task of a worker, stolen from another worker if
+ * its own deque is empty, or NULL if no task is left
+ */
+StatsTask *stats_pool_next(StatsPool *pool, int id) {
+    for (int i = 0; i < pool->n_workers; i++) {
+        StatsDeque *d = &pool->deques[(id + i) % pool->n_workers];
+        StatsTask *task = NULL;
+        pthread_mutex_lock(&d->lock);
+        if (d->head < d->tail) task = i == 0 ? d->tasks[--d->tail] : d->tasks[d->head++];
+        pthread_mutex_unlock(&d->lock);
+        if (task != NULL) return task;
+    }
+    return NULL;
+}
+
+/**
+ * Marks a task done and merges the done tasks that follow the merged
+ * ones into the table of their file. Subjects keep the order of a
+ * serial scan, and the table of a task is freed as soon as the tasks
+ * before it are done instead of after the whole pool.
+ */
+void stats_task_finish(StatsTask *task) {
+    StatsFile *f = task->file;
+    pthread_mutex_lock(&f->lock);
+    task->done = true;
+    while (f->n_merged < f->n_tasks && f->tasks[f->n_merged].done) {
+        StatsTask *done = &f->tasks[f->n_merged++];
+        stats_table_merge(&f->t, &done->t);
+        stats_table_free(&done->t);
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+void *stats_worker_run(void *arg) {
+    StatsWorker *w = arg;
+    StatsTask *task;
+    while ((task = stats_pool_next(w->pool, w->id)) != NULL) {
+        stats_task_run(task);
+        stats_task_finish(task);
+    }
+    return NULL;
+}
+
+/**
+ * Orders tasks by ascending size, tasks of the same size by
+ * descending position, so owners that take from the tail run the
+ * ranges of a file in row order.
+ */
+int stats_task_cmp(const void *a, const void *b) {
+    StatsTask *x = *(StatsTask **) a;
+    StatsTask *y = *(StatsTask **) b;
+    if (x->size != y->size) return (x->size > y->size) - (x->size < y->size);
+    return (x < y) - (x > y);
+}
+
+/**
+ * Runs the tasks on n_workers threads (the calling one included)
+ * with work stealing. The tasks are dealt round robin in ascending
+ * size, so every worker starts with its largest tasks and steals
+ * the small ones of the others when it runs out. Every finished
+ * task is merged into its file with stats_task_finish.
+ */
+void stats_pool_run(StatsTask *tasks, int n_tasks, int n_workers) {
+    StatsTask **sorted = malloc(sizeof(StatsTask *) * n_tasks);
+    for (int i = 0; i < n_tasks; i++) sorted[i] = &tasks[i];
+    qsort(sorted, n_tasks, sizeof(StatsTask *), stats_task_cmp);
+    StatsPool pool = { malloc(sizeof(StatsDeque) * n_workers), n_workers };
+    for (int i = 0; i < n_workers; i++) {
+        StatsDeque *d = &pool.deques[i];
+        pthread_mutex_init(&d->lock, NULL);
+        d->tasks = malloc(sizeof(StatsTask *) * (n_tasks / n_workers + 1));
+        d->head = 0;
+        d->tail = 0;
+    }
+    for (int i = 0; i < n_tasks; i++) {
+        StatsDeque *d = &pool.deques[i % n_workers];
+        d->tasks[d->tail++] = sorted[i];
+    }
+    StatsWorker *workers = malloc(sizeof(StatsWorker) * n_workers);
+    for (int i = 0; i < n_workers; i++) {
+        workers[i].pool = &pool;
+        workers[i].id = i;
+        workers[i].thread = pthread_self();
+    }
+    for (int i = 1; i < n_workers; i++) {
+        if (pthread_create(&workers[i].thread, NULL, stats_worker_run, &workers[i]) != 0) {
+            workers[i].thread = pthread_self(); // the others steal its tasks
+        }
+    }
+    stats_worker_run(&workers[0]);
+    for (int i = 1; i < n_workers; i++) {
+        if (!pthread_equal(workers[i].thread, pthread_self())) pthread_join(workers[i].thread, NULL);
+    }
+    for (int i = 0; i < n_workers; i++) {
+        pthread_mutex_destroy(&pool.deques[i].lock);
+        free(pool.deques[i].tasks);
+    }
+    free(pool.deques);
+    free(workers);
+    free(sorted);
+}
+
+/**
+ * Aggregates the grades of a grade book file that pass filter (may
+ * be NULL for all) into t. Tables with histograms and filtered scans
+ * bypass the sidecar, which only holds count, sum, min and max of
+ * every row. Time predicates are narrowed down with the time index.
+ */
+void stats_collect_file(char *path, StatsTable *t, int n_threads, const RowFilter *filter) {
+    profile_phase(PHASE_OPEN);
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) cmd_exit_errno("open file failed");
+    profile_phase(PHASE_AGGREGATE);
+    if (bin_is_book(fd)) {
+        CsvMap m;
+        bin_map_open(&m, fd);
+        bin_stats(&m, t, filter);
+        csv_map_close(&m);
+    } else if (t->hist || filter != NULL) {
+        CsvDead dead;
+        csv_dead_load(&dead, path, fd);
+        if (filter != NULL && filter->has_time) csv_stats_timed(path, fd, t, n_threads, &dead, filter);
+        else csv_stats(fd, t, 0, n_threads, &dead, filter);
+        csv_dead_free(&dead);
+    } else {
+        csv_stats_cached(path, fd, t, n_threads);
+    }
+    if (close(fd) == -1) cmd_exit_errno(NULL);
+}
+
+/**
+ * Aggregates the grades of the session or of the grade book file
+ * that pass filter (may be NULL for all) into t.
+ */
+void status_collect(StatsTable *t, int n_threads, const RowFilter *filter) {
+    if (session_gb != NULL) {
+        profile_phase(PHASE_AGGREGATE);
+        gradebook_stats(session_gb, t, filter);
+        return;
+    }
+    stats_collect_file(opt_default_csv, t, n_threads, filter);
+}
+
+/**
+ * Prints count, average, min and max of a subject as text row or
+ * as row of tab (if tab is not NULL). A NULL name is written as
+ * missing value.
+ */
+void status_all_row(OutBuf *o, OutTable *tab, char *name, SubjectStats *st) {
+    if (tab != NULL) {
+        if (name != NULL) out_table_str(tab, name);
+        else out_table_null(tab);
+        out_table_int(tab, st->count);
+        out_table_num(tab, grade_avg(st->sum, st->count));
+        out_table_grade(tab, st->min);
+        out_table_grade(tab, st->max);
+        out_table_end_row(tab);
+        return;
+    }
+    char min[GRADE_FORMAT_SIZE];
+    char max[GRADE_FORMAT_SIZE];
+    out_printf(o, "%-16s %6lld %6.2f %6s %6s\n", name, (long long) st->count,
+               grade_avg(st->sum, st->count), grade_format(st->min, min), grade_format(st->max, max));
+}
+
+/**
+ * Prints count, average, min and max of every subject (or of one
+ * subject) followed by the overall average. Machine readable
+ * formats get one row per subject.
+ */
+/**
+ * returns the number of rows of every subject (or of one subject)
+ * whose grade could not be read
+ */
+int64_t stats_table_invalid(StatsTable *t, char *subject) {
+    int64_t n = 0;
+    for (int i = 0; i < t->n; i++) {
+        if (subject == NULL || streq(t->stats[i].name, subject)) n += t->stats[i].n_invalid;
+    }
+    return n;
+}
+
+/**
+ * Reports rows that were left out of the results because their
+ * grade could not be read. Machine readable formats get the note
+ * on stderr, so their output stays a table.
+ */
+void status_report_invalid(OutBuf *o, OutFormat format, int64_t n) {
+    if (n == 0) return;
+    if (format == OUT_TEXT) out_printf(o, "Skipped %lld rows with malformed grades\n", (long long) n);
+    else fprintf(stderr, "skipped %lld rows with malformed grades\n", (long long) n);
+}
+
+void status_print_all(OutBuf *o, StatsTable *t, char *subject, OutFormat format) {
+    OutTable tab;
+    OutTable *rows = NULL; // NULL for text
+    const char *cols[] = { "subject", "count", "avg", "min", "max" };
+    if (format == OUT_TEXT) {
+        out_puts(o, "Stats\n");
+        out_printf(o, "%-16s %6s %6s %6s %6s\n", "Subject", "Count", "Avg", "Min", "Max");
+    } else {
+        out_table_begin(&tab, o, format, cols, 5);
+        rows = &tab;
+    }
+    int64_t count = 0;
+    int64_t sum = 0;
+    for (int i = 0; i < t->n; i++) {
+        SubjectStats *st = &t->stats[i];
+        if (st->count == 0 || (subject != NULL && !streq(st->name, subject))) continue;
+        status_all_row(o, rows, st->name, st);
+        count += st->count;
+        sum += st->sum;
+    }
+    if (format != OUT_TEXT) out_table_end(&tab);
+    else if (count == 0) out_puts(o, "No grades\n");
+    else out_printf(o, "Avg: %.2f\n", grade_avg(sum, count));
+    status_report_invalid(o, format, stats_table_invalid(t, subject));
+}
+
+/**
+ * Prints count, average, min and max of every subject (or of one
+ * subject) followed by the overall average, computed in one pass
+ * over the csv.
+ */
+void command_status_all(char *subject, int n_threads, OutFormat format, const RowFilter *filter) {
+    StatsTable t;
+    stats_table_init(&t);
+    status_collect(&t, n_threads, filter);
+
+    profile_phase(PHASE_OUTPUT);
+    OutBuf o;
+    out_init(&o);
+    status_print_all(&o, &t, subject, format);
+    out_free(&o);
+    stats_table_free(&t);
+}
+
+/**
+ * Prints the stats of a subject as text row or as row of tab
+ * (if tab is not NULL). A NULL name is written as missing value.
+ */
+void status_stats_row(OutBuf *o, OutTable *tab, char *name, SubjectStats *st) {
+    double mean = (double) st->sum / st->count;
+    double median = grade_hist_median(st->hist, st->count) / GRADE_SCALE;
+    grade_t p10 = grade_hist_percentile(st->hist, st->count, 10);
+    grade_t p90 = grade_hist_percentile(st->hist, st->count, 90);
+    double stddev = grade_hist_stddev(st->hist, st->count, mean) / GRADE_SCALE;
+    if (tab != NULL) {
+        if (name != NULL) out_table_str(tab, name);
+        else out_table_null(tab);
+        out_table_int(tab, st->count);
+        out_table_num(tab, mean / GRADE_SCALE);
+        out_table_grade(tab, st->min);
+        out_table_grade(tab, st->max);
+        out_table_num(tab, median);
+        out_table_grade(tab, p10);
+        out_table_grade(tab, p90);
+        out_table_num(tab, stddev);
+        out_table_end_row(tab);
+        return;
+    }
+    char min[GRADE_FORMAT_SIZE];
+    char max[GRADE_FORMAT_SIZE];
+    char p10_str[GRADE_FORMAT_SIZE];
+    char p90_str[GRADE_FORMAT_SIZE];
+    out_printf(o, "%-16s %6lld %6.2f %6s %6s %6.2f %6s %6s %6.2f\n", name, (long long) st->count,
+               mean / GRADE_SCALE, grade_format(st->min, min), grade_format(st->max, max), median,
+               grade_format(p10, p10_str), grade_format(p90, p90_str), stddev);
+}
+
+/**
+ * Prints a histogram with one bar per whole grade, grades above
+ * the histogram domain share the last bar.
+ */
+void status_stats_histogram(OutBuf *o, SubjectStats *st) {
+    int lo = st->min / GRADE_SCALE;
+    int hi = (st->max < HIST_MAX_GRADE ? st->max : HIST_MAX_GRADE) / GRADE_SCALE;
+    if (lo > hi) lo = hi;
+    int64_t *buckets = calloc(hi - lo + 1, sizeof(int64_t));
+    int64_t max = 0;
+    for (int g = lo * GRADE_SCALE; g <= HIST_MAX_GRADE; g++) {
+        int b = g / GRADE_SCALE - lo;
+        if (b > hi - lo) break;
+        buckets[b] += st->hist->counts[g];
+    }
+    buckets[hi - lo] += st->hist->n_overflow;
+    for (int b = 0; b <= hi - lo; b++) if (buckets[b] > max) max = buckets[b];
+    char bar[HIST_BAR_WIDTH];
+    memset(bar, '#', sizeof(bar));
+    out_puts(o, "Histogram\n");
+    for (int b = 0; b <= hi - lo; b++) {
+        int width = (int) (buckets[b] * HIST_BAR_WIDTH / max);
+        out_printf(o, "%3d%s ", lo + b, b == hi - lo && st->hist->n_overflow > 0 ? "+" : " ");
+        out_write(o, bar, width);
+        out_printf(o, "%s%lld\n", width > 0 ? " " : "", (long long) buckets[b]);
+    }
+    free(buckets);
+}
+
+/**
+ * Merges the stats of every subject (or of one subject) of t into
+ * total, which gets a histogram if the table has histograms.
+ * returns the number of merged subjects
+ */
+int status_total(StatsTable *t, char *subject, SubjectStats *total) {
+    SubjectStats empty = { NULL, 0, 0, 0, 0, 0, t->hist ? grade_hist_create() : NULL };
+    *total = empty;
+    int n = 0;
+    for (int i = 0; i < t->n; i++) {
+        SubjectStats *st = &t->stats[i];
+        if (st->count == 0 || (subject != NULL && !streq(st->name, subject))) continue;
+        if (total->count == 0 || st->min < total->min) total->min = st->min;
+        if (total->count == 0 || st->max > total->max) total->max = st->max;
+        total->count += st->count;
+        total->sum += st->sum;
+        if (total->hist != NULL) grade_hist_merge(total->hist, st->hist);
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Prints count, average, min, max, median, 10th and 90th percentile
+ * and standard deviation of every subject (or of one subject) and a
+ * histogram. Machine readable formats get one row per subject, no
+ * total and no histogram.
+ */
+void status_print_stats(OutBuf *o, StatsTable *t, char *subject, OutFormat format) {
+    const char *cols[] = { "subject", "count", "avg", "min", "max", "median", "p10", "p90", "stddev" };
+    if (format != OUT_TEXT) {
+        OutTable tab;
+        out_table_begin(&tab, o, format, cols, 9);
+        for (int i = 0; i < t->n; i++) {
+            SubjectStats *st = &t->stats[i];
+            if (st->count == 0 || (subject != NULL && !streq(st->name, subject))) continue;
+            status_stats_row(o, &tab, st->name, st);
+        }
+        out_table_end(&tab);
+        status_report_invalid(o, format, stats_table_invalid(t, subject));
+        return;
+    }
+    if (subject != NULL) out_printf(o, "Stats for %s\n", subject);
+    else out_puts(o, "Stats\n");
+    out_printf(o, "%-16s %6s %6s %6s %6s %6s %6s %6s %6s\n",
+               "Subject", "Count", "Avg", "Min", "Max", "Median", "P10", "P90", "Stddev");
+    for (int i = 0; i < t->n; i++) {
+        SubjectStats *st = &t->stats[i];
+        if (st->count == 0 || (subject != NULL && !streq(st->name, subject))) continue;
+        status_stats_row(o, NULL, st->name, st);
+    }
+    SubjectStats total;
+    int n_rows = status_total(t, subject, &total);
+    if (total.count == 0) {
+        out_puts(o, "No grades\n");
+    } else {
+        if (n_rows > 1) status_stats_row(o, NULL, "Total", &total);
+        status_stats_histogram(o, &total);
+    }
+    grade_hist_free(total.hist);
+    status_report_invalid(o, format, stats_table_invalid(t, subject));
+}
+
+/**
+ * Prints the stats of every subject (or of one subject) including
+ * the order statistics. These come from per subject counting
+ * histograms filled in the same pass that computes the average.
+ */
+void command_status_stats(char *subject, int n_threads, OutFormat format, const RowFilter *filter) {
+    StatsTable t;
+    stats_table_init(&t);
+    t.hist = true;
+    status_collect(&t, n_threads, filter);
+
+    profile_phase(PHASE_OUTPUT);
+    OutBuf o;
+    out_init(&o);
+    status_print_stats(&o, &t, subject, format);
+    out_free(&o);
+    stats_table_free(&t);
+}
+
+/**
+ * returns whether status has to aggregate several grade books, i.e.
+ * several --csv were given or a directory or a pattern
+ */
+bool csv_multi_input() {
+    if (n_opt_csvs > 1) return true;
+    if (n_opt_csvs == 0) return false;
+    struct stat st;
+    return strpbrk(opt_csvs[0], CSV_GLOB_CHARS) != NULL
+        || (stat(opt_csvs[0], &st) == 0 && S_ISDIR(st.st_mode));
+}
+
+/**
+ * Expands the --csv arguments into grade book paths. A directory
+ * stands for its *.csv files, a path with * ? or [ is a pattern.
+ * Exits if an argument matches nothing.
+ * arg(o_n) output parameter, the number of paths
+ * returns the paths, allocated from cmd_arena
+ */
+char **csv_multi_paths(int *o_n) {
+    int cap = n_opt_csvs;
+    char **paths = malloc(sizeof(char *) * cap);
+    *o_n = 0;
+    for (int i = 0; i < n_opt_csvs; i++) {
+        char *arg = opt_csvs[i];
+        char pattern[PATH_MAX];
+        struct stat st;
+        if (strpbrk(arg, CSV_GLOB_CHARS) != NULL) {
+            snprintf(pattern, sizeof(pattern), "%s", arg);
+        } else if (stat(arg, &st) == 0 && S_ISDIR(st.st_mode)) {
+            snprintf(pattern, sizeof(pattern), "%s/*%s", arg, CSV_EXTENSION);
+        } else {
+            if (*o_n == cap) paths = realloc(paths, sizeof(char *) * (cap *= 2));
+            paths[(*o_n)++] = arg;
+            continue;
+        }
+        glob_t g;
+        if (glob(pattern, 0, NULL, &g) != 0) {
+            free(paths);
+            fprintf(cmd_out, "no grade books found for %s\n", arg);
+            cmd_exit(1);
+        }
+        for (size_t j = 0; j < g.gl_pathc; j++) {
+            if (stat(g.gl_pathv[j], &st) == -1 || !S_ISREG(st.st_mode)) continue;
+            if (*o_n == cap) paths = realloc(paths, sizeof(char *) * (cap *= 2));
+            paths[(*o_n)++] = arena_strndup(&cmd_arena, g.gl_pathv[j], strlen(g.gl_pathv[j]));
+        }
+        globfree(&g);
+    }
+    char **out = arena_alloc(&cmd_arena, sizeof(char *) * (*o_n + 1));
+    memcpy(out, paths, sizeof(char *) * *o_n);
+    free(paths);
+    return out;
+}
+
+/**
+ * Adds the tasks of a grade book to tasks. Large csv files are
+ * mapped and split into ranges of rows (unless their sidecar is up
+ * to date and neither histograms nor a filter are needed), other
+ * files are one task.
+ * returns the new number of tasks
+ */
+int stats_file_plan(StatsFile *f, bool hist, const RowFilter *filter, StatsTask **tasks, int n_tasks, int *cap_tasks) {
+    struct stat st;
+    if (stat(f->path, &st) == -1) memset(&st, 0, sizeof(st)); // the task records the error
+    f->split = false;
+    if (S_ISREG(st.st_mode) && st.st_size >= STATS_SPLIT_SIZE) {
+        int fd = open(f->path, O_RDONLY);
+        if (fd != -1 && (hist || filter != NULL || !stats_sidecar_fresh(f->path, fd, &st))) {
+            f->split = !bin_is_book(fd) && csv_map_open(&f->map, fd);
+            if (f->split) {
+                csv_dead_load(&f->dead, f->path, fd);
+                f->map.dead = &f->dead;
+            }
+        }
+        if (fd != -1) close(fd);
+    }
+    size_t pos = 0;
+    size_t end = f->split ? f->map.size : 0;
+    if (f->split) {
+        CsvField s, g;
+        csv_map_next_row(&f->map, &pos, &s, &g, NULL); // skip header
+    }
+    do {
+        if (n_tasks == *cap_tasks) {
+            *cap_tasks = *cap_tasks ? *cap_tasks * 2 : 16;
+            *tasks = realloc(*tasks, sizeof(StatsTask) * *cap_tasks);
+        }
+        StatsTask *task = &(*tasks)[n_tasks++];
+        task->file = f;
+        task->hist = hist;
+        task->filter = filter;
+        task->start = pos;
+        task->end = pos + STATS_TASK_SIZE < end ? pos + STATS_TASK_SIZE : end;
+        // snap the end behind the next newline
+        if (task->end < end && f->map.data[task->end - 1] != '\n') {
+            char *nl = memchr(f->map.data + task->end, '\n', end - task->end);
+            task->end = nl != NULL ? (size_t) (nl - f->map.data) + 1 : end;
+        }
+        // full ranges count as STATS_TASK_SIZE, whatever the newline snapping
+        // added, so they tie and the pool runs them in row order
+        task->size = !f->split ? (size_t) st.st_size
+            : task->end - task->start < STATS_TASK_SIZE ? task->end - task->start : STATS_TASK_SIZE;
+        task->done = false;
+        stats_table_init(&task->t);
+        task->t.hist = hist;
+        pos = task->end;
+    } while (pos < end);
+    return n_tasks;
+}
+
+/**
+ * Prints the stats of several grade books: one row per file and the
+ * combined stats of every subject (or of one subject). Files are
+ * aggregated by a pool of n_threads workers with work stealing.
+ * Machine readable formats get a single table with a file and a
+ * subject column, per file rows have no subject and combined rows
+ * no file.
+ */
+void command_status_files(char *subject, bool hist, int n_threads, OutFormat format, const RowFilter *filter) {
+    profile_phase(PHASE_OPEN);
+    int n_files;
+    char **paths = csv_multi_paths(&n_files);
+    StatsFile *files = malloc(sizeof(StatsFile) * n_files);
+    StatsTask *tasks = NULL;
+    int n_tasks = 0;
+    int cap_tasks = 0;
+    int *first_task = malloc(sizeof(int) * n_files);
+    for (int i = 0; i < n_files; i++) {
+        files[i].path = paths[i];
+        files[i].error = 0;
+        stats_table_init(&files[i].t);
+        files[i].t.hist = hist;
+        first_task[i] = n_tasks;
+        n_tasks = stats_file_plan(&files[i], hist, filter, &tasks, n_tasks, &cap_tasks);
+        files[i].n_tasks = n_tasks - first_task[i];
+        files[i].n_merged = 0;
+        pthread_mutex_init(&files[i].lock, NULL);
+    }
+    for (int i = 0; i < n_files; i++) files[i].tasks = tasks + first_task[i]; // tasks is final now
+    free(first_task);
+
+    profile_phase(PHASE_AGGREGATE);
+    if (n_threads == 0) n_threads = cpu_count();
+    if (n_threads > n_tasks) n_threads = n_tasks;
+    if (n_threads > 0) stats_pool_run(tasks, n_tasks, n_threads);
+    free(tasks);
+    StatsTable all;
+    stats_table_init(&all);
+    all.hist = hist;
+    for (int i = 0; i < n_files; i++) {
+        if (files[i].split) {
+            csv_map_close(&files[i].map);
+            csv_dead_free(&files[i].dead);
+        }
+        pthread_mutex_destroy(&files[i].lock);
+        stats_table_merge(&all, &files[i].t);
+    }
+
+    profile_phase(PHASE_OUTPUT);
+    OutBuf o;
+    out_init(&o);
+    int failed = 0;
+    for (int i = 0; i < n_files; i++) {
+        if (files[i].error == 0) continue;
+        out_printf(&o, "%s: %s\n", files[i].path, files[i].error == -1 ? "unsupported binary grade book" : strerror(files[i].error));
+        failed++;
+    }
+    if (format == OUT_TEXT) {
+        out_puts(&o, "Files\n");
+        out_printf(&o, "%-32s %6s %6s %6s %6s\n", "File", "Count", "Avg", "Min", "Max");
+    }
+    OutTable tab;
+    const char *cols[] = { "file", "subject", "count", "avg", "min", "max", "median", "p10", "p90", "stddev" };
+    if (format != OUT_TEXT) out_table_begin(&tab, &o, format, cols, hist ? 10 : 6);
+    char min[GRADE_FORMAT_SIZE];
+    char max[GRADE_FORMAT_SIZE];
+    for (int i = 0; i < n_files; i++) {
+        SubjectStats total;
+        status_total(&files[i].t, subject, &total);
+        if (total.count > 0 && format == OUT_TEXT) {
+            out_printf(&o, "%-32s %6lld %6.2f %6s %6s\n", files[i].path, (long long) total.count,
+                       grade_avg(total.sum, total.count), grade_format(total.min, min), grade_format(total.max, max));
+        } else if (total.count > 0) {
+            out_table_str(&tab, files[i].path);
+            if (hist) status_stats_row(&o, &tab, NULL, &total);
+            else status_all_row(&o, &tab, NULL, &total);
+        }
+        grade_hist_free(total.hist);
+    }
+    if (format == OUT_TEXT && hist) {
+        status_print_stats(&o, &all, subject, format);
+    } else if (format == OUT_TEXT) {
+        status_print_all(&o, &all, subject, format);
+    } else {
+        for (int i = 0; i < all.n; i++) {
+            SubjectStats *st = &all.stats[i];
+            if (st->count == 0 || (subject != NULL && !streq(st->name, subject))) continue;
+            out_table_null(&tab);
+            if (hist) status_stats_row(&o, &tab, st->name, st);
+            else status_all_row(&o, &tab, st->name, st);
+        }
+        out_table_end(&tab);
+        status_report_invalid(&o, format, stats_table_invalid(&all, subject));
+    }
+    out_free(&o);
+    for (int i = 0; i < n_files; i++) stats_table_free(&files[i].t);
+    free(files);
+    stats_table_free(&all);
+    if (failed > 0) cmd_exit(1);
+}
+
+/**
+ * Aggregates of a grade book that are kept up to date while the
+ * file changes. Rows appended to a csv are aggregated on their own,
+ * the file is only scanned again if it shrinks, is replaced (as by
+ * rm, which renames a rewritten copy over it) or the bytes before
+ * the aggregated offset change or rows are deleted (the delete log
+ * changes). Binary books are scanned again on every change.
+ */
+typedef struct stats_watch {
+    char *path;
+    int fd;
+    struct stat st; // identity of the file behind fd
+    bool binary;
+    size_t offset;  // csv bytes aggregated so far, always behind a newline
+    char tail[SIDECAR_TAIL_SIZE]; // last bytes before offset
+    size_t tail_len;
+    CsvDead dead;
+    uint64_t del_size; // size of the delete log when dead was loaded
+    const RowFilter *filter;
+    int n_threads;
+    StatsTable t;
+} StatsWatch;
+
+/**
+ * Aggregates the complete rows of [offset, end of file) of the watched
+ * csv. A row that is still being written (no newline yet) is left for
+ * the next update.
+ */
+void stats_watch_scan_csv(StatsWatch *w) {
+    CsvMap m;
+    if (!csv_map_open(&m, w->fd)) return; // empty or not mappable
+    size_t end = m.size;
+    while (end > w->offset && m.data[end - 1] != '\n') end--;
+    CsvMap rows = { m.data, end, &w->dead, NULL, m.timed };
+    size_t pos = w->offset;
+    CsvField s, g;
+    if (pos == 0 && end > 0) csv_map_next_row(&rows, &pos, &s, &g, NULL); // skip header
+    rows.filter = w->filter;
+    size_t max_threads = (end - pos) / STATS_MIN_CHUNK + 1;
+    int n_threads = w->n_threads < max_threads ? w->n_threads : max_threads;
+    if (n_threads > 1) csv_map_stats_parallel(&rows, pos, &w->t, n_threads);
+    else csv_map_stats(&rows, pos, &w->t);
+    w->offset = end;
+    w->tail_len = end < SIDECAR_TAIL_SIZE ? end : SIDECAR_TAIL_SIZE;
+    memcpy(w->tail, m.data + end - w->tail_len, w->tail_len);
+    csv_map_close(&m);
+}
+
+/**
+ * returns the size of the delete log of the watched file, 0 if there is none
+ */
+uint64_t stats_watch_del_size(StatsWatch *w) {
+    char path[PATH_MAX];
+    struct stat st;
+    return stat(csv_dead_path(w->path, path), &st) == 0 ? st.st_size : 0;
+}
+
+/**
+ * (Re)opens the watched file and aggregates it from the start.
+ * returns false if the file does not exist
+ */
+bool stats_watch_rescan(StatsWatch *w) {
+    bool hist = w->t.hist;
+    stats_table_free(&w->t);
+    stats_table_init(&w->t);
+    w->t.hist = hist;
+    w->offset = 0;
+    w->tail_len = 0;
+    csv_dead_free(&w->dead);
+    if (w->fd != -1) close(w->fd);
+    w->fd = open(w->path, O_RDONLY);
+    if (w->fd == -1) return false;
+    if (fstat(w->fd, &w->st) == -1) cmd_exit_errno("fstat failed");
+    w->binary = bin_is_book(w->fd);
+    w->del_size = stats_watch_del_size(w);
+    if (!w->binary) csv_dead_load(&w->dead, w->path, w->fd);
+    if (w->binary) {
+        CsvMap m;
+        if (csv_map_open(&m, w->fd)) {
+            if (bin_map_supported(&m)) bin_stats(&m, &w->t, w->filter);
+            csv_map_close(&m);
+        }
+    } else {
+        stats_watch_scan_csv(w);
+    }
+    return true;
+}
+
+/**
+ * Starts to watch a grade book.
+ * arg(hist)      whether histograms are kept (for --stats)
+ * arg(filter)    rows that are aggregated, may be NULL for all
+ * arg(n_threads) maximum number of threads of a full scan
+ */
+void stats_watch_init(StatsWatch *w, char *path, bool hist, const RowFilter *filter, int n_threads) {
+    w->path = path;
+    w->fd = -1;
+    w->filter = filter;
+    memset(&w->dead, 0, sizeof(w->dead));
+    w->n_threads = n_threads == 0 ? cpu_count() : n_threads;
+    stats_table_init(&w->t);
+    w->t.hist = hist;
+    stats_watch_rescan(w);
+}
+
+/**
+ * Brings the aggregates up to date with the file.
+ * returns whether the aggregates have been updated
+ */
+bool stats_watch_update(StatsWatch *w) {
+    struct stat st;
+    if (stat(w->path, &st) == -1) return false; // gone, wait for its replacement
+    if (w->fd == -1 || st.st_dev != w->st.st_dev || st.st_ino != w->st.st_ino
+            || stats_watch_del_size(w) != w->del_size) {
+        return stats_watch_rescan(w);
+    }
+    if (w->binary) {
+        if (st.st_size == w->st.st_size && st.st_mtim.tv_sec == w->st.st_mtim.tv_sec
+                && st.st_mtim.tv_nsec == w->st.st_mtim.tv_nsec) return false;
+        return stats_watch_rescan(w);
+    }
+    char tail[SIDECAR_TAIL_SIZE];
+    if (st.st_size < w->offset || pread(w->fd, tail, w->tail_len, w->offset - w->tail_len) != w->tail_len
+            || memcmp(tail, w->tail, w->tail_len) != 0) {
+        return stats_watch_rescan(w);
+    }
+    w->st = st;
+    if (st.st_size == w->offset) return false;
+    size_t offset = w->offset;
+    stats_watch_scan_csv(w);
+    return w->offset != offset;
+}
+
+void stats_watch_free(StatsWatch *w) {
+    if (w->fd != -1) close(w->fd);
+    w->fd = -1;
+    csv_dead_free(&w->dead);
+    stats_table_free(&w->t);
+}
+
+void status_watch_print(StatsWatch *w, char *subject, OutFormat format) {
+    OutBuf o;
+    out_init(&o);
+    if (w->t.hist) status_print_stats(&o, &w->t, subject, format);
+    else status_print_all(&o, &w->t, subject, format);
+    out_free(&o);
+    fflush(cmd_out);
+}
+
+/**
+ * Prints the stats of the grade book and prints them again whenever
+ * the file changes, until the process is interrupted. Changes are
+ * waited for with inotify on the directory of the file, which also
+ * reports the file being replaced by a rename.
+ */
+void command_status_watch(char *subject, bool hist, int n_threads, OutFormat format, const RowFilter *filter) {
+    if (session_gb != NULL || serving) {
+        fprintf(cmd_out, "%s is not available in a session or on the server\n", OPT_NAME_WATCH);
+        cmd_exit(1);
+    }
+    char dir[PATH_MAX];
+    char *name = strrchr(opt_default_csv, '/');
+    if (name != NULL) snprintf(dir, sizeof(dir), "%.*s", (int) (name - opt_default_csv) + 1, opt_default_csv);
+    else snprintf(dir, sizeof(dir), ".");
+    name = name != NULL ? name + 1 : opt_default_csv;
+    char del_name[PATH_MAX];
+    snprintf(del_name, sizeof(del_name), "%s%s", name, DEL_SUFFIX);
+
+    int in = inotify_init1(IN_CLOEXEC);
+    if (in == -1) cmd_exit_errno("inotify_init failed");
+    if (inotify_add_watch(in, dir, IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_ATTRIB) == -1) {
+        cmd_exit_errno("inotify_add_watch failed");
+    }
+    StatsWatch w;
+    stats_watch_init(&w, opt_default_csv, hist, filter, n_threads);
+    status_watch_print(&w, subject, format);
+
+    char buf[WATCH_EVENT_BUF_SIZE] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (true) {
+        ssize_t n = read(in, buf, sizeof(buf));
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1) cmd_exit_errno("inotify read failed");
+        bool changed = false;
+        for (char *p = buf; p < buf + n; p += sizeof(struct inotify_event) + ((struct inotify_event *) p)->len) {
+            struct inotify_event *ev = (struct inotify_event *) p;
+            if (ev->len > 0 && (streq(ev->name, name) || streq(ev->name, del_name))) changed = true;
+        }
+        if (changed && stats_watch_update(&w)) status_watch_print(&w, subject, format);
+    }
+}
+
+/**
+ * Prints count and average of a subject (or of all grades) from
+ * the aggregated stats, without loading the grades.
+ */
+void command_status_summary(char *subject, OutFormat format, const RowFilter *filter) {
+    StatsTable t;
+    stats_table_init(&t);
+    status_collect(&t, 0, filter);
+
+    profile_phase(PHASE_OUTPUT);
+    int64_t count = 0;
+    int64_t sum = 0;
+    for (int i = 0; i < t.n; i++) {
+        SubjectStats *st = &t.stats[i];
+        if (subject != NULL && !streq(st->name, subject)) continue;
+        count += st->count;
+        sum += st->sum;
+    }
+    OutBuf o;
+    out_init(&o);
+    if (format == OUT_TEXT) {
+        if (subject != NULL) out_printf(&o, "Stats for %s\n", subject);
+        else out_puts(&o, "Stats\n");
+        if (count == 0) out_puts(&o, "No grades\n");
+        else out_printf(&o, "Count: %lld\nAvg: %.2f\n", (long long) count, grade_avg(sum, count));
+    } else {
+        OutTable tab;
+        const char *cols[] = { "subject", "count", "avg" };
+        out_table_begin(&tab, &o, format, subject != NULL ? cols : cols + 1, subject != NULL ? 3 : 2);
+        if (subject != NULL) out_table_str(&tab, subject);
+        out_table_int(&tab, count);
+        if (count == 0) out_table_null(&tab);
+        else out_table_num(&tab, grade_avg(sum, count));
+        out_table_end_row(&tab);
+        out_table_end(&tab);
+    }
+    status_report_invalid(&o, format, stats_table_invalid(&t, subject));
+    out_free(&o);
+    stats_table_free(&t);
+}
+
+/**
+ * returns the output format with the given name, exits if unknown
+ */
+OutFormat out_format_parse(char *name) {
+    if (streq(name, FORMAT_TEXT)) return OUT_TEXT;
+    if (streq(name, FORMAT_CSV)) return OUT_CSV;
+    if (streq(name, FORMAT_TSV)) return OUT_TSV;
+    if (streq(name, FORMAT_JSON)) return OUT_JSON;
+    fprintf(cmd_out, "unknown format '%s', use %s, %s, %s or %s\n", name, FORMAT_TEXT, FORMAT_CSV, FORMAT_TSV, FORMAT_JSON);
+    cmd_exit(1);
+    return OUT_TEXT;
+}
+
+/**
+ * Execute status command.
+ *
+ * arg(length)   size of args
+ * arg(args)     array with the command arguments
+ */
+void command_status(int length, char *args[]) {
+    char *subject = NULL;
+    bool all = false;
+    bool stats = false;
+    bool list = true;
+    bool watch = false;
+    OutFormat format = OUT_TEXT;
+    int n_threads = 0;
+    RowFilter where;
+    RowFilter *filter = NULL;
+    row_filter_init(&where);
+    for (int i = 0; i < length; i++) {
+        if (streq(args[i], OPT_NAME_HELP)) {
+            command_status_usage(0);
+        } else if (streq(args[i], OPT_NAME_WHERE)) {
+            if (i + 1 == length) cmd_exit_usage_missing_value(args[i]);
+            if (!row_filter_parse(&where, args[++i], &cmd_arena)) {
+                fprintf(cmd_out, "invalid filter '%s'\n", args[i]);
+                cmd_exit(-1);
+            }
+            filter = &where;
+        } else if (streq(args[i], OPT_NAME_SINCE) || streq(args[i], OPT_NAME_UNTIL)) {
+            if (i + 1 == length) cmd_exit_usage_missing_value(args[i]);
+            int64_t time;
+            if (!time_arg_parse(args[i + 1], &time)) {
+                fprintf(cmd_out, "invalid time '%s', use YYYY-MM-DD[THH:MM[:SS]] or @SECONDS\n", args[i + 1]);
+                cmd_exit(-1);
+            }
+            if (streq(args[i++], OPT_NAME_SINCE)) where.since = time;
+            else where.until = time;
+            where.has_time = true;
+            filter = &where;
+        } else if (streq(args[i], OPT_NAME_ALL)) {
+            all = true;
+        } else if (streq(args[i], OPT_NAME_STATS)) {
+            stats = true;
+        } else if (streq(args[i], OPT_NAME_NO_LIST)) {
+            list = false;
+        } else if (streq(args[i], OPT_NAME_WATCH)) {
+            watch = true;
+        } else if (streq(args[i], OPT_NAME_FORMAT)) {
+            if (i + 1 == length) cmd_exit_usage_missing_value(args[i]);
+            format = out_format_parse(args[++i]);
+        } else if (streq(args[i], OPT_NAME_THREADS)) {
+            if (i + 1 == length) cmd_exit_usage_missing_value(args[i]);
+            n_threads = strtol(args[++i], NULL, 10);
+            if (n_threads < 1) {
+                fprintf(cmd_out, "invalid number of threads '%s'\n", args[i]);
+                cmd_exit(-1);
+            }
+        } else if (cmd_is_option(args[i])) {
+            exit_unknown_option(args[i]);
+        } else {
+            subject = args[i];
+        }
+    }
+    if (session_gb == NULL && csv_multi_input()) {
+        if (watch) {
+            fprintf(cmd_out, "%s is only available for a single grade book\n", OPT_NAME_WATCH);
+            cmd_exit(-1);
+        }
+        command_status_files(subject, stats, n_threads, format, filter);
+        return;
+    }
+    csv_must_exist();
+    if (where.has_time && !(session_gb != NULL ? gradebook_timed(session_gb) : csv_is_timed(opt_default_csv))) {
+        fprintf(cmd_out, "%s has no time column, create grade books with '%s %s %s'\n", opt_default_csv, APP_NAME, CMD_NAME_INIT, OPT_NAME_TIME);
+        cmd_exit(1);
+    }
+    if (watch) {
+        command_status_watch(subject, stats, n_threads, format, filter);
+        return;
+    }
+    if (stats) {
+        command_status_stats(subject, n_threads, format, filter);
+        return;
+    }
+    if (all) {
+        command_status_all(subject, n_threads, format, filter);
+        return;
+    }
+    if (!list) {
+        command_status_summary(subject, format, filter);
+        return;
+    }
+    GradeBook local;
+    GradeBook *gb = session_gb;
+    if (gb == NULL) {
+        // only the rows to print are loaded: SUBJECT becomes a subject
+        // predicate unless the filter has one
+        if (subject != NULL && where.n_subjects == 0) {
+            where.subjects = arena_alloc(&cmd_arena, sizeof(SubjectPattern));
+            where.subjects[0].name.ptr = subject;
+            where.subjects[0].name.len = strlen(subject);
+            where.subjects[0].prefix = false;
+            where.n_subjects = 1;
+            filter = &where;
+        }
+        gradebook_init(&local, false);
+        local.filter = filter;
+        gradebook_load(&local, opt_default_csv);
+        gb = &local;
+    }
+    profile_phase(PHASE_AGGREGATE);
+    GradeRef *order = NULL;
+    Subject *s = NULL; // the subject, or NULL to print all rows
+    int n_grades = 0;
+    if (subject != NULL) {
+        s = gradebook_subject(gb, subject, strlen(subject), false);
+        n_grades = s != NULL ? s->n_grades : 0;
+    } else {
+        order = gradebook_order(gb);
+        n_grades = gb->n_rows;
+    }
 
-typedef struct subject {
-    char *name;
-    float *grades;
-    int n_grades;
-} Subject;
+    profile_phase(PHASE_OUTPUT);
+    OutBuf o;
+    out_init(&o);
+    OutTable tab;
+    const char *cols[] = { "subject", "grade" };
+    if (format != OUT_TEXT) out_table_begin(&tab, &o, format, cols, 2);
+    else if (subject != NULL) out_printf(&o, "Stats for %s\n", subject);
+    else out_puts(&o, "Stats\n");
+    int64_t sum = 0;
+    int count = 0;
+    int64_t n_invalid = 0;
+    for (int i = 0; i < n_grades; i++) {
+        GradeRef ref = order != NULL ? order[i] : (GradeRef) { s, i };
+        grade_t g = ref.subject->grades[ref.i];
+        // a loaded book only holds the rows that pass, the session book holds all
+        if (gb == session_gb && filter != NULL && !gradebook_row_passes(gb, filter, ref)) continue;
+        if (g == GRADE_INVALID) {
+            n_invalid++;
+            continue;
+        }
+        if (format != OUT_TEXT) {
+            out_table_str(&tab, ref.subject->name);
+            out_table_grade(&tab, g);
+            out_table_end_row(&tab);
+        } else {
+            out_puts(&o, count == 0 ? "Grades: " : ", ");
+            out_grade(&o, g);
+        }
+        sum += g;
+        count++;
+    }
+    if (format != OUT_TEXT) {
+        out_table_end(&tab);
+    } else if (count == 0) {
+        out_puts(&o, "No grades\n");
+    } else {
+        out_puts(&o, "\n");
+        out_printf(&o, "Avg: %.2f\n", grade_avg(sum, count));
+    }
+    status_report_invalid(&o, format, n_invalid);
+    out_free(&o);
 
-Subject subject_create(char* name) {
-    Subject s;
-    s.name = name;
-    s.grades = malloc(0);
-    s.n_grades = 0;
-    return s;
+    free(order);
+    if (gb == &local) gradebook_free(&local);
 }
 
-void subject_insert_grade(Subject *subject, float grade) {
-    subject->n_grades++;
-    subject->grades = (float *) realloc(subject->grades, sizeof(float) * subject->n_grades);
-    subject->grades[subject->n_grades-1] = grade;
+/**
+ * Execute init command.
+ *
+ * arg(length)   size of args
+ * arg(args)     array with the command arguments
+ */
+void command_init(int length, char **args) {
+    bool timed = false;
+    for (int i = 0; i < length; i++) {
+        if (streq(args[i], OPT_NAME_TIME)) timed = true;
+        else exit_unknown_option(args[i]);
+    }
+    if (csv_exists() || !csv_init_file(opt_default_csv, timed)) exit_csv_already_initialized();
+    fprintf(cmd_out, "%s successfully initialized!\n", DEFAULT_CSV_NAME);
 }
 
-void exit_usage(int exit_code) {
-    printf("\nUsage: %s COMMAND\n", APP_NAME);
-    printf("\n");
-    printf("A lightweight tool to manage school grades\n");
-    printf("\n");
-    printf("Commands:\n");
-    printf("\tadd \t%s\n", CMD_USAGE_ADD);
-    printf("\tstatus \t%s\n", CMD_USAGE_STATUS);
-    printf("\n");
-    printf("Run '%s COMMAND --help' for more information on a command.\n", APP_NAME);
-    exit(exit_code);
+void command_rm_usage(int exit_code) {
+    fprintf(cmd_out, "\nUsage: %s rm [SUBJECT GRADE [INDEX]]...\n", APP_NAME);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "%s\n", CMD_USAGE_RM);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Examples:\n");
+    fprintf(cmd_out, "\t%s rm                    remove the last added grade\n", APP_NAME);
+    fprintf(cmd_out, "\t%s rm math 5.25          remove the first 5.25 of math\n", APP_NAME);
+    fprintf(cmd_out, "\t%s rm math 5.25 1        remove the second 5.25 of math\n", APP_NAME);
+    fprintf(cmd_out, "\t%s rm math 5 0 bio 4 2   remove several grades at once\n", APP_NAME);
+    fprintf(cmd_out, "\n");
+    cmd_exit(exit_code);
 }
 
-void exit_unknown_option(char *option) {
-    printf("Unknown option %s\n", option);
-    exit(1);
+/**
+ * Execute rm command on a grade book (the one of the session or
+ * a loaded binary grade book).
+ * returns false if not every target has been found
+ */
+bool command_rm_book(GradeBook *gb, int argc, char **args) {
+    if (argc == 0) {
+        if (!gradebook_remove_last(gb)) {
+            fprintf(cmd_out, "no grades to remove\n");
+            return false;
+        }
+        fprintf(cmd_out, "removed last grade\n");
+        return true;
+    }
+    int n_targets = argc == 2 ? 1 : argc / 3;
+    bool missing = false;
+    // indexes refer to the grade book before the removal, so the
+    // targets are resolved to grades before anything is removed
+    GradeRef *refs = malloc(sizeof(GradeRef) * n_targets);
+    for (int i = 0; i < n_targets; i++) {
+        char *subject = args[i * 3];
+        char *grade = args[i * 3 + 1];
+        int index = argc > 2 ? strtol(args[i * 3 + 2], NULL, 10) : 0;
+        refs[i].subject = gradebook_subject(gb, subject, strlen(subject), false);
+        refs[i].i = -1;
+        for (int k = 0; refs[i].subject != NULL && k < refs[i].subject->n_grades; k++) {
+            if (gradebook_grade_eq(gb, refs[i].subject, k, grade) && index-- == 0) {
+                refs[i].i = k;
+                break;
+            }
+        }
+        for (int j = 0; j < i && refs[i].i != -1; j++) {
+            if (refs[j].subject == refs[i].subject && refs[j].i == refs[i].i) refs[i].i = -1; // removed once
+        }
+        if (refs[i].i == -1) {
+            fprintf(cmd_out, "grade %s of %s not found\n", grade, subject);
+            missing = true;
+        }
+    }
+    // remove from the back so that the resolved positions stay valid
+    for (int i = 0; i < n_targets; i++) {
+        int last = -1;
+        for (int k = 0; k < n_targets; k++) {
+            if (refs[k].i == -1) continue;
+            if (last == -1 || refs[k].subject > refs[last].subject
+                    || (refs[k].subject == refs[last].subject && refs[k].i > refs[last].i)) last = k;
+        }
+        if (last == -1) break;
+        gradebook_remove_at(gb, refs[last].subject, refs[last].i);
+        for (int k = 0; k < n_targets; k++) {
+            if (refs[k].subject == refs[last].subject && refs[k].i == refs[last].i) refs[k].i = -1;
+        }
+    }
+    free(refs);
+    return !missing;
 }
 
-void exit_no_csv() {
-    printf("%s does not exist. Init a new .csv file with:\n\t%s %s\n", opt_default_csv, APP_NAME, CMD_NAME_INIT);
-    exit(1);
-}
+/**
+ * Execute rm command.
+ * Without arguments the last row is removed. Otherwise every
+ * SUBJECT GRADE [INDEX] target removes the INDEX-th (0-based) grade
+ * of SUBJECT that equals GRADE. Several targets have to be given as
+ * SUBJECT GRADE INDEX triples and are removed in one pass.
+ *
+ * arg(argc)   size of args
+ * arg(args)   array with the command arguments
+ */
+void command_rm(int argc, char **args) {
+    if (argc > 0 && streq(args[0], OPT_NAME_HELP)) command_rm_usage(0);
+    if (argc == 1 || (argc > 3 && argc % 3 != 0)) command_rm_usage(-1);
+    csv_must_exist();
+    if (session_gb != NULL) {
+        if (!command_rm_book(session_gb, argc, args)) cmd_exit(1);
+        return;
+    }
+    if (book_is_binary(opt_default_csv)) {
+        GradeBook gb;
+        gradebook_init(&gb, true);
+        gradebook_load(&gb, opt_default_csv);
+        bool ok = command_rm_book(&gb, argc, args);
+        gradebook_save(&gb, opt_default_csv);
+        gradebook_free(&gb);
+        if (!ok) cmd_exit(1);
+        return;
+    }
+    if (argc == 0) {
+        char *line;
+        csv_remove_last_row(opt_default_csv, &line);
+        if (line == NULL) {
+            fprintf(cmd_out, "no grades to remove\n");
+            cmd_exit(1);
+        }
+        fprintf(cmd_out, "removed %s\n", line);
+        return;
+    }
 
-void exit_unknown_cmd(char *cmd) {
-    printf("Unknown command '%s'\n", cmd);
-    exit(1);
+    int n_targets = argc == 2 ? 1 : argc / 3;
+    RmTarget *targets = malloc(sizeof(RmTarget) * n_targets);
+    for (int i = 0; i < n_targets; i++) {
+        targets[i].subject = args[i * 3];
+        targets[i].grade = args[i * 3 + 1];
+        targets[i].index = argc > 2 ? strtol(args[i * 3 + 2], NULL, 10) : 0;
+        targets[i].seen = 0;
+        targets[i].removed = false;
+    }
+    csv_remove_rows(opt_default_csv, targets, n_targets);
+    bool missing = false;
+    for (int i = 0; i < n_targets; i++) {
+        if (!targets[i].removed) {
+            fprintf(cmd_out, "grade %s of %s not found\n", targets[i].grade, targets[i].subject);
+            missing = true;
+        }
+    }
+    free(targets);
+    if (missing) cmd_exit(1);
 }
 
-void exit_csv_already_initialized() {
-    printf("%s already initialized.\n", DEFAULT_CSV_NAME);
-    exit(1);
+void command_convert_usage(int exit_code) {
+    fprintf(cmd_out, "\nUsage: %s convert %s %s|%s [%s FILE]\n", APP_NAME, OPT_NAME_TO, FORMAT_CSV, FORMAT_BIN, OPT_NAME_OUT);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "%s\n", CMD_USAGE_CONVERT);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Options:\n");
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_TO, OPT_USAGE_TO);
+    fprintf(cmd_out, "\t%s \t%s\n", OPT_NAME_OUT, OPT_USAGE_OUT);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "Examples:\n");
+    fprintf(cmd_out, "\t%s convert %s %s\n", APP_NAME, OPT_NAME_TO, FORMAT_BIN);
+    fprintf(cmd_out, "\t%s convert %s %s %s export.csv\n", APP_NAME, OPT_NAME_TO, FORMAT_CSV, OPT_NAME_OUT);
+    fprintf(cmd_out, "\n");
+    cmd_exit(exit_code);
 }
 
-void command_add_usage(int exit_code) {
-    printf("\nUsage: %s add SUBJECT GRADE [COMMENT]\n", APP_NAME);
-    printf("\n");
-    printf("%s\n", CMD_USAGE_STATUS);
-    printf("\n");
-    printf("Examples:\n");
-    printf("\t%s add math 5.2\n", APP_NAME);
-    printf("\t%s add math 5.5 \"second exam\"\n", APP_NAME);
-    printf("\n");
-    exit(exit_code);
+/**
+ * Lists the rows whose grade cannot be read. A binary book only
+ * stores parsed grades, so their text would be lost on conversion.
+ * returns the number of listed rows
+ */
+int gradebook_list_malformed(GradeBook *gb) {
+    GradeRef *order = gradebook_order(gb);
+    int n = 0;
+    for (int i = 0; i < gb->n_rows; i++) {
+        Subject *s = order[i].subject;
+        if (s->grades[order[i].i] != GRADE_INVALID) continue;
+        fprintf(cmd_out, "malformed grade '%s' of %s\n", s->grade_strs[order[i].i], s->name);
+        n++;
+    }
+    free(order);
+    return n;
 }
 
-void command_status_usage(int exit_code) {
-
+/**
+ * Execute convert command. The grade book is rewritten in the
+ * target format, either in place or into another file.
+ *
+ * arg(argc)   size of args
+ * arg(args)   array with the command arguments
+ */
+void command_convert(int argc, char **args) {
+    char *to = NULL;
+    char *out = NULL;
+    for (int i = 0; i < argc; i++) {
+        if (streq(args[i], OPT_NAME_HELP)) {
+            command_convert_usage(0);
+        } else if (streq(args[i], OPT_NAME_TO) || streq(args[i], OPT_NAME_OUT)) {
+            if (i + 1 == argc) cmd_exit_usage_missing_value(args[i]);
+            if (streq(args[i], OPT_NAME_TO)) to = args[++i];
+            else out = args[++i];
+        } else if (cmd_is_option(args[i])) {
+            exit_unknown_option(args[i]);
+        } else {
+            command_convert_usage(-1);
+        }
+    }
+    if (to == NULL) command_convert_usage(-1);
+    if (!streq(to, FORMAT_CSV) && !streq(to, FORMAT_BIN)) {
+        fprintf(cmd_out, "unknown format '%s', use %s or %s\n", to, FORMAT_CSV, FORMAT_BIN);
+        cmd_exit(-1);
+    }
+    csv_must_exist();
+    bool timed = session_gb != NULL ? gradebook_timed(session_gb) : csv_is_timed(opt_default_csv);
+    if (timed && streq(to, FORMAT_BIN)) {
+        fprintf(cmd_out, "binary grade books have no time column\n");
+        cmd_exit(1);
+    }
+    if (session_gb != NULL) {
+        if (out != NULL) {
+            fprintf(cmd_out, "%s is not available in a session\n", OPT_NAME_OUT);
+            cmd_exit(-1);
+        }
+        if (streq(to, FORMAT_BIN) && gradebook_list_malformed(session_gb) > 0) {
+            fprintf(cmd_out, "not converted, fix or remove the malformed grades first\n");
+            cmd_exit(1);
+        }
+        // the book is rewritten on sync and at the end of the session
+        session_gb->binary = streq(to, FORMAT_BIN);
+        session_gb->rewrite = true;
+        fprintf(cmd_out, "converted %d grades to %s\n", session_gb->n_rows, to);
+        return;
+    }
+    GradeBook gb;
+    gradebook_init(&gb, true);
+    gradebook_load(&gb, opt_default_csv);
+    if (streq(to, FORMAT_BIN) && gradebook_list_malformed(&gb) > 0) {
+        gradebook_free(&gb);
+        fprintf(cmd_out, "not converted, fix or remove the malformed grades first\n");
+        cmd_exit(1);
+    }
+    gb.binary = streq(to, FORMAT_BIN);
+    gb.rewrite = true;
+    if (out != NULL && !streq(out, opt_default_csv)) gb.ino = 0; // a new file, not the loaded one
+    gradebook_save(&gb, out != NULL ? out : opt_default_csv);
+    fprintf(cmd_out, "converted %d grades to %s\n", gb.n_rows, to);
+    gradebook_free(&gb);
 }
 
-bool csv_exists() {
-    struct stat st;
-    return stat(opt_default_csv, &st) != -1;
+void command_compact_usage(int exit_code) {
+    fprintf(cmd_out, "\nUsage: %s compact\n", APP_NAME);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "%s\n", CMD_USAGE_COMPACT);
+    fprintf(cmd_out, "\n");
+    fprintf(cmd_out, "rm records removed grades in the delete log next to the csv\n");
+    fprintf(cmd_out, "and compacts the csv once they make up 1/%d of it.\n", DEL_COMPACT_DIVISOR);
+    fprintf(cmd_out, "\n");
+    cmd_exit(exit_code);
 }
 
 /**
- * Ensures that the csv file exists.
+ * Execute compact command: a single rewrite of the csv that drops
+ * every row of the delete log.
+ *
+ * arg(argc)   size of args
+ * arg(args)   array with the command arguments
  */
-void csv_must_exist() {
-    struct stat st;
-    if (!csv_exists()) {
-        exit_no_csv();
+void command_compact(int argc, char **args) {
+    if (argc > 0 && streq(args[0], OPT_NAME_HELP)) command_compact_usage(0);
+    if (argc > 0) command_compact_usage(-1);
+    csv_must_exist();
+    if (session_gb != NULL) {
+        // the loaded book has no deleted rows, rewriting it drops them
+        session_gb->rewrite = true;
+        fprintf(cmd_out, "compacted on sync\n");
+        return;
     }
+    int dropped = csv_compact(opt_default_csv);
+    fprintf(cmd_out, "compacted %d deleted rows\n", dropped);
 }
 
 /**
- * writes a \0 terminated string to an fd or exits
- * if write did not work
+ * Splits a command line into arguments (in place). Arguments are
+ * separated by whitespace, single or double quotes group words
+ * into one argument.
+ *
+ * arg(line)     the line to split, gets modified
+ * arg(o_argv)   output parameter, heap allocated argument array
+ *               whose first element is the program name
+ * returns the number of arguments including the program name
  */
-ssize_t csv_write_string(int fd, char *s) {
-    ssize_t b = write(fd, s, sizeof(*s) * strlen(s));
-    if (b == -1) {
-        printerrno("write failed");
+int cmd_split(char *line, char ***o_argv) {
+    int cap = 8;
+    int argc = 0;
+    char **argv = malloc(sizeof(char *) * cap);
+    argv[argc++] = APP_NAME;
+    char *in = line;
+    while (*in) {
+        while (*in == ' ' || *in == '\t' || *in == '\n' || *in == '\r') in++;
+        if (!*in) break;
+        char *out = in;
+        char *arg = in;
+        char quote = 0;
+        while (*in && (quote || (*in != ' ' && *in != '\t' && *in != '\n' && *in != '\r'))) {
+            if (quote && *in == quote) quote = 0;
+            else if (!quote && (*in == '"' || *in == '\'')) quote = *in;
+            else *out++ = *in;
+            in++;
+        }
+        if (*in) in++;
+        *out = '\0';
+        if (argc + 1 == cap) {
+            cap *= 2;
+            argv = (char **) realloc(argv, sizeof(char *) * cap);
+        }
+        argv[argc++] = arg;
     }
-    return b;
-}
-
-void csv_init_file() {
-    int oflag = O_WRONLY | O_CREAT | O_EXCL | O_APPEND;
-    int fd = open(opt_default_csv, oflag);
-    if (fd == -1) printerrno("init csv failed");
-    csv_write_string(fd, "subject;grade;comment");
-    csv_write_string(fd, "\n");
-    if (close(fd) == -1) printerrno(NULL);
+    argv[argc] = NULL;
+    *o_argv = argv;
+    return argc;
 }
 
+void command(int argc, char **argv);
 
-
-size_t csv_move_to_next_line(int csv_fd) {
-    char buf;
-    size_t s = 0; 
-    ssize_t r;
-    while ((r = read(csv_fd, &buf, sizeof(buf)))) { 
-        if (r == -1) printerrno("csv_move_to_next_line read failed");
-        s += r;
-        if (buf == '\n') break;
+/**
+ * Execute sync command: writes the grade book of the session
+ * to the csv file.
+ */
+void command_sync() {
+    if (session_gb == NULL) {
+        fprintf(cmd_out, "%s is only available in a session\n", CMD_NAME_SYNC);
+        cmd_exit(1);
     }
-    return s;
+    gradebook_save(session_gb, opt_default_csv);
+    fprintf(cmd_out, "synced %s\n", opt_default_csv);
 }
 
 /**
- * Read char squence up to the next occurence of terminator.
- * Allocates memory on the heap to store the char sequence.
- * arg(csv_fd) the csv file descriptor
- * arg(terminator) the terminator char
- * returns char sequnce up to terminator (excluding terminator)
+ * Execute shell and batch command.
+ * Loads the csv once and runs every command read from stdin (one
+ * per line) through command() against the loaded grade book. The
+ * csv is written back on sync and once at the end of the session.
+ * A failing command does not end the session, batch exits with
+ * the exit code of the last failed command.
+ *
+ * arg(interactive) whether to print a prompt (shell)
  */
-char *csv_read_to_next(int csv_fd, char terminator) {
-    char *out = malloc(sizeof(char));
-    *out = '\0';
-    int out_size = 0;
-    char buf;
-    ssize_t r;
-    while ((r = read(csv_fd, &buf, sizeof(buf))) && buf != terminator) {
-        if (r == -1) printerrno("csv_read_to_next read failed");
-        out_size++;
-        out = (char *) realloc(out, sizeof(char) * (out_size+1));
-        out[out_size-1] = buf;
-        out[out_size] = '\0';
+void command_session(bool interactive) {
+    if (session_gb != NULL) {
+        fprintf(cmd_out, "sessions can not be nested\n");
+        cmd_exit(1);
     }
-    return out;
+    csv_must_exist();
+    GradeBook gb;
+    gradebook_init(&gb, true);
+    gradebook_load(&gb, opt_default_csv);
+    session_gb = &gb;
+
+    jmp_buf jmp;
+    jmp_buf *outer = cmd_exit_jmp;
+    int status = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    while (true) {
+        if (interactive) {
+            fprintf(cmd_out, "%s> ", APP_NAME);
+            fflush(cmd_out);
+        }
+        if (getline(&line, &line_cap, stdin) == -1) break;
+        char **argv;
+        int argc = cmd_split(line, &argv);
+        if (argc > 1 && streq(argv[1], CMD_NAME_EXIT)) {
+            free(argv);
+            break;
+        }
+        if (argc > 1) {
+            int mark = cmd_n_resources;
+            cmd_exit_jmp = &jmp;
+            if (setjmp(jmp) == 0) {
+                command(argc, argv);
+            } else {
+                status = cmd_exit_code;
+            }
+            cmd_exit_jmp = outer;
+            cmd_release(mark);
+        }
+        free(argv);
+        arena_free(&cmd_arena);
+        fflush(cmd_out);
+    }
+    free(line);
+    if (interactive) fprintf(cmd_out, "\n");
+
+    gradebook_save(&gb, opt_default_csv);
+    gradebook_free(&gb);
+    session_gb = NULL;
+    if (!interactive && status != 0) cmd_exit(status);
 }
 
+/**
+ * A grade book held by the server together with the identity of
+ * the csv file it has been loaded from. If the file changes behind
+ * the server's back, the book is reloaded.
+ */
+typedef struct served_book {
+    char *path;
+    GradeBook gb;
+    struct stat st;
+} ServedBook;
 
 /**
- * Get float array with all grades.
- * arg(csv_fd) the csv file fd
- * arg(*o_size) an output parameter, containing the size of the output array 
- * returns a float array containing all grades
+ * A connection of the server. Requests are read into in, responses
+ * are collected in out until the socket accepts them.
  */
-float *csv_grades(int csv_fd, int *o_size) {
-    float *out = malloc(0);
-    *o_size = 0;
-    char *s; // subject
-    char *g; // grade
-    while (csv_move_to_next_line(csv_fd) && *(s = csv_read_to_next(csv_fd, ';'))) {
-        g = csv_read_to_next(csv_fd, ';');
-        out = (float *) realloc(out, sizeof(float) * (*o_size+1));
-        out[*o_size] = strtof(g, NULL);
-        (*o_size)++;
-        free(g);
-        free(s);
-    } 
-    return out;
+typedef struct serve_client {
+    int fd;
+    char *in;
+    size_t in_len;
+    size_t in_cap;
+    char *out;
+    size_t out_len;
+    size_t out_cap;
+    size_t out_off;
+    bool closing; // close once out has been sent
+} ServeClient;
+
+ServedBook *served_books = NULL;
+int n_served_books = 0;
+char *serve_default_csv = NULL;
+volatile sig_atomic_t serve_stop = 0;
+
+void serve_handle_signal(int sig) {
+    serve_stop = 1;
+}
+
+bool served_book_changed(ServedBook *b, struct stat *st) {
+    return st->st_dev != b->st.st_dev || st->st_ino != b->st.st_ino || st->st_size != b->st.st_size
+        || st->st_mtim.tv_sec != b->st.st_mtim.tv_sec || st->st_mtim.tv_nsec != b->st.st_mtim.tv_nsec;
 }
 
 /**
- * Get float array with all grades of a subject.
- * arg(csv_fd) the csv file fd
- * arg(*subject) the target subject
- * arg(*o_size) an output parameter, containing the size 
- * of the returned array.
- * returns a float array containing all grades
- * of a subject. 
+ * returns the loaded grade book of a csv file or NULL if the file
+ * does not exist
  */
-float *csv_subject_grades(int csv_fd, char *subject, int *o_size) {
-    float *out = malloc(0);
-    *o_size = 0;
-    char *s; // subject
-    char *g; // grade
-    while (csv_move_to_next_line(csv_fd)) {
-        s = csv_read_to_next(csv_fd, ';');
-        if (strcmp(s, subject) == 0) {
-            g = csv_read_to_next(csv_fd, ';');
-            out = (float *) realloc(out, sizeof(float) * (*o_size+1));
-            out[*o_size] = strtof(g, NULL);
-            (*o_size)++;
-            free(g);
-        }
-        free(s);
-    } 
-    return out;
+ServedBook *serve_book(char *path) {
+    struct stat st;
+    if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) return NULL;
+    ServedBook *b = NULL;
+    for (int i = 0; i < n_served_books; i++) {
+        if (streq(served_books[i].path, path)) b = &served_books[i];
+    }
+    if (b != NULL && !served_book_changed(b, &st)) return b;
+    if (b == NULL) {
+        served_books = (ServedBook *) realloc(served_books, sizeof(ServedBook) * (n_served_books + 1));
+        b = &served_books[n_served_books++];
+        b->path = strdup(path);
+    } else {
+        gradebook_free(&b->gb);
+    }
+    gradebook_init(&b->gb, true);
+    gradebook_load(&b->gb, path);
+    b->st = st;
+    return b;
+}
+
+void serve_books_free() {
+    for (int i = 0; i < n_served_books; i++) {
+        gradebook_free(&served_books[i].gb);
+        free(served_books[i].path);
+    }
+    free(served_books);
+    served_books = NULL;
+    n_served_books = 0;
 }
 
 /**
- * traverses an array and searches for an option value.
- * e.g. let arr=["cgrade", "--csv", "cgrade.csv", "--more-options"]
- * then cmd_get_option(4, arr, "--csv") returns cgrade.csv
- * everything that starts with "-" is considered an option
- * and not a value.
- * 
- * arg(n) the size of the cmd array
- * arg(cmd) the cmd array to be traversed
- * arg(option) the option to be searched
- *
- * returns the value for the first option occurence or NULL if the option could not be found.
- * if the option is directly followed by another option, then an empty string is returned,
- * which indicates that the option was present without any value.
+ * Runs one request line through command() and renders the response
+ * as "EXIT_CODE LENGTH\n" followed by LENGTH bytes of output.
  */
-char *cmd_get_option(int n, char **cmd, char *option) {
-    for (int i = 0; i < n; i++) {
-        if (strcmp(option, cmd[i]) == 0) {
-            if (i+1 < n && cmd[i+1][0] != '-') {
-                return cmd[i+1];
+void serve_request(char *line, char **o_resp, size_t *o_len) {
+    char **argv;
+    int argc = cmd_split(line, &argv);
+    char *body = NULL;
+    size_t body_len = 0;
+    cmd_out_file = open_memstream(&body, &body_len);
+    int code = 0;
+
+    opt_default_csv = serve_default_csv;
+    int i = 1;
+    for (; i < argc && cmd_is_option(argv[i]); i++) {
+        if (streq(argv[i], OPT_NAME_CSV) && i + 1 < argc) opt_default_csv = argv[++i];
+    }
+    char *cmd = i < argc ? argv[i] : "";
+    if (streq(cmd, CMD_NAME_SERVE) || streq(cmd, CMD_NAME_SHELL) || streq(cmd, CMD_NAME_BATCH)) {
+        fprintf(cmd_out, "%s is not available on the server\n", cmd);
+        code = 1;
+    } else if (argc > 1) {
+        ServedBook *b = serve_book(opt_default_csv);
+        session_gb = b != NULL ? &b->gb : NULL;
+        int mark = cmd_n_resources;
+        jmp_buf jmp;
+        jmp_buf *outer = cmd_exit_jmp;
+        cmd_exit_jmp = &jmp;
+        if (setjmp(jmp) == 0) {
+            command(argc, argv);
+        } else {
+            code = cmd_exit_code;
+        }
+        session_gb = NULL;
+        if (b != NULL && (b->gb.rewrite || b->gb.n_persisted < b->gb.n_rows)) {
+            // a failing save fails the request, the book is reloaded
+            // by the next one since it no longer matches the file
+            if (setjmp(jmp) == 0) {
+                gradebook_save(&b->gb, b->path);
+                stat(b->path, &b->st);
             } else {
-                return "";
+                code = cmd_exit_code;
+                memset(&b->st, 0, sizeof(b->st));
             }
         }
+        cmd_exit_jmp = outer;
+        cmd_release(mark);
     }
-    return NULL;
-}
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    free(argv);
+    arena_free(&cmd_arena);
 
-bool cmd_is_option(char *cmd) {
-    if (cmd[0] == '-') return true;
-    return false;
+    char head[32];
+    int head_len = snprintf(head, sizeof(head), "%d %zu\n", code, body_len);
+    *o_resp = malloc(head_len + body_len);
+    memcpy(*o_resp, head, head_len);
+    memcpy(*o_resp + head_len, body, body_len);
+    *o_len = head_len + body_len;
+    free(body);
 }
 
 /**
- * moves the cmd array pointer forward to the first string
- * that is not an option. Everything that starts with
- * an '-' is considered an option.
- *
- * arg(n)   size of the cmd array
- * arg(cmd) a pointer to an array of strings
- *
- * returns a pointer that points to the first string of 
- * the cmd array which isn't an option. Furthermore, the
- * size pointer arg(n) will be set to the correct size
- * of the new cmd array
+ * Sends as much of the pending output as the socket accepts.
+ * returns false if the connection failed
  */
-char **cmd_skip_options(int *n, char *cmd[]) {
-    int counter = 0;
-    int prevSkipped = 0;
-    while (*n > 0 && (cmd[0][0] == '-' || prevSkipped)) {
-        prevSkipped = !prevSkipped;
-        cmd++;
-        *n -= 1;
+bool serve_client_flush(ServeClient *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n == -1) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        c->out_off += n;
     }
-    return cmd;
+    c->out_off = 0;
+    c->out_len = 0;
+    return true;
 }
 
 /**
- * Execute add command.
- *
- * arg(length)   size of args
- * arg(args)     array with the command arguments
+ * Reads from a client and answers all complete request lines.
+ * returns false if the connection should be closed
  */
-void command_add(int length, char *args[]) {
-    if (length > 0 && streq(*args, OPT_NAME_HELP)) command_add_usage(0);
-    if (length < 2) command_add_usage(-1);
-    csv_must_exist();
-    char *subject = args[0];
-    char *grade = args[1];
-    float gradef = strtof(grade, NULL);
-    if (gradef == 0) {
-        printf("invalid grade '%s'\n", grade);
-        exit(-1);
-    }
-    char *msg = "";
-    if (length > 2) msg = args[2];
-
-    int o_flag = O_WRONLY | O_APPEND;
-    int fd = open(opt_default_csv, o_flag);
-    if (fd == -1) {
-        printerrno("open file failed");
+bool serve_client_read(ServeClient *c) {
+    while (true) {
+        if (c->in_cap - c->in_len < 4096) {
+            c->in_cap = c->in_cap ? c->in_cap * 2 : 8192;
+            c->in = realloc(c->in, c->in_cap);
+        }
+        ssize_t n = recv(c->fd, c->in + c->in_len, c->in_cap - c->in_len - 1, 0);
+        if (n == -1 && errno == EINTR) continue;
+        if (n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n <= 0) {
+            c->closing = true;
+            break;
+        }
+        c->in_len += n;
     }
-    csv_write_string(fd, subject);
-    csv_write_string(fd, ";");
-    csv_write_string(fd, grade);
-    csv_write_string(fd, ";");
-    csv_write_string(fd, msg);
-    csv_write_string(fd, "\n");
-
-    if (close(fd) == -1) {
-        printerrno(NULL);
+    size_t start = 0;
+    char *nl;
+    while ((nl = memchr(c->in + start, '\n', c->in_len - start)) != NULL) {
+        *nl = '\0';
+        char *resp;
+        size_t resp_len;
+        serve_request(c->in + start, &resp, &resp_len);
+        if (c->out_len + resp_len > c->out_cap) {
+            c->out_cap = (c->out_len + resp_len) * 2;
+            c->out = realloc(c->out, c->out_cap);
+        }
+        memcpy(c->out + c->out_len, resp, resp_len);
+        c->out_len += resp_len;
+        free(resp);
+        start = nl - c->in + 1;
     }
+    memmove(c->in, c->in + start, c->in_len - start);
+    c->in_len -= start;
+    if (c->in_len > SERVE_MAX_REQUEST) return false;
+    return serve_client_flush(c);
+}
 
-    printf("added grade %.2f to %s!\n", gradef, subject);
+void serve_client_close(int epfd, ServeClient *c) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in);
+    free(c->out);
+    free(c);
 }
 
 /**
- * Execute status command.
+ * Execute serve command.
+ * Listens on a unix socket and answers requests of many concurrent
+ * clients in an epoll event loop. A request is a command line as it
+ * would be passed to cgrade (e.g. "--csv /path/grades.csv add math 5"),
+ * terminated by a newline. Grade books are loaded once and kept in
+ * memory, mutations are written to their csv right away.
  *
- * arg(length)   size of args
- * arg(args)     array with the command arguments
+ * arg(argc)   size of args
+ * arg(args)   array with the command arguments
  */
-void command_status(int length, char *args[]) {
-    if (length > 0 && streq(args[0], OPT_NAME_HELP)) command_status_usage(0);
-    csv_must_exist();
-    int fd = open(opt_default_csv, O_RDONLY);
-    int n_grades;
-    float *grades;
-    char *title;
-    if (length > 0) {
-        grades = csv_subject_grades(fd, args[0], &n_grades);
-        printf("Stats for %s\n", args[0]);
-    } else {
-        grades = csv_grades(fd, &n_grades);
-        printf("Stats\n");
+void command_serve(int argc, char **args) {
+    char *socket_path = cmd_get_option(argc, args, OPT_NAME_SOCKET);
+    if (socket_path == NULL || !*socket_path) {
+        fprintf(cmd_out, "\nUsage: %s serve %s PATH\n\n%s\n\n", APP_NAME, OPT_NAME_SOCKET, CMD_USAGE_SERVE);
+        cmd_exit(argc > 0 && streq(args[0], OPT_NAME_HELP) ? 0 : -1);
     }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(cmd_out, "socket path too long\n");
+        cmd_exit(1);
+    }
+    strcpy(addr.sun_path, socket_path);
 
-    printf("Grades: %.2f", *grades);
-    float avg = *grades;
-    for (float* f = (grades+1); f < (grades + n_grades); f++) {
-        printf(", %.2f", *f);
-        avg += *f;
+    int lfd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (lfd == -1) cmd_exit_errno("socket failed");
+    if (connect(lfd, (struct sockaddr *) &addr, sizeof(addr)) == 0) {
+        fprintf(cmd_out, "%s is already served\n", socket_path);
+        cmd_exit(1);
     }
-    printf("\n");
-    avg /= n_grades;
-    printf("Avg: %.2f\n", avg);
+    unlink(socket_path); // stale socket of a previous server
+    if (bind(lfd, (struct sockaddr *) &addr, sizeof(addr)) == -1) cmd_exit_errno("bind failed");
+    if (listen(lfd, SOMAXCONN) == -1) cmd_exit_errno("listen failed");
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_handle_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
 
-    free(grades);
-    if (close(fd) == -1) printerrno("command_default close failed");
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1) cmd_exit_errno("epoll_create failed");
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL; // the listening socket
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, lfd, &ev) == -1) cmd_exit_errno("epoll_ctl failed");
+
+    serve_default_csv = opt_default_csv;
+    serving = true;
+    fprintf(cmd_out, "serving on %s\n", socket_path);
+    fflush(cmd_out);
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    while (!serve_stop) {
+        int n = epoll_wait(epfd, events, SERVE_MAX_EVENTS, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            cmd_exit_errno("epoll_wait failed");
+        }
+        for (int i = 0; i < n; i++) {
+            ServeClient *c = events[i].data.ptr;
+            if (c == NULL) {
+                int cfd;
+                while ((cfd = accept(lfd, NULL, NULL)) != -1) {
+                    fcntl(cfd, F_SETFL, O_NONBLOCK);
+                    fcntl(cfd, F_SETFD, FD_CLOEXEC);
+                    c = calloc(1, sizeof(ServeClient));
+                    c->fd = cfd;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(epfd, EPOLL_CTL_ADD, cfd, &ev);
+                }
+                continue;
+            }
+            bool ok = true;
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) ok = serve_client_read(c);
+            if (ok && (events[i].events & EPOLLOUT)) ok = serve_client_flush(c);
+            if (!ok || (c->closing && c->out_len == 0)) {
+                serve_client_close(epfd, c);
+                continue;
+            }
+            ev.events = c->out_len > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN;
+            ev.data.ptr = c;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+        }
+    }
+    serving = false;
+    close(epfd);
+    close(lfd);
+    unlink(socket_path);
+    serve_books_free();
 }
 
 /**
- * Execute init command.
- *
- * arg(length)   size of args
- * arg(args)     array with the command arguments
+ * Appends an argument to a request line, quoted if needed.
  */
-void command_init(int length, char **args) {
-    if (csv_exists()) exit_csv_already_initialized();
-    csv_init_file();
-    printf("%s successfully initialized!\n", DEFAULT_CSV_NAME);
+void cmd_append_arg(char **line, size_t *len, char *arg) {
+    bool quote = !*arg || strpbrk(arg, " \t\"'") != NULL;
+    char q = strchr(arg, '"') != NULL ? '\'' : '"';
+    *line = realloc(*line, *len + strlen(arg) + 4);
+    if (*len > 0) (*line)[(*len)++] = ' ';
+    if (quote) (*line)[(*len)++] = q;
+    memcpy(*line + *len, arg, strlen(arg));
+    *len += strlen(arg);
+    if (quote) (*line)[(*len)++] = q;
+    (*line)[*len] = '\0';
 }
 
-void command_rm(int argc, char **args) {
-    // Vorgehen:
-    // 1. Neues tmp.csv anlegen
-    // 2. Lese für jede Zeile von cgrade.cs von cgrade.csvv:
-    // 2.1 Fach
-    // 2.2 Note
-    // 2.3 Wenn Fach & Note nicht der entspricht, die gelöscht werden sollte, soll NOTE;GRADE;{restliche zeile} in tmp.csv geschrieben werden
-    // 3. Remove cgrade.csv, rename tmp.csv to cgrade.csv
-    // Edge Cases:
-    // * 2 Mal gleiche Note in gleichem Fach vorhanden
-    // Command Structure:
-    // * cgrade rm algd2 5.25 1
-    char *subject = args[0];
-    char *grade = args[1];
-    int delete_index = 1;
-    if (argc > 2) {
-        delete_index = strtol(args[2], NULL,10);
-    }
-    
-    int read_fd = open(opt_default_csv, O_RDONLY);
-    int mode_t = S_IRUSR | S_IWUSR;
-    int write_fd = open(TMP_CSV_PATH, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, mode_t);
-
-    char *header = csv_read_to_next(read_fd, '\n');
-    csv_write_string(write_fd, header);
-    csv_write_string(write_fd, "\n");
-    char *pivot_subject = csv_read_to_next(read_fd, CSV_DELIMITER);
-    char *pivot_grade = csv_read_to_next(read_fd, CSV_DELIMITER);
-    char *pivot_comment = csv_read_to_next(read_fd, '\n');
-    char *buffer;
-    bool deleted = false;
-    int delete_position = 1;
-    while (strlen(pivot_subject) != 0) {
-        if (streq(grade, pivot_grade) && streq(subject, pivot_subject)) {
-            if (delete_index == delete_position) {
-                delete_position++;
-                deleted = true;
-                // skip the line to be removed
-                printf("skipping line")
-                pivot_subject = csv_read_to_next(read_fd, ';');
-                pivot_grade = csv_read_to_next(read_fd, ';');
-                pivot_comment = csv_read_to_next(read_fd, '\n');
-            }
+/**
+ * Sends a command to the server listening on opt_connect, prints
+ * its output and exits with its exit code. The csv path is sent as
+ * absolute path, so that it refers to the same file as it would
+ * without --connect.
+ *
+ * arg(argc)   size of args
+ * arg(args)   the command and its arguments
+ */
+void command_connect(int argc, char **args) {
+    char *csv;
+    if (opt_default_csv[0] == '/') {
+        csv = strdup(opt_default_csv);
+    } else {
+        char *cwd = getcwd(NULL, 0);
+        if (cwd == NULL) cmd_exit_errno("getcwd failed");
+        csv = malloc(strlen(cwd) + strlen(opt_default_csv) + 2);
+        sprintf(csv, "%s/%s", cwd, opt_default_csv);
+        free(cwd);
+    }
+    char *line = NULL;
+    size_t len = 0;
+    cmd_append_arg(&line, &len, OPT_NAME_CSV);
+    cmd_append_arg(&line, &len, csv);
+    for (int i = 0; i < argc; i++) {
+        if (strchr(args[i], '\n') != NULL) {
+            fprintf(cmd_out, "arguments must not contain newlines\n");
+            cmd_exit(1);
         }
-        csv_write_string(write_fd, pivot_subject);
-        csv_write_string(write_fd, ";");
-        csv_write_string(write_fd, pivot_grade);
-        csv_write_string(write_fd, ";");
-        csv_write_string(write_fd, pivot_comment);
-        csv_write_string(write_fd, "\n");
+        cmd_append_arg(&line, &len, args[i]);
+    }
+    line[len++] = '\n';
+    free(csv);
 
-        pivot_subject = csv_read_to_next(read_fd, ';');
-        pivot_grade = csv_read_to_next(read_fd, ';');
-        pivot_comment = csv_read_to_next(read_fd, '\n');
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, opt_connect, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd == -1) cmd_exit_errno("socket failed");
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == -1) cmd_exit_errno("connect failed");
+    for (size_t off = 0; off < len; ) {
+        ssize_t n = write(fd, line + off, len - off);
+        if (n == -1) cmd_exit_errno("send request failed");
+        off += n;
     }
-    
-    /*buffer = csv_read_to_next(read_fd, '\n');
-    while (strlen(buffer) != 0) {
-        csv_write_string(write_fd, buffer);
-        csv_write_string(write_fd, "\n");
-        buffer = csv_read_to_next(read_fd, '\n');
-    }*/
+    free(line);
 
-    if (remove(opt_default_csv) == -1) {
-        printerrno("failed to remove csv");
+    CsvReader r;
+    csv_reader_init(&r, fd);
+    const char *line_view;
+    size_t line_len;
+    char head[64] = "";
+    if (csv_reader_line(&r, &line_view, &line_len) && line_len < sizeof(head)) {
+        memcpy(head, line_view, line_len);
+        head[line_len] = '\0';
+    }
+    int code;
+    size_t body_len;
+    if (sscanf(head, "%d %zu", &code, &body_len) != 2) {
+        fprintf(cmd_out, "invalid response from %s\n", opt_connect);
+        cmd_exit(1);
     }
-    if (rename(TMP_CSV_PATH, opt_default_csv) != 0) {
-        printerrno("failed to rename tmp csv");
+    while (body_len > 0 && csv_reader_fill(&r)) {
+        size_t n = r.len - r.pos < body_len ? r.len - r.pos : body_len;
+        fwrite(r.buf + r.pos, 1, n, cmd_out);
+        r.pos += n;
+        body_len -= n;
+    }
+    csv_reader_free(&r);
+    close(fd);
+    fflush(cmd_out);
+    cmd_exit(code);
+}
+
+int cmd_process_option_connect(int length, char **cmd) {
+    if (length < 2) cmd_exit_usage_missing_value(cmd[0]);
+    if (serving) {
+        fprintf(cmd_out, "%s is not available on the server\n", OPT_NAME_CONNECT);
+        cmd_exit(1);
     }
+    opt_connect = cmd[1];
+    return 2;
+}
+
+/**
+ * Enables profiling, an optional value selects the report format.
+ * returns the number of cmd items processed
+ */
+int cmd_process_option_profile(int length, char **cmd) {
+    bool json = length > 1 && streq(cmd[1], "json");
+    bool text = length > 1 && streq(cmd[1], "text");
+    profile_enable(json);
+    return json || text ? 2 : 1;
 }
 
 int cmd_process_option_csv(int length, char **cmd) {
+    if (length < 2) cmd_exit_usage_missing_value(cmd[0]);
+    if (session_gb != NULL && !streq(opt_default_csv, cmd[1])) {
+        fprintf(cmd_out, "%s can not be changed in a session\n", OPT_NAME_CSV);
+        cmd_exit(1);
+    }
     opt_default_csv = cmd[1]; 
+    if (n_opt_csvs == cap_opt_csvs) {
+        cap_opt_csvs = cap_opt_csvs ? cap_opt_csvs * 2 : 4;
+        opt_csvs = (char **) realloc(opt_csvs, sizeof(char *) * cap_opt_csvs);
+    }
+    opt_csvs[n_opt_csvs++] = cmd[1];
     return 2;
 }
 
@@ -473,6 +6104,10 @@ int cmd_process_option(int length, char **cmd) {
     char *opt = cmd[0];
     if (streq(OPT_NAME_CSV, opt)) {
         return cmd_process_option_csv(length, cmd);
+    } else if (streq(OPT_NAME_PROFILE, opt)) {
+        return cmd_process_option_profile(length, cmd);
+    } else if (streq(OPT_NAME_CONNECT, opt)) {
+        return cmd_process_option_connect(length, cmd);
     } else if (streq(OPT_NAME_HELP, opt)) {
         exit_usage(0);
     } else {
@@ -486,14 +6121,24 @@ void command(int argc, char **argv) {
     argc--;
     if (argc < 1) exit_usage(-1);
 
-    while (cmd_is_option(argv[0])) { 
+    n_opt_csvs = 0;
+    while (argc > 0 && cmd_is_option(argv[0])) { 
         int processed = cmd_process_option(argc, argv);
         argc -= processed;
         argv += processed;
     }
+    if (argc < 1) exit_usage(-1);
+    if (opt_connect != NULL) {
+        command_connect(argc, argv);
+        return;
+    }
 
     //argv = cmd_skip_options(&argc, argv); 
     char *cmd = argv[0];
+    if (!streq(cmd, CMD_NAME_STATUS) && csv_multi_input()) {
+        fprintf(cmd_out, "several grade books are only supported by %s\n", CMD_NAME_STATUS);
+        cmd_exit(1);
+    }
     if (strcmp(cmd, CMD_NAME_ADD) == 0) {
         command_add(argc-1, argv+1);
     } else if (strcmp(cmd, CMD_NAME_STATUS) == 0) {
@@ -502,6 +6147,16 @@ void command(int argc, char **argv) {
         command_rm(argc-1, argv+1);
     } else if (streq(cmd, CMD_NAME_INIT)) {
         command_init(argc-1, argv+1);
+    } else if (streq(cmd, CMD_NAME_SHELL) || streq(cmd, CMD_NAME_BATCH)) {
+        command_session(streq(cmd, CMD_NAME_SHELL));
+    } else if (streq(cmd, CMD_NAME_SYNC)) {
+        command_sync();
+    } else if (streq(cmd, CMD_NAME_SERVE)) {
+        command_serve(argc-1, argv+1);
+    } else if (streq(cmd, CMD_NAME_CONVERT)) {
+        command_convert(argc-1, argv+1);
+    } else if (streq(cmd, CMD_NAME_COMPACT)) {
+        command_compact(argc-1, argv+1);
     } else {
         exit_unknown_cmd(cmd);
     }
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include "libs/ctoolbox.c"
+
+/*
+ * Benchmark suite of the cgrade program. Grade books of every
+ * requested size are generated, then every operation runs a number
+ * of times as its own cgrade process. Wall time (median and p95),
+ * rows per second and the peak RSS of the process are reported as
+ * tab separated values, one line per operation and size, so runs of
+ * different commits can be diffed.
+ *
+ * usage: cgrade_bench [--rows N[,N...]] [--subjects N] [--comment-len N] [--runs N] [--cgrade PATH]
+ *        cgrade_bench --gen FILE ROWS [SUBJECTS [COMMENT_LEN]]
+ */
+
+#define BENCH_DEFAULT_ROWS "1000,100000,1000000"
+#define BENCH_DEFAULT_SUBJECTS 40
+#define BENCH_DEFAULT_COMMENT_LEN 16
+#define BENCH_DEFAULT_RUNS 5
+#define BENCH_DEFAULT_CGRADE "./out/cgrade"
+#define BENCH_SUBJECT "subject1"
+#define BENCH_MAX_ARGS 16
+
+static char *bench_cgrade = BENCH_DEFAULT_CGRADE;
+static int bench_runs = BENCH_DEFAULT_RUNS;
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Writes a csv with rows grades spread over n_subjects subjects.
+ * Grades are quarter steps between 1 and 6, every comment has
+ * comment_len characters. The output only depends on the arguments.
+ */
+static void bench_generate(char *path, long rows, int n_subjects, int comment_len) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) printerrno("open file failed");
+    setvbuf(f, NULL, _IOFBF, 1 << 20);
+    char *comment = malloc(comment_len + 1);
+    for (int i = 0; i < comment_len; i++) comment[i] = 'a' + i % 26;
+    comment[comment_len] = '\0';
+    uint64_t x = 88172645463325252ull; // xorshift64
+    fprintf(f, "subject;grade;comment\n");
+    for (long i = 0; i < rows; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        int grade = 100 + (x >> 32) % 21 * 25;
+        fprintf(f, "subject%d;%d.%02d;%s\n", (int) (x % n_subjects), grade / 100, grade % 100, comment);
+    }
+    free(comment);
+    if (fclose(f) != 0) printerrno("write failed");
+}
+
+static void bench_copy(char *from, char *to) {
+    int in = open(from, O_RDONLY);
+    int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (in == -1 || out == -1) printerrno("open file failed");
+    char *buf = malloc(1 << 20);
+    ssize_t n;
+    while ((n = read(in, buf, 1 << 20)) > 0) {
+        if (write(out, buf, n) != n) printerrno("write failed");
+    }
+    if (n == -1) printerrno("read failed");
+    free(buf);
+    close(in);
+    close(out);
+}
+
+/**
+ * Runs cgrade with the given arguments, its output is discarded.
+ * arg(o_rss_kb) output parameter, the peak RSS of the process
+ * returns the wall time in seconds
+ */
+static double bench_exec(char **args, long *o_rss_kb) {
+    double start = bench_now();
+    pid_t pid = fork();
+    if (pid == -1) printerrno("fork failed");
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execv(bench_cgrade, args);
+        _exit(127);
+    }
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) == -1) printerrno("wait failed");
+    double secs = bench_now() - start;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) {
+        fprintf(stderr, "%s could not be run\n", bench_cgrade);
+        exit(1);
+    }
+    *o_rss_kb = ru.ru_maxrss;
+    return secs;
+}
+
+static int bench_cmp(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * Removes a csv and the files cgrade keeps next to it (stats
+ * sidecar, delete log, time index). A csv created again can get the
+ * same inode, which would make old ones look valid.
+ */
+static void bench_remove_csv(char *csv) {
+    char *suffixes[] = { "", ".idx", ".del", ".tix" };
+    char path[300];
+    for (int i = 0; i < 4; i++) {
+        snprintf(path, sizeof(path), "%s%s", csv, suffixes[i]);
+        unlink(path);
+    }
+}
+
+/**
+ * Times an operation bench_runs times and prints its result line.
+ * Before every run the working csv is reset to a copy of the
+ * generated one (untimed), so every run sees the same input.
+ * arg(op)     name of the operation in the output
+ * arg(rows)   number of rows of the grade book
+ * arg(source) the generated csv or NULL if the csv must not exist
+ * arg(csv)    the working csv the command runs on
+ * arg(cmd)    the cgrade arguments following --csv csv, NULL terminated
+ */
+static void bench_op(char *op, long rows, char *source, char *csv, char **cmd) {
+    char *args[BENCH_MAX_ARGS];
+    int n = 0;
+    args[n++] = "cgrade";
+    args[n++] = "--csv";
+    args[n++] = csv;
+    for (; *cmd != NULL && n < BENCH_MAX_ARGS - 1; cmd++) args[n++] = *cmd;
+    args[n] = NULL;
+
+    double *times = malloc(sizeof(double) * bench_runs);
+    long max_rss = 0;
+    for (int i = 0; i < bench_runs; i++) {
+        bench_remove_csv(csv);
+        if (source != NULL) bench_copy(source, csv);
+        long rss;
+        times[i] = bench_exec(args, &rss);
+        if (rss > max_rss) max_rss = rss;
+    }
+    qsort(times, bench_runs, sizeof(double), bench_cmp);
+    double median = times[bench_runs / 2];
+    double p95 = times[(bench_runs * 95 + 99) / 100 - 1];
+    printf("%s\t%ld\t%d\t%.3f\t%.3f\t%.0f\t%ld\n", op, rows, bench_runs,
+           median * 1000, p95 * 1000, rows / median, max_rss);
+    fflush(stdout);
+    free(times);
+}
+
+static void bench_size(char *dir, long rows, int n_subjects, int comment_len) {
+    char source[256];
+    char csv[256];
+    snprintf(source, sizeof(source), "%s/gen.csv", dir);
+    snprintf(csv, sizeof(csv), "%s/cgrade.csv", dir);
+    bench_generate(source, rows, n_subjects, comment_len);
+
+    char *init[] = { "init", NULL };
+    char *add[] = { "add", BENCH_SUBJECT, "4.5", "bench", NULL };
+    char *status[] = { "status", NULL };
+    char *status_subject[] = { "status", BENCH_SUBJECT, NULL };
+    char *status_all[] = { "status", "--all", NULL };
+    char *status_stats[] = { "status", "--stats", NULL };
+    char *rm_last[] = { "rm", NULL };
+    char *rm_first[] = { "rm", BENCH_SUBJECT, "1.00", NULL };
+    if (rows == 0) bench_op("init", rows, NULL, csv, init);
+    bench_op("add", rows, source, csv, add);
+    bench_op("status", rows, source, csv, status);
+    bench_op("status_subject", rows, source, csv, status_subject);
+    bench_op("status_all", rows, source, csv, status_all);
+    bench_op("status_stats", rows, source, csv, status_stats);
+    bench_op("rm_last", rows, source, csv, rm_last);
+    bench_op("rm_subject", rows, source, csv, rm_first);
+
+    unlink(source);
+    bench_remove_csv(csv);
+}
+
+int main(int argc, char **argv) {
+    if (argc > 2 && streq(argv[1], "--gen")) {
+        bench_generate(argv[2], atol(argc > 3 ? argv[3] : "1000"),
+                       argc > 4 ? atoi(argv[4]) : BENCH_DEFAULT_SUBJECTS,
+                       argc > 5 ? atoi(argv[5]) : BENCH_DEFAULT_COMMENT_LEN);
+        return 0;
+    }
+    char *rows = BENCH_DEFAULT_ROWS;
+    int n_subjects = BENCH_DEFAULT_SUBJECTS;
+    int comment_len = BENCH_DEFAULT_COMMENT_LEN;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (streq(argv[i], "--rows")) rows = argv[i + 1];
+        else if (streq(argv[i], "--subjects")) n_subjects = atoi(argv[i + 1]);
+        else if (streq(argv[i], "--comment-len")) comment_len = atoi(argv[i + 1]);
+        else if (streq(argv[i], "--runs")) bench_runs = atoi(argv[i + 1]);
+        else if (streq(argv[i], "--cgrade")) bench_cgrade = argv[i + 1];
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (n_subjects < 1 || comment_len < 0 || bench_runs < 1) {
+        fprintf(stderr, "invalid arguments\n");
+        return 1;
+    }
+    char dir[] = "/tmp/cgrade_bench.XXXXXX";
+    if (mkdtemp(dir) == NULL) printerrno("mkdtemp failed");
+
+    printf("# cgrade bench subjects=%d comment_len=%d runs=%d\n", n_subjects, comment_len, bench_runs);
+    printf("op\trows\truns\tmedian_ms\tp95_ms\trows_per_s\tmax_rss_kb\n");
+    bench_size(dir, 0, n_subjects, comment_len);
+    char *list = strdup(rows);
+    for (char *tok = strtok(list, ","); tok != NULL; tok = strtok(NULL, ",")) {
+        bench_size(dir, atol(tok), n_subjects, comment_len);
+    }
+    free(list);
+    rmdir(dir);
+    return 0;
+}
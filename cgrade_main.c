@@ -1,8 +1,5 @@
-#include <string.h>
-#include "cgrade.c"
+#include "libcgrade.h"
 
 int main(int argc, char *argv[]) {
-    command(argc, argv);
-    return 0;
+    return cgrade_run(argc, argv);
 }
-
@@ -0,0 +1,83 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cgrade.c"
+
+/*
+ * Microbenchmark of the structural index kernels against the
+ * char by char loop that csv_read_to_next used to run.
+ *
+ * usage: cgrade_scan_bench [MEGABYTES]
+ */
+
+#define BENCH_DEFAULT_MB 64
+#define BENCH_RUNS 5
+
+/**
+ * Char by char scan as done by the old csv_read_to_next: every
+ * byte is compared against the terminators one at a time.
+ */
+static size_t bench_bytewise(const char *buf, size_t len, uint32_t *positions) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        char c = buf[i];
+        if (c == CSV_DELIMITER) positions[n++] = i;
+        else if (c == '\n') positions[n++] = i;
+    }
+    return n;
+}
+
+static double bench_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Runs a kernel block by block over buf and prints the best
+ * throughput of BENCH_RUNS runs.
+ */
+static void bench_kernel(char *name, size_t (*kernel)(const char *, size_t, uint32_t *),
+                         const char *buf, size_t len, uint32_t *positions) {
+    double best = 0;
+    size_t total = 0;
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        total = 0;
+        double start = bench_now();
+        for (size_t off = 0; off < len; off += CSV_INDEX_BLOCK) {
+            size_t n = len - off < CSV_INDEX_BLOCK ? len - off : CSV_INDEX_BLOCK;
+            total += kernel(buf + off, n, positions);
+        }
+        double secs = bench_now() - start;
+        double mbs = len / secs / (1024 * 1024);
+        if (mbs > best) best = mbs;
+    }
+    printf("%-10s %10.0f MB/s %12zu structurals\n", name, best, total);
+}
+
+int main(int argc, char **argv) {
+    size_t mb = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_MB;
+    size_t len = mb * 1024 * 1024;
+    char *buf = malloc(len);
+    size_t off = 0;
+    for (int i = 0; off < len; i++) {
+        char row[128];
+        int n = snprintf(row, sizeof(row), "subject%d;%d.%d;comment number %d\n", i % 40, 1 + i % 6, i % 10, i);
+        if (off + n > len) n = len - off;
+        memcpy(buf + off, row, n);
+        off += n;
+    }
+    uint32_t *positions = malloc(sizeof(uint32_t) * CSV_INDEX_BLOCK);
+
+    printf("scanning %zu MB in blocks of %d bytes\n", mb, CSV_INDEX_BLOCK);
+    bench_kernel("bytewise", bench_bytewise, buf, len, positions);
+    bench_kernel("scalar", csv_index_scalar, buf, len, positions);
+#ifdef CSV_INDEX_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) bench_kernel("sse2", csv_index_sse2, buf, len, positions);
+    if (__builtin_cpu_supports("avx2")) bench_kernel("avx2", csv_index_avx2, buf, len, positions);
+#endif
+    free(positions);
+    free(buf);
+    return 0;
+}
@@ -0,0 +1,125 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/wait.h>
+#include "cgrade.c"
+
+/*
+ * Stress test of concurrent writers. WRITERS processes append ROWS
+ * grades each to the same csv while REMOVERS processes repeatedly
+ * add and remove a grade (which rewrites the csv). Afterwards every
+ * line of the csv is checked: a line that does not look like a row
+ * written by a writer is torn, a row of a writer that is not found
+ * is missing.
+ *
+ * usage: cgrade_stress [WRITERS] [ROWS] [REMOVERS]
+ */
+
+#define STRESS_CSV "./cgrade_stress.csv"
+#define STRESS_DEFAULT_WRITERS 8
+#define STRESS_DEFAULT_ROWS 2000
+#define STRESS_DEFAULT_REMOVERS 1
+#define STRESS_GRADE "4.5"
+#define STRESS_REMOVER_SUBJECT "remover"
+
+static double stress_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void stress_writer(int id, int rows) {
+    char subject[32];
+    char comment[32];
+    snprintf(subject, sizeof(subject), "w%d", id);
+    for (int i = 0; i < rows; i++) {
+        snprintf(comment, sizeof(comment), "%d", i);
+        char *argv[] = { APP_NAME, CMD_NAME_ADD, subject, STRESS_GRADE, comment };
+        command(5, argv);
+    }
+}
+
+static void stress_remover(int id, int rows) {
+    char subject[32];
+    snprintf(subject, sizeof(subject), "%s%d", STRESS_REMOVER_SUBJECT, id);
+    for (int i = 0; i < rows; i++) {
+        char *add[] = { APP_NAME, CMD_NAME_ADD, subject, STRESS_GRADE };
+        command(4, add);
+        char *rm[] = { APP_NAME, CMD_NAME_RM, subject, STRESS_GRADE };
+        command(4, rm);
+    }
+}
+
+/**
+ * Checks the csv written by the writers.
+ * arg(o_missing) output parameter, number of rows that are missing
+ * returns the number of torn lines
+ */
+static int stress_verify(int writers, int rows, int *o_missing) {
+    int fd = open(STRESS_CSV, O_RDONLY);
+    if (fd == -1) printerrno("open file failed");
+    CsvMap m;
+    int torn = 0;
+    char *seen = calloc((size_t) writers * rows, 1);
+    if (csv_map_open(&m, fd)) {
+        size_t pos = 0;
+        CsvField s, g, c;
+        csv_map_next_row(&m, &pos, &s, &g, &c);
+        if (!csv_field_eq(s, "subject") || !csv_field_eq(g, "grade")) torn++;
+        while (csv_map_next_row(&m, &pos, &s, &g, &c)) {
+            if (s.len > strlen(STRESS_REMOVER_SUBJECT) && memcmp(s.ptr, STRESS_REMOVER_SUBJECT, strlen(STRESS_REMOVER_SUBJECT)) == 0) continue;
+            char line[64];
+            int len = c.ptr + c.len - s.ptr;
+            if (len > sizeof(line) - 1) len = sizeof(line) - 1;
+            memcpy(line, s.ptr, len);
+            line[len] = '\0';
+            int id, row, n = 0;
+            bool valid = sscanf(line, "w%d;" STRESS_GRADE ";%d%n", &id, &row, &n) == 2 && n == len
+                && id >= 0 && id < writers && row >= 0 && row < rows && !seen[(size_t) id * rows + row];
+            if (valid) seen[(size_t) id * rows + row] = 1;
+            else torn++;
+        }
+        csv_map_close(&m);
+    }
+    close(fd);
+    *o_missing = 0;
+    for (size_t i = 0; i < (size_t) writers * rows; i++) *o_missing += !seen[i];
+    free(seen);
+    return torn;
+}
+
+int main(int argc, char **argv) {
+    int writers = argc > 1 ? atoi(argv[1]) : STRESS_DEFAULT_WRITERS;
+    int rows = argc > 2 ? atoi(argv[2]) : STRESS_DEFAULT_ROWS;
+    int removers = argc > 3 ? atoi(argv[3]) : STRESS_DEFAULT_REMOVERS;
+    opt_default_csv = STRESS_CSV;
+    unlink(STRESS_CSV);
+    csv_init_file(STRESS_CSV, false);
+
+    double start = stress_now();
+    for (int i = 0; i < writers + removers; i++) {
+        pid_t pid = fork();
+        if (pid == -1) printerrno("fork failed");
+        if (pid == 0) {
+            cmd_out_file = fopen("/dev/null", "w");
+            if (i < writers) stress_writer(i, rows);
+            else stress_remover(i - writers, rows / 10);
+            exit(0);
+        }
+    }
+    int failed = 0;
+    int status;
+    while (wait(&status) > 0) {
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    double secs = stress_now() - start;
+
+    int missing;
+    int torn = stress_verify(writers, rows, &missing);
+    printf("%d writers x %d rows, %d removers: %.0f rows/s\n", writers, rows, removers, writers * rows / secs);
+    printf("torn lines: %d, missing rows: %d, failed processes: %d\n", torn, missing, failed);
+    unlink(STRESS_CSV);
+    stats_sidecar_remove(STRESS_CSV);
+    csv_dead_remove(STRESS_CSV);
+    return torn > 0 || missing > 0 || failed > 0;
+}
@@ -1,7 +1,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "libs/ctest.h"
-#include "cgrade.c"
+#include "libcgrade.c"
 #include <stdio.h>
 #include <unistd.h>
 
@@ -28,19 +28,226 @@ static int test_csv_create(char *content) {
 }
 
 /**
- * Deletes the test csv file.
+ * Deletes the test csv file and its delete log.
  */
 static void test_csv_delete() {
 	if (remove(TEST_CSV_FILE) == -1) {
 		printerrno("deleting test csv failed");
 	}
+	csv_dead_remove(TEST_CSV_FILE);
+}
+
+/**
+ * Reads the whole test csv file into a heap allocated string.
+ */
+static char *test_csv_content() {
+    int fd = open(TEST_CSV_FILE, O_RDONLY);
+    struct stat st;
+    fstat(fd, &st);
+    char *content = malloc(st.st_size + 1);
+    ssize_t n = read(fd, content, st.st_size);
+    content[n < 0 ? 0 : n] = '\0';
+    close(fd);
+    return content;
 }
 
 static int test_command_rm() {
-	/*int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nmath;5.2;Second Exam\nmath;4.6;Third Exam\n");
-	char *cmd[] = {"math", "5.2"};
-	command_rm(2, cmd);*/
-	return 1;
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nmath;5.2;Second Exam\nmath;4.6;Third Exam\n");
+    close(fd);
+    opt_default_csv = TEST_CSV_FILE;
+    char *cmd[] = {"math", "5.2", "1"};
+    command_rm(3, cmd);
+    char *content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;5.2;First Exam\nmath;4.6;Third Exam\n"));
+    free(content);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_csv_remove_rows() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5;a\nmath;5;b\nbio;4;\nmath;5;c\n");
+    close(fd);
+    RmTarget targets[] = {
+        { "math", "5", 2, 0, false },
+        { "math", "5", 0, 0, false },
+        { "bio", "4", 1, 0, false },
+    };
+    assrt(csv_remove_rows(TEST_CSV_FILE, targets, 3) == 2);
+    assrt(targets[0].removed && targets[1].removed && !targets[2].removed);
+    char *content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;5;b\nbio;4;\n"));
+    free(content);
+
+    // targets of the same grade count the rows before the removal
+    fd = test_csv_create("subject;grade;comment\nmath;5;a\nmath;5;b\nbio;4;\nmath;5;c\n");
+    close(fd);
+    RmTarget ascending[] = {
+        { "math", "5", 0, 0, false },
+        { "math", "5", 1, 0, false },
+    };
+    assrt(csv_remove_rows(TEST_CSV_FILE, ascending, 2) == 2);
+    assrt(ascending[0].removed && ascending[1].removed);
+    csv_compact(TEST_CSV_FILE);
+    content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nbio;4;\nmath;5;c\n"));
+    free(content);
+    fd = test_csv_create("subject;grade;comment\nmath;5;b\nbio;4;\n");
+    close(fd);
+
+    // a repeated target refers to the same row
+    RmTarget twice[] = {
+        { "math", "5", 0, 0, false },
+        { "math", "5", 0, 0, false },
+    };
+    assrt(csv_remove_rows(TEST_CSV_FILE, twice, 2) == 1);
+    assrt(twice[0].removed && !twice[1].removed);
+    assrt(csv_compact(TEST_CSV_FILE) == 1);
+    content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nbio;4;\n"));
+    free(content);
+
+    char *line;
+    csv_remove_last_row(TEST_CSV_FILE, &line);
+    assrt(streq(line, "bio;4;"));
+    csv_remove_last_row(TEST_CSV_FILE, &line);
+    csv_remove_last_row(TEST_CSV_FILE, &line);
+    assrt(line == NULL);
+    arena_free(&cmd_arena);
+    content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\n"));
+    free(content);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_csv_dead() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5;a\nmath;5;b\nbio;4;\nmath;5;c\n");
+    for (int i = 0; i < 20; i++) write(fd, "physics;4.5;long enough to defer compaction\n", 44);
+    close(fd);
+    char *before = test_csv_content();
+
+    // rm only appends to the delete log, indexes skip deleted rows
+    RmTarget first[] = { { "math", "5", 1, 0, false } };
+    assrt(csv_remove_rows(TEST_CSV_FILE, first, 1) == 1);
+    RmTarget second[] = { { "math", "5", 1, 0, false } };
+    assrt(csv_remove_rows(TEST_CSV_FILE, second, 1) == 1);
+    char *content = test_csv_content();
+    assrt(streq(content, before));
+    free(content);
+    assrt(access(TEST_CSV_FILE DEL_SUFFIX, F_OK) == 0);
+
+    GradeBook gb;
+    gradebook_init(&gb, true);
+    gradebook_load(&gb, TEST_CSV_FILE);
+    Subject *math = gradebook_subject(&gb, "math", 4, false);
+    assrt(math->n_grades == 1);
+    assrt(streq(math->comments[0], "a"));
+    gradebook_free(&gb);
+
+    fd = open(TEST_CSV_FILE, O_RDONLY);
+    StatsTable t;
+    stats_table_init(&t);
+    csv_stats_cached(TEST_CSV_FILE, fd, &t, 1);
+    assrt(stats_table_get(&t, "math", 4)->count == 1);
+    assrt(stats_table_get(&t, "physics", 7)->count == 20);
+    stats_table_free(&t);
+    close(fd);
+
+    // rm last removes the last live row and the deleted rows behind it
+    RmTarget last[] = { { "physics", "4.5", 19, 0, false } };
+    assrt(csv_remove_rows(TEST_CSV_FILE, last, 1) == 1);
+    char *line;
+    csv_remove_last_row(TEST_CSV_FILE, &line);
+    assrt(streq(line, "physics;4.5;long enough to defer compaction"));
+    arena_free(&cmd_arena);
+
+    assrt(csv_compact(TEST_CSV_FILE) == 2);
+    assrt(access(TEST_CSV_FILE DEL_SUFFIX, F_OK) == -1);
+    content = test_csv_content();
+    assrt(strncmp(content, "subject;grade;comment\nmath;5;a\nbio;4;\nphysics;4.5;", 50) == 0);
+    assrt(strlen(content) == strlen(before) - 18 - 2 * 44);
+    free(content);
+    free(before);
+    assrt(csv_compact(TEST_CSV_FILE) == 0);
+    test_csv_delete();
+    stats_sidecar_remove(TEST_CSV_FILE);
+    return 1;
+}
+
+static int test_command_add_bulk() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\n");
+    close(fd);
+    opt_default_csv = TEST_CSV_FILE;
+    int in = open("./test_cgrade_in.csv", O_RDWR | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    char *records = "subject;grade;comment\nphysics;4.5;Lab\n\nbio;6\n";
+    write(in, records, strlen(records));
+    lseek(in, 0, SEEK_SET);
+    command_add_bulk(in);
+    close(in);
+    remove("./test_cgrade_in.csv");
+    char *content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;Lab\nbio;6;\n"));
+    free(content);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_grade_parse() {
+    grade_t g;
+    char buf[GRADE_FORMAT_SIZE];
+    assrt(grade_parse("5", 1, &g) && g == 500);
+    assrt(grade_parse("4.5", 3, &g) && g == 450);
+    assrt(grade_parse("4.75", 4, &g) && g == 475);
+    assrt(grade_parse("0.05", 4, &g) && g == 5);
+    assrt(grade_parse("6;", 1, &g) && g == 600);
+    assrt(!grade_parse("", 0, &g));
+    assrt(!grade_parse("4.", 2, &g));
+    assrt(!grade_parse(".5", 2, &g));
+    assrt(!grade_parse("4.125", 5, &g));
+    assrt(!grade_parse("-4", 2, &g));
+    assrt(!grade_parse("4e1", 3, &g));
+    assrt(!grade_parse(" 4", 2, &g));
+    assrt(!grade_parse("4,5", 3, &g));
+    assrt(!grade_parse("12345678", 8, &g));
+    assrt(streq(grade_format(475, buf), "4.75"));
+    assrt(streq(grade_format(5, buf), "0.05"));
+    assrt(streq(grade_format(600, buf), "6.00"));
+    assrt(grade_valid("4.5") && !grade_valid("0") && !grade_valid("abc"));
+    assrt(grade_read("4.5", 3, &g) && g == 450);
+    assrt(grade_read("5.125", 5, &g) && g == 513);
+    assrt(grade_read("5.1249", 6, &g) && g == 512);
+    assrt(grade_read("9.999", 5, &g) && g == 1000);
+    assrt(!grade_read("5abc", 4, &g));
+    assrt(!grade_read("1e1", 3, &g));
+    assrt(!grade_read("5.12x", 5, &g));
+    assrt(!grade_valid("5.125"));
+    return 1;
+}
+
+static int test_csv_grades() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;\nmath;4.6;Third Exam\n");
+    lseek(fd, 0, SEEK_SET);
+    CsvReader r;
+    csv_reader_init(&r, fd);
+    int n;
+    grade_t *grades = csv_grades(&r, &n);
+    assrt(n == 3);
+    assrt(grades[0] == 520);
+    assrt(grades[1] == 450);
+    assrt(grades[2] == 460);
+    free(grades);
+
+    lseek(fd, 0, SEEK_SET);
+    csv_reader_free(&r);
+    csv_reader_init(&r, fd);
+    grades = csv_subject_grades(&r, "math", &n);
+    assrt(n == 2);
+    assrt(grades[1] == 460);
+    free(grades);
+    csv_reader_free(&r);
+    close(fd);
+    test_csv_delete();
+    return 1;
 }
 
 static int test_subject_create() {
@@ -51,6 +258,684 @@ static int test_subject_create() {
     return 1;
 }
 
+static int test_csv_map_grades() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5\nmath;4.6;Third;Exam");
+    CsvMap m;
+    assrt(csv_map_open(&m, fd));
+    int n;
+    grade_t *grades = csv_map_grades(&m, NULL, &n);
+    assrt(n == 3);
+    assrt(grades[1] == 450);
+    assrt(grades[2] == 460);
+    free(grades);
+    grades = csv_map_grades(&m, "math", &n);
+    assrt(n == 2);
+    assrt(grades[0] == 520);
+    free(grades);
+    csv_map_close(&m);
+    close(fd);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_gradebook() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;\nmath;4.6;Third;Exam\n");
+    close(fd);
+    GradeBook gb;
+    gradebook_init(&gb, true);
+    gradebook_load(&gb, TEST_CSV_FILE);
+    assrt(gb.n_rows == 3);
+    assrt(gb.n_subjects == 2);
+    Subject *math = gradebook_subject(&gb, "math", 4, false);
+    assrt(math->n_grades == 2);
+    assrt(math->rows[1] == 2);
+    assrt(streq(math->comments[1], "Third;Exam"));
+
+    gradebook_add(&gb, "physics", "5", "Lab");
+    gradebook_save(&gb, TEST_CSV_FILE);
+    char *content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;\nmath;4.6;Third;Exam\nphysics;5;Lab\n"));
+    free(content);
+
+    assrt(!gradebook_remove(&gb, "math", "4.5", 0));
+    assrt(gradebook_remove(&gb, "physics", "4.5", 0));
+    assrt(math->rows[1] == 1);
+    gradebook_save(&gb, TEST_CSV_FILE);
+    content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;5.2;First Exam\nmath;4.6;Third;Exam\nphysics;5;Lab\n"));
+    free(content);
+
+    // the strings of removed rows are dropped when the book is rewritten
+    char comment[200];
+    memset(comment, 'c', sizeof(comment) - 1);
+    comment[sizeof(comment) - 1] = '\0';
+    for (int i = 0; i < 1000; i++) gradebook_add(&gb, "bio", "4", comment);
+    gradebook_save(&gb, TEST_CSV_FILE);
+    assrt(gb.arena.head->next != NULL);
+    for (int i = 0; i < 1000; i++) assrt(gradebook_remove_last(&gb));
+    gradebook_save(&gb, TEST_CSV_FILE);
+    assrt(gb.arena.head != NULL && gb.arena.head->next == NULL);
+    math = gradebook_subject(&gb, "math", 4, false);
+    assrt(math != NULL && streq(math->name, "math") && streq(math->comments[1], "Third;Exam"));
+    content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;5.2;First Exam\nmath;4.6;Third;Exam\nphysics;5;Lab\n"));
+    free(content);
+
+    // a csv changed by someone else since the last save is not rewritten
+    fd = open(TEST_CSV_FILE, O_RDWR | O_APPEND);
+    assrt(gradebook_file_unchanged(&gb, TEST_CSV_FILE, fd));
+    write(fd, "bio;4;\n", 7);
+    assrt(!gradebook_file_unchanged(&gb, TEST_CSV_FILE, fd));
+    close(fd);
+    gradebook_free(&gb);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_bin_book() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;\nmath;4.6;Third;Exam\n");
+    close(fd);
+    GradeBook gb;
+    gradebook_init(&gb, true);
+    gradebook_load(&gb, TEST_CSV_FILE);
+    gb.binary = true;
+    gb.rewrite = true;
+    gradebook_save(&gb, TEST_CSV_FILE);
+    gradebook_free(&gb);
+    assrt(book_is_binary(TEST_CSV_FILE));
+
+    // appended rows become a new segment that reuses the dictionary
+    gradebook_init(&gb, true);
+    gradebook_add(&gb, "bio", "6", "");
+    gradebook_add(&gb, "math", "4", "Fourth");
+    gradebook_save(&gb, TEST_CSV_FILE);
+    gradebook_free(&gb);
+
+    fd = open(TEST_CSV_FILE, O_RDONLY);
+    CsvMap m;
+    bin_map_open(&m, fd);
+    StatsTable t;
+    stats_table_init(&t);
+    bin_stats(&m, &t, NULL);
+    assrt(t.n == 3);
+    assrt(streq(t.stats[0].name, "math"));
+    assrt(t.stats[0].count == 3);
+    assrt(t.stats[0].sum == 520 + 460 + 400);
+    assrt(t.stats[2].max == 600);
+    stats_table_free(&t);
+    csv_map_close(&m);
+    close(fd);
+
+    gradebook_init(&gb, true);
+    gradebook_load(&gb, TEST_CSV_FILE);
+    assrt(gb.binary);
+    assrt(gb.n_rows == 5);
+    assrt(gb.n_subjects == 3);
+    Subject *math = gradebook_subject(&gb, "math", 4, false);
+    assrt(math->rows[2] == 4);
+    assrt(streq(math->comments[1], "Third;Exam"));
+    assrt(streq(math->comments[2], "Fourth"));
+    assrt(gradebook_remove(&gb, "math", "5.20", 0));
+    assrt(gradebook_remove(&gb, "physics", "4.5", 0));
+    gb.binary = false;
+    gradebook_save(&gb, TEST_CSV_FILE);
+    gradebook_free(&gb);
+    char *content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;4.60;Third;Exam\nbio;6.00;\nmath;4.00;Fourth\n"));
+    free(content);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_csv_init_file() {
+    mode_t mask = umask(027);
+    assrt(csv_init_file(TEST_CSV_FILE, false));
+    umask(mask);
+    struct stat st;
+    assrt(stat(TEST_CSV_FILE, &st) == 0 && (st.st_mode & 0777) == 0640);
+    assrt(!csv_init_file(TEST_CSV_FILE, true));
+    char *content = test_csv_content();
+    assrt(streq(content, CSV_HEADER "\n"));
+    free(content);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_command_convert() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;\n");
+    close(fd);
+    char *out;
+    size_t len;
+    cmd_out_file = open_memstream(&out, &len);
+    opt_default_csv = TEST_CSV_FILE;
+    char *to_bin[] = { "--to", "bin", "--out", "./test_cgrade.bin" };
+    command_convert(4, to_bin);
+    opt_default_csv = "./test_cgrade.bin";
+    char *to_csv[] = { "--to", "csv", "--out", "./test_cgrade_copy.csv" };
+    command_convert(4, to_csv);
+    opt_default_csv = TEST_CSV_FILE;
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    assrt(streq(out, "converted 2 grades to bin\nconverted 2 grades to csv\n"));
+    free(out);
+    assrt(book_is_binary("./test_cgrade.bin"));
+    fd = open("./test_cgrade_copy.csv", O_RDONLY);
+    char copy[64] = { 0 };
+    read(fd, copy, sizeof(copy) - 1);
+    close(fd);
+    assrt(streq(copy, "subject;grade;comment\nmath;5.20;First Exam\nphysics;4.50;\n"));
+    remove("./test_cgrade.bin");
+    remove("./test_cgrade_copy.csv");
+    test_csv_delete();
+
+    // a binary book can not keep the text of a malformed grade
+    char *book = "subject;grade;comment\nmath;abc;y\nmath;4;z\nbio;;w\n";
+    close(test_csv_create(book));
+    cmd_out_file = open_memstream(&out, &len);
+    jmp_buf jmp;
+    cmd_exit_jmp = &jmp;
+    char *in_place[] = { "--to", "bin" };
+    if (setjmp(jmp) == 0) command_convert(2, in_place);
+    cmd_exit_jmp = NULL;
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    assrt(cmd_exit_code == 1);
+    assrt(streq(out, "malformed grade 'abc' of math\nmalformed grade '' of bio\n"
+                "not converted, fix or remove the malformed grades first\n"));
+    free(out);
+    cmd_exit_code = 0;
+    char *content = test_csv_content();
+    assrt(streq(content, book));
+    free(content);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_status_malformed() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.125;x\nmath;4;y\nmath;5abc;z\n");
+    close(fd);
+    char *out;
+    size_t len;
+    cmd_out_file = open_memstream(&out, &len);
+    opt_default_csv = TEST_CSV_FILE;
+    command_status(0, NULL);
+    char *all[] = { "--all" };
+    command_status(1, all);
+    command_status(1, all); // from the sidecar
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    char *row = "Stats\nSubject           Count    Avg    Min    Max\n"
+        "math                  2   4.57   4.00   5.13\nAvg: 4.57\nSkipped 1 rows with malformed grades\n";
+    char expected[512];
+    snprintf(expected, sizeof(expected), "Stats\nGrades: 5.13, 4.00\nAvg: 4.57\n"
+             "Skipped 1 rows with malformed grades\n%s%s", row, row);
+    assrt(streq(out, expected));
+    free(out);
+    stats_sidecar_remove(TEST_CSV_FILE);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_csv_stats() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;\nmath;4.6;Third;Exam\n");
+    lseek(fd, 0, SEEK_SET);
+    StatsTable t;
+    stats_table_init(&t);
+    csv_stats(fd, &t, 0, 1, NULL, NULL);
+    assrt(t.n == 2);
+    assrt(streq(t.stats[0].name, "math"));
+    assrt(t.stats[0].count == 2);
+    assrt(t.stats[0].min == 460);
+    assrt(t.stats[0].max == 520);
+    assrt(t.stats[1].sum == 450);
+
+    char name[16];
+    for (int i = 0; i < 100; i++) {
+        sprintf(name, "s%d", i);
+        subject_stats_add(stats_table_get(&t, name, strlen(name)), i);
+    }
+    assrt(t.n == 102);
+    assrt(stats_table_get(&t, "s42", 3)->sum == 42);
+    assrt(stats_table_get(&t, "physics", 7)->count == 1);
+    stats_table_free(&t);
+    close(fd);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_grade_hist() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5;\nmath;4.5;\nbio;6;\nmath;3;\nmath;5.5;\nmath;12;\n");
+    StatsTable t;
+    stats_table_init(&t);
+    t.hist = true;
+    csv_stats(fd, &t, 0, 1, NULL, NULL);
+    SubjectStats *math = stats_table_get(&t, "math", 4);
+    assrt(math->count == 5);
+    assrt(grade_hist_kth(math->hist, 0) == 300);
+    assrt(grade_hist_kth(math->hist, 4) == 1200);
+    assrt(grade_hist_median(math->hist, math->count) == 500);
+    assrt(grade_hist_percentile(math->hist, math->count, 10) == 300);
+    assrt(grade_hist_percentile(math->hist, math->count, 90) == 1200);
+    assrt(math->hist->n_overflow == 1);
+
+    // the median of an even number of grades is the mean of the middle ones
+    GradeHist *h = grade_hist_create();
+    grade_hist_add(h, 450);
+    grade_hist_add(h, 475);
+    assrt(grade_hist_median(h, 2) == 462.5);
+    assrt(grade_hist_stddev(h, 2, 462.5) == 12.5);
+    grade_hist_merge(h, math->hist);
+    assrt(grade_hist_kth(h, 6) == 1200);
+    grade_hist_free(h);
+    stats_table_free(&t);
+    close(fd);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_profile() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;\n");
+    lseek(fd, 0, SEEK_SET);
+    profile.enabled = true; // without profile_enable, which would report at exit
+    profile.reads = 0;
+    profile.bytes_read = 0;
+    profile.allocs = 0;
+    CsvReader r;
+    csv_reader_init(&r, fd);
+    int n;
+    grade_t *grades = csv_grades(&r, &n);
+    profile_phase(PHASE_PARSE);
+    profile_phase(PHASE_OUTPUT);
+    profile.enabled = false;
+    assrt(profile.reads == 2); // one block and the end of file
+    assrt(profile.bytes_read == 32);
+    assrt(profile.allocs == 2); // read buffer and grade array, rows are views
+
+    assrt(profile.wall[PHASE_PARSE] >= 0);
+    assrt(profile.phase == PHASE_OUTPUT);
+    free(grades);
+    csv_reader_free(&r);
+    close(fd);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_csv_reader_next_row() {
+    size_t long_len = CSV_READER_BUF_SIZE * 2 + 10;
+    char *content = malloc(long_len + 64);
+    strcpy(content, "subject;grade;comment\nmath;5.2\nbio;4;");
+    size_t len = strlen(content);
+    memset(content + len, 'x', long_len);
+    strcpy(content + len + long_len, "\nlast;1;end");
+    int fd = test_csv_create(content);
+    lseek(fd, 0, SEEK_SET);
+    CsvReader r;
+    csv_reader_init(&r, fd);
+    CsvField s, g, c;
+    assrt(csv_reader_next_row(&r, &s, &g, &c) && csv_field_eq(c, "comment"));
+    assrt(csv_reader_next_row(&r, &s, &g, &c) && csv_field_eq(g, "5.2") && c.len == 0);
+    assrt(csv_reader_next_row(&r, &s, &g, &c) && csv_field_eq(s, "bio") && c.len == long_len);
+    assrt(c.ptr[0] == 'x' && c.ptr[long_len - 1] == 'x');
+    assrt(csv_reader_next_row(&r, &s, &g, &c) && csv_field_eq(s, "last") && csv_field_eq(c, "end"));
+    assrt(!csv_reader_next_row(&r, &s, &g, &c));
+    csv_reader_free(&r);
+    close(fd);
+    test_csv_delete();
+    free(content);
+    return 1;
+}
+
+static int test_arena() {
+    Arena a;
+    arena_init(&a);
+    char *name = arena_strndup(&a, "mathematics", 4);
+    assrt(streq(name, "math"));
+    long *n = arena_alloc(&a, sizeof(long));
+    assrt((uintptr_t) n % sizeof(void *) == 0);
+    char *big = arena_alloc(&a, ARENA_BLOCK_SIZE * 2);
+    big[ARENA_BLOCK_SIZE * 2 - 1] = 'x';
+    assrt(streq(name, "math"));
+    arena_free(&a);
+    assrt(a.head == NULL);
+    return 1;
+}
+
+static int test_out_table() {
+    char *out;
+    size_t len;
+    cmd_out_file = open_memstream(&out, &len);
+    OutBuf o;
+    out_init(&o);
+    char name[OUT_LINE_MAX + 100];
+    memset(name, 'x', sizeof(name) - 1);
+    name[sizeof(name) - 1] = '\0';
+    out_printf(&o, "%s;%d\n", name, 1);
+    const char *cols[] = { "subject", "comment" };
+    OutTable tab;
+    for (OutFormat f = OUT_CSV; f <= OUT_TSV; f++) {
+        out_table_begin(&tab, &o, f, cols, 2);
+        out_table_str(&tab, "ma\"th");
+        out_table_str(&tab, "a;b\tc\\d\ne");
+        out_table_end_row(&tab);
+        out_table_end(&tab);
+    }
+    out_free(&o);
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    assrt(memcmp(out, name, sizeof(name) - 1) == 0);
+    assrt(streq(out + sizeof(name) - 1, ";1\n"
+        "subject;comment\n\"ma\"\"th\";\"a;b\tc\\d\ne\"\n"
+        "subject\tcomment\nma\"th\ta;b\\tc\\\\d\\ne\n"));
+    free(out);
+    return 1;
+}
+
+static int test_status_format() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.5;\nbio;4;\nmath;4.25;\n");
+    close(fd);
+    opt_default_csv = TEST_CSV_FILE;
+    char *out;
+    size_t len;
+    cmd_out_file = open_memstream(&out, &len);
+    char *list[] = { "--format", "csv" };
+    command_status(2, list);
+    char *all[] = { "--all", "--format", "json" };
+    command_status(3, all);
+    char *summary[] = { "math", "--no-list", "--format", "tsv" };
+    command_status(4, summary);
+    char *text[] = { "--no-list" };
+    command_status(1, text);
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    assrt(streq(out,
+        "subject;grade\nmath;5.50\nbio;4.00\nmath;4.25\n"
+        "[\n{\"subject\":\"math\",\"count\":2,\"avg\":4.88,\"min\":4.25,\"max\":5.50},\n"
+        "{\"subject\":\"bio\",\"count\":1,\"avg\":4.00,\"min\":4.00,\"max\":4.00}\n]\n"
+        "subject\tcount\tavg\nmath\t2\t4.88\n"
+        "Stats\nCount: 3\nAvg: 4.58\n"));
+    free(out);
+    stats_sidecar_remove(TEST_CSV_FILE);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_status_files() {
+    mkdir("./test_cgrade_dir", S_IRWXU);
+    int fd = open("./test_cgrade_dir/a.csv", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    csv_write_string(fd, "subject;grade;comment\nmath;5;\nbio;4;\n");
+    close(fd);
+    fd = open("./test_cgrade_dir/b.csv", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    csv_write_string(fd, "subject;grade;comment\nmath;6;\n");
+    close(fd);
+    char *dir = "./test_cgrade_dir";
+    opt_csvs = &dir;
+    n_opt_csvs = 1;
+    assrt(csv_multi_input());
+    char *out;
+    size_t len;
+    cmd_out_file = open_memstream(&out, &len);
+    char *args[] = { "--format", "csv", "--threads", "2" };
+    command_status(4, args);
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    assrt(streq(out,
+        "file;subject;count;avg;min;max\n"
+        "./test_cgrade_dir/a.csv;;2;4.50;4.00;5.00\n"
+        "./test_cgrade_dir/b.csv;;1;6.00;6.00;6.00\n"
+        ";math;2;5.50;5.00;6.00\n"
+        ";bio;1;4.00;4.00;4.00\n"));
+    free(out);
+
+    // a large file is split into ranges, their subjects keep the file order
+    fd = open("./test_cgrade_dir/c.csv", O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+    CsvWriter w;
+    csv_writer_init(&w, fd);
+    csv_writer_write(&w, "subject;grade;comment\n", 22);
+    char row[64];
+    int rows = STATS_SPLIT_SIZE / 40 + STATS_TASK_SIZE / 40;
+    for (int i = 0; i < rows; i++) {
+        int n = snprintf(row, sizeof(row), "%s;%d;some comment of the row %07d\n", i == rows - 1 ? "late" : "bio", 1 + i % 5, i);
+        csv_writer_write(&w, row, n);
+    }
+    csv_writer_free(&w);
+    close(fd);
+    cmd_out_file = open_memstream(&out, &len);
+    char *stats[] = { "--stats", "--format", "csv", "--threads", "3" };
+    command_status(5, stats);
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    char expected[512];
+    snprintf(expected, sizeof(expected),
+        "file;subject;count;avg;min;max;median;p10;p90;stddev\n"
+        "./test_cgrade_dir/a.csv;;2;4.50;4.00;5.00;4.50;4.00;5.00;0.50\n"
+        "./test_cgrade_dir/b.csv;;1;6.00;6.00;6.00;6.00;6.00;6.00;0.00\n"
+        "./test_cgrade_dir/c.csv;;%d;3.00;1.00;5.00;3.00;1.00;5.00;1.41\n"
+        ";math;2;5.50;5.00;6.00;5.50;5.00;6.00;0.50\n"
+        ";bio;%d;3.00;1.00;5.00;3.00;1.00;5.00;1.41\n"
+        ";late;1;%d.00;%d.00;%d.00;%d.00;%d.00;%d.00;0.00\n", rows, rows,
+        1 + (rows - 1) % 5, 1 + (rows - 1) % 5, 1 + (rows - 1) % 5, 1 + (rows - 1) % 5, 1 + (rows - 1) % 5, 1 + (rows - 1) % 5);
+    assrt(streq(out, expected));
+    free(out);
+
+    // several grade books can not be watched
+    cmd_out_file = open_memstream(&out, &len);
+    jmp_buf jmp;
+    cmd_exit_jmp = &jmp;
+    char *watch[] = { "--watch" };
+    if (setjmp(jmp) == 0) command_status(1, watch);
+    cmd_exit_jmp = NULL;
+    fclose(cmd_out_file);
+    cmd_out_file = NULL;
+    assrt(cmd_exit_code == -1);
+    assrt(streq(out, "--watch is only available for a single grade book\n"));
+    free(out);
+    cmd_exit_code = 0;
+    opt_csvs = NULL;
+    n_opt_csvs = 0;
+    arena_free(&cmd_arena);
+    stats_sidecar_remove("./test_cgrade_dir/a.csv");
+    stats_sidecar_remove("./test_cgrade_dir/b.csv");
+    remove("./test_cgrade_dir/a.csv");
+    remove("./test_cgrade_dir/b.csv");
+    remove("./test_cgrade_dir/c.csv");
+    rmdir(dir);
+    return 1;
+}
+
+static int test_stats_watch() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5;\n");
+    StatsWatch w;
+    stats_watch_init(&w, TEST_CSV_FILE, false, NULL, 1);
+    assrt(w.t.n == 1 && w.t.stats[0].count == 1);
+    assrt(!stats_watch_update(&w));
+    csv_write_string(fd, "bio;4;\nmath;6");
+    assrt(stats_watch_update(&w)); // the row without newline is left for later
+    assrt(w.t.n == 2 && w.t.stats[0].count == 1);
+    csv_write_string(fd, ";\n");
+    assrt(stats_watch_update(&w));
+    assrt(w.t.stats[0].count == 2 && w.t.stats[0].sum == 1100);
+    size_t offset = w.offset;
+    opt_default_csv = TEST_CSV_FILE;
+    command_rm(0, NULL); // shrinks the file
+    assrt(stats_watch_update(&w));
+    assrt(w.offset < offset && w.t.stats[0].count == 1);
+    char *rm_bio[] = { "bio", "4" };
+    command_rm(2, rm_bio); // replaces the file
+    assrt(stats_watch_update(&w));
+    assrt(w.t.n == 1 && streq(w.t.stats[0].name, "math"));
+    stats_watch_free(&w);
+    close(fd);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_csv_index() {
+    char *block = "subject;grade;comment\nmathematics;5.25;first exam of the semester\nbio;4\n;;\n";
+    size_t len = strlen(block);
+    uint32_t expected[128];
+    uint32_t positions[128];
+    size_t n = csv_index_scalar(block, len, expected);
+    assrt(n == 11);
+    assrt(expected[0] == 7);
+    assrt(expected[2] == 21);
+    assrt(expected[10] == len - 1);
+
+    n = csv_index(block, len, positions);
+    assrt(n == 11);
+    assrt(memcmp(positions, expected, sizeof(uint32_t) * n) == 0);
+#ifdef CSV_INDEX_X86
+    n = csv_index_sse2(block, len, positions);
+    assrt(n == 11);
+    assrt(memcmp(positions, expected, sizeof(uint32_t) * n) == 0);
+    if (__builtin_cpu_supports("avx2")) {
+        n = csv_index_avx2(block, len, positions);
+        assrt(n == 11);
+        assrt(memcmp(positions, expected, sizeof(uint32_t) * n) == 0);
+    }
+#endif
+    return 1;
+}
+
+static int test_csv_stats_parallel() {
+    int fd = test_csv_create("subject;grade;comment\n");
+    CsvWriter w;
+    csv_writer_init(&w, fd);
+    char subject[16];
+    char grade[16];
+    for (int i = 0; i < 200000; i++) {
+        sprintf(subject, "s%d", (i * 7) % 31);
+        sprintf(grade, "%d.%d", 1 + i % 6, i % 10);
+        csv_write_row(&w, subject, grade, "some comment");
+    }
+    csv_writer_free(&w);
+
+    StatsTable serial, parallel;
+    stats_table_init(&serial);
+    stats_table_init(&parallel);
+    csv_stats(fd, &serial, 0, 1, NULL, NULL);
+    csv_stats(fd, &parallel, 0, 4, NULL, NULL);
+    assrt(serial.n == 31);
+    assrt(parallel.n == serial.n);
+    for (int i = 0; i < serial.n; i++) {
+        assrt(streq(serial.stats[i].name, parallel.stats[i].name));
+        assrt(serial.stats[i].count == parallel.stats[i].count);
+        assrt(serial.stats[i].sum == parallel.stats[i].sum);
+        assrt(serial.stats[i].min == parallel.stats[i].min);
+        assrt(serial.stats[i].max == parallel.stats[i].max);
+    }
+    stats_table_free(&serial);
+    stats_table_free(&parallel);
+    close(fd);
+    test_csv_delete();
+    return 1;
+}
+
+static int test_csv_stats_cached() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;\n");
+    StatsTable t;
+    stats_table_init(&t);
+    csv_stats_cached(TEST_CSV_FILE, fd, &t, 1);
+    assrt(t.n == 2);
+    stats_table_free(&t);
+    assrt(access(TEST_CSV_FILE SIDECAR_SUFFIX, F_OK) == 0);
+
+    // appended rows are added to the cached stats
+    write(fd, "math;4;\nbio;6;\n", 15);
+    stats_table_init(&t);
+    csv_stats_cached(TEST_CSV_FILE, fd, &t, 1);
+    assrt(t.n == 3);
+    assrt(stats_table_get(&t, "math", 4)->count == 2);
+    assrt(stats_table_get(&t, "math", 4)->sum == 520 + 400);
+    stats_table_free(&t);
+
+    // a row that is still being written is not cached
+    write(fd, "math;3", 6);
+    stats_table_init(&t);
+    csv_stats_cached(TEST_CSV_FILE, fd, &t, 1);
+    assrt(stats_table_get(&t, "math", 4)->sum == 520 + 400 + 300);
+    stats_table_free(&t);
+    write(fd, ".5;\n", 4);
+    stats_table_init(&t);
+    csv_stats_cached(TEST_CSV_FILE, fd, &t, 1);
+    assrt(stats_table_get(&t, "math", 4)->count == 3);
+    assrt(stats_table_get(&t, "math", 4)->sum == 520 + 400 + 350);
+    stats_table_free(&t);
+    close(fd);
+
+    // a rewritten csv rebuilds the stats
+    fd = test_csv_create("subject;grade;comment\nmath;5;\n");
+    stats_table_init(&t);
+    csv_stats_cached(TEST_CSV_FILE, fd, &t, 1);
+    assrt(t.n == 1);
+    assrt(t.stats[0].sum == 500);
+    stats_table_free(&t);
+    close(fd);
+    test_csv_delete();
+    stats_sidecar_remove(TEST_CSV_FILE);
+    return 1;
+}
+
+static int test_row_filter() {
+    RowFilter f;
+    row_filter_init(&f);
+    char subjects[] = "subject=math,bio*";
+    char min[] = "grade>=4";
+    char max[] = "grade<6";
+    char comment[] = "comment~exam";
+    assrt(row_filter_parse(&f, subjects, &cmd_arena));
+    assrt(row_filter_parse(&f, min, &cmd_arena));
+    assrt(row_filter_parse(&f, max, &cmd_arena));
+    assrt(row_filter_parse(&f, comment, &cmd_arena));
+    assrt(f.n_subjects == 2 && f.min == 400 && f.max == 599);
+    assrt(!row_filter_parse(&f, subjects, &cmd_arena)); // one subject predicate
+    assrt(!row_filter_parse(&f, "grade", &cmd_arena));
+    assrt(!row_filter_parse(&f, "grade~4", &cmd_arena));
+    assrt(!row_filter_parse(&f, "subject=", &cmd_arena));
+    assrt(!row_filter_parse(&f, "name=x", &cmd_arena));
+    assrt(row_filter_subject(&f, "math", 4) && row_filter_subject(&f, "biology", 7));
+    assrt(!row_filter_subject(&f, "maths", 5) && !row_filter_subject(&f, "chem", 4));
+    assrt(row_filter_comment(&f, "final exam", 10) && !row_filter_comment(&f, "exa", 3));
+
+    int fd = test_csv_create("subject;grade;comment\nmath;5;exam 1\nmath;6;exam 2\nbio;4;lab\nbiology;4.5;exam\nchem;5;exam\nmath;x;exam\n");
+    StatsTable t;
+    stats_table_init(&t);
+    csv_stats(fd, &t, 0, 1, NULL, &f);
+    assrt(t.n == 2);
+    assrt(stats_table_get(&t, "math", 4)->count == 1);
+    assrt(stats_table_get(&t, "biology", 7)->sum == 450);
+    stats_table_free(&t);
+    close(fd);
+
+    GradeBook gb;
+    gradebook_init(&gb, true);
+    gb.filter = &f;
+    gradebook_load(&gb, TEST_CSV_FILE);
+    assrt(gb.n_rows == 2);
+    assrt(streq(gb.subjects[0].comments[0], "exam 1"));
+    gradebook_free(&gb);
+
+    // the binary book evaluates the same predicates on its columns
+    gradebook_init(&gb, true);
+    gradebook_load(&gb, TEST_CSV_FILE);
+    gb.binary = true;
+    gb.rewrite = true;
+    gradebook_save(&gb, TEST_CSV_FILE);
+    gradebook_free(&gb);
+    fd = open(TEST_CSV_FILE, O_RDONLY);
+    CsvMap m;
+    bin_map_open(&m, fd);
+    stats_table_init(&t);
+    bin_stats(&m, &t, &f);
+    assrt(t.n == 2);
+    assrt(stats_table_get(&t, "math", 4)->count == 1);
+    stats_table_free(&t);
+    csv_map_close(&m);
+    close(fd);
+    arena_free(&cmd_arena);
+    test_csv_delete();
+    return 1;
+}
+
 static int test_cmd_get_option() {
     char *cmd_1[] = { "cgrade", "--csv", "cgrade.csv", "somethingElse" };
     char *cmd_2[] = { "cgrade", "--csv" }; 
@@ -103,6 +988,261 @@ static int test_cmd_skip_options() {
     return 1;
 }
 
+static int test_cmd_split() {
+    char line[] = "  add math 5.5 \"second exam\"  'a b'c\n";
+    char **argv;
+    int argc = cmd_split(line, &argv);
+    assrt(argc == 6);
+    assrt(streq(argv[0], APP_NAME));
+    assrt(streq(argv[1], "add"));
+    assrt(streq(argv[3], "5.5"));
+    assrt(streq(argv[4], "second exam"));
+    assrt(streq(argv[5], "a bc"));
+    assrt(argv[6] == NULL);
+    free(argv);
+
+    char empty[] = " \n";
+    argc = cmd_split(empty, &argv);
+    assrt(argc == 1);
+    free(argv);
+    return 1;
+}
+
+static int test_serve_request() {
+    int fd = test_csv_create("subject;grade;comment\nmath;5.2;First Exam\n");
+    close(fd);
+    serve_default_csv = TEST_CSV_FILE;
+    char add[] = "add physics 4.5 \"Lab work\"";
+    char *resp;
+    size_t len;
+    serve_request(add, &resp, &len);
+    assrt(len == strlen("0 29\nadded grade 4.50 to physics!\n"));
+    assrt(memcmp(resp, "0 29\nadded grade 4.50 to physics!\n", len) == 0);
+    free(resp);
+
+    char rm[] = "--csv " TEST_CSV_FILE " rm bio 4";
+    serve_request(rm, &resp, &len);
+    assrt(memcmp(resp, "1 ", 2) == 0);
+    free(resp);
+    assrt(n_served_books == 1);
+
+    // the server must not read its own stdin, also without a loaded book
+    serving = true;
+    char bulk[] = "--csv /dev/null add --stdin";
+    serve_request(bulk, &resp, &len);
+    serving = false;
+    assrt(memcmp(resp, "0 ", 2) != 0);
+    assrt(n_served_books == 1);
+    free(resp);
+
+    char *content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nmath;5.2;First Exam\nphysics;4.5;Lab work\n"));
+    free(content);
+
+    // a failing save fails the request, not the server
+    for (int i = 0; i < 6; i++) {
+        char more[] = "add bio 4 \"long enough to defer compaction\"";
+        serve_request(more, &resp, &len);
+        free(resp);
+    }
+    RmTarget other[] = { { "physics", "4.5", 0, 0, false } };
+    assrt(csv_remove_rows(TEST_CSV_FILE, other, 1) == 1); // the served book misses this
+    char stale[] = "rm math 5.2";
+    serve_request(stale, &resp, &len);
+    assrt(memcmp(resp, "1 ", 2) == 0);
+    free(resp);
+    char reloaded[] = "rm math 5.2";
+    serve_request(reloaded, &resp, &len);
+    assrt(memcmp(resp, "0 ", 2) == 0);
+    free(resp);
+    serve_books_free();
+    test_csv_delete();
+    return 1;
+}
+
+static void *test_libcgrade_thread(void *arg) {
+    CgradeBook *book;
+    if (cgrade_open((char *) arg, CGRADE_CREATE, &book) != CGRADE_OK) return arg;
+    for (int i = 0; i < 50; i++) {
+        if (cgrade_add(book, "math", "5", NULL) != CGRADE_OK) return arg;
+    }
+    CgradeStats st;
+    int res = cgrade_stats(book, NULL, &st);
+    cgrade_close(book);
+    return res == CGRADE_OK && st.count == 50 ? NULL : arg;
+}
+
+static int test_time_index() {
+    int64_t time;
+    assrt(time_arg_parse("@1700000000", &time) && time == 1700000000);
+    assrt(time_arg_parse("2026-09-01", &time) && time_arg_parse("2026-09-01T08:30", &time));
+    assrt(time_arg_parse("2026-09-01T08:30:15", &time));
+    assrt(!time_arg_parse("2026-13-01", &time) && !time_arg_parse("2026-09-01T08", &time));
+    assrt(!time_arg_parse("@", &time) && !time_arg_parse("yesterday", &time));
+
+    // 3 blocks and a partial one, times 1000, 1001, ... with a row
+    // that is written out of order
+    int n_rows = TIME_INDEX_STRIDE * 3 + 10;
+    int fd = test_csv_create(CSV_HEADER_TIMED "\n");
+    CsvWriter w;
+    csv_writer_init(&w, fd);
+    char row[64];
+    for (int i = 0; i < n_rows; i++) {
+        int n = snprintf(row, sizeof(row), "s%d;%d;%d;c\n", i % 3, 1 + i % 6, i == 10 ? 900 : 1000 + i);
+        csv_writer_write(&w, row, n);
+    }
+    csv_writer_free(&w);
+    close(fd);
+    time_index_remove(TEST_CSV_FILE);
+
+    RowFilter f;
+    row_filter_init(&f);
+    f.has_time = true;
+    f.since = 1000 + TIME_INDEX_STRIDE * 2 + 5;
+    f.until = 1000 + TIME_INDEX_STRIDE * 3 + 2;
+    StatsTable t;
+    stats_table_init(&t);
+    stats_collect_file(TEST_CSV_FILE, &t, 1, &f);
+    int64_t count = 0;
+    for (int i = 0; i < t.n; i++) count += t.stats[i].count;
+    assrt(count == TIME_INDEX_STRIDE - 3);
+    stats_table_free(&t);
+    assrt(access(TEST_CSV_FILE TIME_INDEX_SUFFIX, F_OK) == 0);
+
+    // the range covers the third and the fourth block only
+    fd = open(TEST_CSV_FILE, O_RDONLY);
+    CsvMap m;
+    assrt(csv_map_open(&m, fd) && m.timed);
+    struct stat st;
+    fstat(fd, &st);
+    TimeIndex idx;
+    time_index_load(&idx, TEST_CSV_FILE, &m, &st);
+    assrt(idx.h.n_entries == 4 && idx.h.last_rows == 10 && idx.h.size == m.size);
+    assrt(!time_index_extend(&idx, &m));
+    assrt(idx.entries[0].min == 900 && idx.entries[1].max == 1000 + TIME_INDEX_STRIDE * 2 - 1);
+    size_t start, end;
+    time_index_range(&idx, f.since, f.until, m.size, &start, &end);
+    assrt(start == idx.entries[2].offset && end == m.size);
+    time_index_range(&idx, 0, 1000 + TIME_INDEX_STRIDE, m.size, &start, &end);
+    assrt(start == idx.entries[0].offset && end == idx.entries[1].offset);
+    time_index_range(&idx, 5000, 6000, m.size, &start, &end);
+    assrt(start == m.size && end == m.size);
+    time_index_free(&idx);
+    csv_map_close(&m);
+    close(fd);
+
+    // appended rows extend the index, a truncation removes it
+    opt_default_csv = TEST_CSV_FILE;
+    char *add[] = { "s0", "5", "new" };
+    command_add(3, add);
+    f.since = INT64_MIN;
+    f.until = INT64_MAX;
+    stats_table_init(&t);
+    stats_collect_file(TEST_CSV_FILE, &t, 1, &f);
+    assrt(stats_table_get(&t, "s0", 2)->count == (n_rows + 2) / 3 + 1);
+    stats_table_free(&t);
+    char *content = test_csv_content();
+    assrt(strstr(content, "\ns0;5;") != NULL && strstr(content, ";new\n") != NULL);
+    free(content);
+    command_rm(0, NULL);
+    assrt(access(TEST_CSV_FILE TIME_INDEX_SUFFIX, F_OK) == -1);
+
+    // time and comment predicates see the fields of timed rows
+    char comment[] = "comment~c";
+    assrt(row_filter_parse(&f, comment, &cmd_arena));
+    f.since = 1001;
+    assrt(row_filter_rest(&f, "1001;c", 6, true) && !row_filter_rest(&f, "1000;c", 6, true));
+    assrt(!row_filter_rest(&f, "1001;", 5, true) && !row_filter_rest(&f, "1001;c", 6, false));
+    test_csv_delete();
+    return 1;
+}
+
+static int test_libcgrade() {
+    CgradeBook *book;
+    remove(TEST_CSV_FILE);
+    assrt(cgrade_open(TEST_CSV_FILE, 0, &book) == CGRADE_ERR_NOT_FOUND);
+    assrt(book == NULL);
+    assrt(cgrade_open(TEST_CSV_FILE, CGRADE_CREATE, &book) == CGRADE_OK);
+    assrt(cgrade_add(book, "math", "5.5", "first exam") == CGRADE_OK);
+    assrt(cgrade_add(book, "bio", "4", NULL) == CGRADE_OK);
+    assrt(cgrade_add(book, "math", "4.5", "a;b") == CGRADE_OK);
+    assrt(cgrade_add(book, "math", "seven", NULL) == CGRADE_ERR_INVALID);
+    assrt(strcmp(cgrade_error(book), "invalid grade 'seven'") == 0);
+    assrt(cgrade_add(book, "ma;th", "5", NULL) == CGRADE_ERR_INVALID);
+    assrt(cgrade_add(book, "math", "5", "two\nlines") == CGRADE_ERR_INVALID);
+
+    CgradeStats st;
+    assrt(cgrade_stats(book, "math", &st) == CGRADE_OK);
+    assrt(st.count == 2 && st.avg == 5 && st.min == 4.5 && st.max == 5.5);
+    assrt(cgrade_stats(book, NULL, &st) == CGRADE_OK);
+    assrt(st.count == 3 && st.subject == NULL);
+    assrt(cgrade_stats(book, "chemistry", &st) == CGRADE_OK && st.count == 0);
+
+    CgradeStats *stats;
+    int n;
+    const char *where[] = { "grade>=4.5" };
+    assrt(cgrade_subjects(book, where, 1, &stats, &n) == CGRADE_OK);
+    assrt(n == 1 && strcmp(stats[0].subject, "math") == 0 && stats[0].count == 2);
+    cgrade_stats_free(stats, n);
+    const char *bad[] = { "grade>>4" };
+    assrt(cgrade_subjects(book, bad, 1, &stats, &n) == CGRADE_ERR_INVALID);
+    assrt(cgrade_subjects(book, NULL, 0, &stats, &n) == CGRADE_OK);
+    assrt(n == 2 && strcmp(stats[1].subject, "bio") == 0);
+    cgrade_stats_free(stats, n);
+
+    assrt(cgrade_remove(book, "math", "5.5", 1) == CGRADE_ERR_NOT_FOUND);
+    assrt(strcmp(cgrade_error(book), "grade 5.5 of math not found") == 0);
+    assrt(cgrade_remove(book, "math", "5.5", 0) == CGRADE_OK);
+    assrt(cgrade_error(book)[0] == '\0');
+    assrt(cgrade_remove_last(book) == CGRADE_OK);
+    char *content = test_csv_content();
+    assrt(streq(content, "subject;grade;comment\nbio;4;\n"));
+    free(content);
+    assrt(cgrade_remove_last(book) == CGRADE_OK);
+    assrt(cgrade_remove_last(book) == CGRADE_ERR_NOT_FOUND);
+    cgrade_close(book);
+    test_csv_delete();
+
+    // a failing command returns an error instead of exiting
+    assrt(cgrade_open(".", 0, &book) == CGRADE_OK);
+    assrt(cgrade_add(book, "math", "5", NULL) == CGRADE_ERR_IO);
+    assrt(strncmp(cgrade_error(book), "open file failed", 16) == 0);
+    cgrade_close(book);
+
+    // a failing write releases the csv lock, the next write must not block
+    assrt(cgrade_open(TEST_CSV_FILE, CGRADE_CREATE, &book) == CGRADE_OK);
+    assrt(cgrade_add(book, "math", "5", NULL) == CGRADE_OK);
+    assrt(mkdir(TEST_CSV_FILE DEL_SUFFIX, S_IRWXU) == 0); // the delete log can not be written
+    assrt(cgrade_remove(book, "math", "5", 0) == CGRADE_ERR_IO);
+    assrt(strncmp(cgrade_error(book), "open delete log failed", 22) == 0);
+    rmdir(TEST_CSV_FILE DEL_SUFFIX);
+    alarm(10); // fail instead of hanging
+    assrt(cgrade_add(book, "bio", "4", NULL) == CGRADE_OK);
+    assrt(cgrade_remove(book, "math", "5", 0) == CGRADE_OK);
+    alarm(0);
+    cgrade_close(book);
+    test_csv_delete();
+    stats_sidecar_remove(TEST_CSV_FILE);
+
+    // independent handles on several threads
+    char paths[4][32];
+    pthread_t threads[4];
+    for (int i = 0; i < 4; i++) {
+        snprintf(paths[i], sizeof(paths[i]), "./test_cgrade_lib%d.csv", i);
+        remove(paths[i]);
+        pthread_create(&threads[i], NULL, test_libcgrade_thread, paths[i]);
+    }
+    for (int i = 0; i < 4; i++) {
+        void *res;
+        pthread_join(threads[i], &res);
+        assrt(res == NULL);
+        remove(paths[i]);
+        csv_dead_remove(paths[i]);
+        stats_sidecar_remove(paths[i]);
+    }
+    return 1;
+}
+
 static int command_rm_test() {
 
     return 1;
@@ -122,6 +1262,35 @@ static void all_tests() {
     ctest_run(test_subject_create);
     ctest_run(test_cmd_get_option);
     ctest_run(test_cmd_skip_options);
+    ctest_run(test_cmd_split);
+    ctest_run(test_serve_request);
+    ctest_run(test_grade_parse);
+    ctest_run(test_csv_grades);
+    ctest_run(test_csv_map_grades);
+    ctest_run(test_gradebook);
+    ctest_run(test_bin_book);
+    ctest_run(test_command_convert);
+    ctest_run(test_status_malformed);
+    ctest_run(test_csv_init_file);
+    ctest_run(test_csv_stats);
+    ctest_run(test_grade_hist);
+    ctest_run(test_profile);
+    ctest_run(test_csv_reader_next_row);
+    ctest_run(test_arena);
+    ctest_run(test_out_table);
+    ctest_run(test_status_format);
+    ctest_run(test_status_files);
+    ctest_run(test_stats_watch);
+    ctest_run(test_csv_index);
+    ctest_run(test_csv_stats_parallel);
+    ctest_run(test_csv_stats_cached);
+    ctest_run(test_row_filter);
+    ctest_run(test_command_rm);
+    ctest_run(test_command_add_bulk);
+    ctest_run(test_csv_remove_rows);
+    ctest_run(test_csv_dead);
+    ctest_run(test_libcgrade);
+    ctest_run(test_time_index);
     ctest_run(test_playground);
 }
 
@@ -0,0 +1,264 @@
+#include "cgrade.c"
+#include "libcgrade.h"
+
+#define LIB_ERROR_SIZE 256
+
+/**
+ * A grade book opened by cgrade_open. Commands report errors to
+ * cmd_out, which points to the error buffer of the handle while
+ * one of its calls runs.
+ */
+struct cgrade_book {
+    char *path;
+    char error[LIB_ERROR_SIZE];
+    FILE *err;  // writes to error
+    int mark;   // resources of the caller when the running call started
+};
+
+/*
+ * Runs the rest of a library call with cmd_exit_jmp set, so that a
+ * failing command returns CGRADE_ERR_IO from the call instead of
+ * exiting the process. Every return of the call has to go through
+ * lib_end.
+ */
+#define LIB_BEGIN(book) \
+    jmp_buf lib_jmp; \
+    jmp_buf *lib_outer_jmp = cmd_exit_jmp; \
+    FILE *lib_outer_out = cmd_out_file; \
+    lib_begin(book); \
+    if (setjmp(lib_jmp) != 0) return lib_end(book, lib_outer_jmp, lib_outer_out, CGRADE_ERR_IO); \
+    cmd_exit_jmp = &lib_jmp
+
+static void lib_begin(CgradeBook *book) {
+    book->mark = cmd_n_resources;
+    book->error[0] = '\0';
+    rewind(book->err);
+    cmd_out_file = book->err;
+}
+
+/**
+ * Ends a library call: terminates the error message, releases what
+ * a failed call left open (locks, maps, grade books), frees the
+ * allocations of the call and restores the state of the caller.
+ * returns res
+ */
+static int lib_end(CgradeBook *book, jmp_buf *outer_jmp, FILE *outer_out, int res) {
+    fflush(book->err);
+    long n = ftell(book->err);
+    if (n >= LIB_ERROR_SIZE) n = LIB_ERROR_SIZE - 1;
+    while (n > 0 && book->error[n - 1] == '\n') n--;
+    book->error[n < 0 ? 0 : n] = '\0';
+    cmd_release(book->mark);
+    arena_free(&cmd_arena);
+    cmd_exit_jmp = outer_jmp;
+    cmd_out_file = outer_out;
+    return res;
+}
+
+/**
+ * Sets the error message of a call that fails without a command
+ * error. Must be called between lib_begin and lib_end.
+ * returns res
+ */
+static int lib_fail(CgradeBook *book, int res, char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(book->err, fmt, args);
+    va_end(args);
+    return res;
+}
+
+/**
+ * returns whether s can be stored in a field of a csv row. The
+ * comment is the rest of the row and may contain delimiters.
+ */
+static bool lib_field_valid(const char *s, bool subject) {
+    if (subject && s[0] == '\0') return false;
+    for (; *s != '\0'; s++) {
+        if (*s == '\n' || *s == '\r' || (subject && *s == CSV_DELIMITER)) return false;
+    }
+    return true;
+}
+
+/**
+ * Copies the aggregates of st to out.
+ */
+static void lib_stats(const char *name, SubjectStats *st, CgradeStats *out) {
+    out->subject = name;
+    out->count = st->count;
+    out->avg = st->count > 0 ? grade_avg(st->sum, st->count) : 0;
+    out->min = (double) st->min / GRADE_SCALE;
+    out->max = (double) st->max / GRADE_SCALE;
+}
+
+/**
+ * Creates the grade book of a new handle if it does not exist and
+ * CGRADE_CREATE is given.
+ */
+static int lib_open(CgradeBook *book, int flags) {
+    LIB_BEGIN(book);
+    int res = CGRADE_OK;
+    struct stat st;
+    if (stat(book->path, &st) == -1) {
+        if (errno != ENOENT) cmd_exit_errno("stat failed");
+        if (flags & CGRADE_CREATE) csv_init_file(book->path, flags & CGRADE_TIMED); // false if someone else was faster
+        else res = lib_fail(book, CGRADE_ERR_NOT_FOUND, "%s does not exist", book->path);
+    }
+    return lib_end(book, lib_outer_jmp, lib_outer_out, res);
+}
+
+int cgrade_open(const char *path, int flags, CgradeBook **o_book) {
+    *o_book = NULL;
+    CgradeBook *book = calloc(1, sizeof(CgradeBook));
+    book->path = strdup(path);
+    book->err = fmemopen(book->error, LIB_ERROR_SIZE, "w");
+    if (book->err == NULL) {
+        free(book->path);
+        free(book);
+        return CGRADE_ERR_IO;
+    }
+    int res = lib_open(book, flags);
+    if (res != CGRADE_OK) {
+        cgrade_close(book);
+        return res;
+    }
+    *o_book = book;
+    return CGRADE_OK;
+}
+
+void cgrade_close(CgradeBook *book) {
+    if (book == NULL) return;
+    fclose(book->err);
+    free(book->path);
+    free(book);
+}
+
+const char *cgrade_error(CgradeBook *book) {
+    return book->error;
+}
+
+int cgrade_add(CgradeBook *book, const char *subject, const char *grade, const char *comment) {
+    LIB_BEGIN(book);
+    int res = CGRADE_OK;
+    if (comment == NULL) comment = "";
+    if (!lib_field_valid(subject, true)) {
+        res = lib_fail(book, CGRADE_ERR_INVALID, "invalid subject '%s'", subject);
+    } else if (!grade_valid((char *) grade)) {
+        res = lib_fail(book, CGRADE_ERR_INVALID, "invalid grade '%s'", grade);
+    } else if (!lib_field_valid(comment, false)) {
+        res = lib_fail(book, CGRADE_ERR_INVALID, "invalid comment '%s'", comment);
+    } else {
+        char *c = (char *) comment;
+        if (csv_is_timed(book->path)) c = csv_time_comment(&cmd_arena, time(NULL), c, strlen(c));
+        GradeBook gb;
+        gradebook_init(&gb, true);
+        gradebook_own(&gb);
+        gradebook_add(&gb, (char *) subject, (char *) grade, c);
+        gradebook_save(&gb, book->path);
+        gradebook_free(&gb);
+    }
+    return lib_end(book, lib_outer_jmp, lib_outer_out, res);
+}
+
+int cgrade_remove(CgradeBook *book, const char *subject, const char *grade, int index) {
+    LIB_BEGIN(book);
+    bool removed;
+    if (index < 0) {
+        removed = false;
+    } else if (book_is_binary(book->path)) {
+        GradeBook gb;
+        gradebook_init(&gb, true);
+        gradebook_own(&gb);
+        gradebook_load(&gb, book->path);
+        removed = gradebook_remove(&gb, (char *) subject, (char *) grade, index);
+        gradebook_save(&gb, book->path);
+        gradebook_free(&gb);
+    } else {
+        RmTarget target = { (char *) subject, (char *) grade, index, 0, false };
+        removed = csv_remove_rows(book->path, &target, 1) == 1;
+    }
+    int res = CGRADE_OK;
+    if (!removed) res = lib_fail(book, CGRADE_ERR_NOT_FOUND, "grade %s of %s not found", grade, subject);
+    return lib_end(book, lib_outer_jmp, lib_outer_out, res);
+}
+
+int cgrade_remove_last(CgradeBook *book) {
+    LIB_BEGIN(book);
+    bool removed;
+    if (book_is_binary(book->path)) {
+        GradeBook gb;
+        gradebook_init(&gb, true);
+        gradebook_own(&gb);
+        gradebook_load(&gb, book->path);
+        removed = gradebook_remove_last(&gb);
+        gradebook_save(&gb, book->path);
+        gradebook_free(&gb);
+    } else {
+        char *line;
+        csv_remove_last_row(book->path, &line);
+        removed = line != NULL;
+    }
+    int res = CGRADE_OK;
+    if (!removed) res = lib_fail(book, CGRADE_ERR_NOT_FOUND, "no grades to remove");
+    return lib_end(book, lib_outer_jmp, lib_outer_out, res);
+}
+
+int cgrade_stats(CgradeBook *book, const char *subject, CgradeStats *o_stats) {
+    LIB_BEGIN(book);
+    StatsTable t;
+    stats_table_init(&t);
+    stats_collect_file(book->path, &t, 1, NULL);
+    SubjectStats total;
+    status_total(&t, (char *) subject, &total);
+    lib_stats(subject, &total, o_stats);
+    stats_table_free(&t);
+    return lib_end(book, lib_outer_jmp, lib_outer_out, CGRADE_OK);
+}
+
+int cgrade_subjects(CgradeBook *book, const char **where, int n_where, CgradeStats **o_stats, int *o_n) {
+    *o_stats = NULL;
+    *o_n = 0;
+    LIB_BEGIN(book);
+    RowFilter filter;
+    row_filter_init(&filter);
+    for (int i = 0; i < n_where; i++) {
+        if (!row_filter_parse(&filter, (char *) where[i], &cmd_arena)) {
+            int res = lib_fail(book, CGRADE_ERR_INVALID, "invalid expression '%s'", where[i]);
+            return lib_end(book, lib_outer_jmp, lib_outer_out, res);
+        }
+    }
+    StatsTable t;
+    stats_table_init(&t);
+    stats_collect_file(book->path, &t, 1, n_where > 0 ? &filter : NULL);
+    CgradeStats *stats = malloc(sizeof(CgradeStats) * (t.n ? t.n : 1));
+    int n = 0;
+    for (int i = 0; i < t.n; i++) {
+        if (t.stats[i].count == 0) continue; // subjects with malformed grades only
+        lib_stats(t.stats[i].name, &t.stats[i], &stats[n]);
+        t.stats[i].name = NULL; // owned by stats now
+        n++;
+    }
+    stats_table_free(&t);
+    *o_stats = stats;
+    *o_n = n;
+    return lib_end(book, lib_outer_jmp, lib_outer_out, CGRADE_OK);
+}
+
+void cgrade_stats_free(CgradeStats *stats, int n) {
+    if (stats == NULL) return;
+    for (int i = 0; i < n; i++) free((char *) stats[i].subject);
+    free(stats);
+}
+
+int cgrade_run(int argc, char **argv) {
+    jmp_buf jmp;
+    jmp_buf *outer = cmd_exit_jmp;
+    int mark = cmd_n_resources;
+    cmd_exit_jmp = &jmp;
+    cmd_exit_code = 0;
+    if (setjmp(jmp) == 0) command(argc, argv);
+    cmd_exit_jmp = outer;
+    cmd_release(mark);
+    fflush(cmd_out);
+    return cmd_exit_code;
+}
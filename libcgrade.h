@@ -0,0 +1,118 @@
+#ifndef LIBCGRADE_H
+#define LIBCGRADE_H
+
+#include <stdint.h>
+
+/* libcgrade: the grade book operations of cgrade as a library.
+ *
+ * CgradeBook *book;
+ * cgrade_open("grades.csv", CGRADE_CREATE, &book);
+ * cgrade_add(book, "math", "5.25", "test 1");
+ * CgradeStats st;
+ * cgrade_stats(book, "math", &st);   // count, avg, min and max of math
+ * cgrade_remove(book, "math", "5.25", 0);
+ * cgrade_close(book);
+ *
+ * Every call works on the file (csv or binary grade book), so
+ * handles of several threads or processes see each other's changes.
+ * Writes take the same file lock as the cgrade command line tool.
+ * Functions return CGRADE_OK or a negative error code and never
+ * exit the process, the message of the last error of a handle is
+ * returned by cgrade_error. Handles are independent and may be used
+ * by different threads at the same time, a single handle must not.
+ * cgrade_run is the exception to both, see there.
+ */
+
+#define CGRADE_API __attribute__((visibility("default")))
+
+#define CGRADE_OK 0
+#define CGRADE_ERR_IO -1        // a system call failed or the file is malformed
+#define CGRADE_ERR_NOT_FOUND -2 // no such file or grade
+#define CGRADE_ERR_INVALID -3   // invalid argument
+
+#define CGRADE_CREATE 1 // cgrade_open creates a missing csv
+#define CGRADE_TIMED 2  // with CGRADE_CREATE: the rows of the csv carry the time they are added at
+
+typedef struct cgrade_book CgradeBook;
+
+/**
+ * Aggregates of the grades of a subject (or of all subjects).
+ * Grades are given as numbers, e.g. 5.25.
+ */
+typedef struct cgrade_stats {
+    const char *subject; // NULL for all subjects
+    int64_t count;
+    double avg;
+    double min;
+    double max;
+} CgradeStats;
+
+/**
+ * Opens a grade book.
+ * arg(path)   the csv or binary grade book
+ * arg(flags)  0, CGRADE_CREATE or CGRADE_CREATE | CGRADE_TIMED
+ * arg(o_book) output parameter, the handle (NULL on error)
+ * returns CGRADE_ERR_NOT_FOUND if the file does not exist
+ */
+CGRADE_API int cgrade_open(const char *path, int flags, CgradeBook **o_book);
+
+CGRADE_API void cgrade_close(CgradeBook *book);
+
+/**
+ * returns the message of the last failed call of the handle, empty
+ * if there is none
+ */
+CGRADE_API const char *cgrade_error(CgradeBook *book);
+
+/**
+ * Appends a grade, rows of timed books get the current time.
+ * arg(comment) may be NULL
+ * returns CGRADE_ERR_INVALID for a malformed grade, an empty subject,
+ *         a subject with ';' or a line break in subject or comment
+ */
+CGRADE_API int cgrade_add(CgradeBook *book, const char *subject, const char *grade, const char *comment);
+
+/**
+ * Removes the index-th (0-based) grade of subject that is written
+ * as grade, like `cgrade rm SUBJECT GRADE INDEX`.
+ * returns CGRADE_ERR_NOT_FOUND if there is no such grade
+ */
+CGRADE_API int cgrade_remove(CgradeBook *book, const char *subject, const char *grade, int index);
+
+/**
+ * Removes the last added grade.
+ * returns CGRADE_ERR_NOT_FOUND if the book has no grades
+ */
+CGRADE_API int cgrade_remove_last(CgradeBook *book);
+
+/**
+ * Aggregates the grades of a subject, or of all subjects if subject
+ * is NULL. A subject without grades has count 0.
+ */
+CGRADE_API int cgrade_stats(CgradeBook *book, const char *subject, CgradeStats *o_stats);
+
+/**
+ * Aggregates the grades of every subject, in the order of the first
+ * grade of each subject.
+ * arg(where)    status --where expressions the grades have to
+ *               match, e.g. "grade>=4" (may be NULL)
+ * arg(n_where)  size of where
+ * arg(o_stats)  output parameter, to be freed with cgrade_stats_free
+ * arg(o_n)      output parameter, the number of subjects
+ * returns CGRADE_ERR_INVALID for a malformed expression
+ */
+CGRADE_API int cgrade_subjects(CgradeBook *book, const char **where, int n_where, CgradeStats **o_stats, int *o_n);
+
+CGRADE_API void cgrade_stats_free(CgradeStats *stats, int n);
+
+/**
+ * Runs the command line tool: cgrade_run(argc, argv) behaves like
+ * the cgrade binary, but returns its exit code. The options of a
+ * command are process wide, so only one thread may run commands at
+ * a time. Some commands do not return: serve and status --watch run
+ * until the process is interrupted, --profile prints its report when
+ * the process exits.
+ */
+CGRADE_API int cgrade_run(int argc, char **argv);
+
+#endif